@@ -0,0 +1,179 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#if defined(_WIN32)
+#if defined(COLORQUANTIZATION_EXPORTS)
+#define EXPORT_API extern "C" __declspec(dllexport)
+#else
+#define EXPORT_API extern "C" __declspec(dllimport)
+#endif
+#else
+#define EXPORT_API extern "C" __attribute__((visibility("default")))
+#endif
+
+using color_t = uint32_t;
+
+struct SpaceShockColorExtractor;
+struct Palette;
+struct DitherStream;
+struct QuantizationQueue;
+struct QuantizationJob;
+
+// Error between the source image and its quantized result, channels in r, g, b order.
+struct QuantizationMetrics {
+    uint64_t pixelCount;
+    uint64_t squaredError[3];
+    uint32_t maxError[3];
+    uint64_t usage[256];
+};
+
+// Hot-path counters of an extractor since create/reset. All zero unless built with COLORQUANTIZATION_STATS.
+struct ExtractorStats {
+    uint64_t colorTableCalls;
+    uint64_t absorbCalls;
+    uint64_t absorbCellsVisited;
+    uint64_t absorbCellsNonEmpty;
+    uint64_t absorbCellsChanged;
+    uint64_t kernelRebuilds;
+    uint64_t mapInserts;
+    uint64_t mapErases;
+    uint64_t selectIterations;
+    uint64_t reduceIterations;
+    // wall time of each get_color_table stage, summed over calls
+    uint64_t sortNanoseconds;
+    uint64_t forceNanoseconds;
+    uint64_t selectNanoseconds;
+    uint64_t reduceNanoseconds;
+    // putting back the counts the call consumed
+    uint64_t restoreNanoseconds;
+};
+
+// Hot-path counters of a palette since creation. All zero unless built with COLORQUANTIZATION_STATS.
+struct PaletteStats {
+    uint64_t cacheHits;
+    uint64_t cacheMisses;
+    uint64_t candidatesExamined;
+    // slow lookups by number of candidates examined: bucket k holds counts in (2^(k-1), 2^k]
+    uint64_t candidateHistogram[9];
+};
+
+// Limits for get_color_table_budget, 0 for none. Work counts absorb kernel cells and reduce-phase color
+// comparisons, so unlike the deadline it gives the same table on every run.
+struct ColorTableBudget {
+    uint64_t deadlineNanoseconds;
+    uint64_t maxWork;
+};
+
+// Shortcuts get_color_table_budget took to stay within its budget.
+enum ColorTableShortcut : uint32_t {
+    ShortcutSmallKernels = 1, // absorb kernels were capped below their scheduled size
+    ShortcutSkipAbsorb = 2, // low-count colors were selected without absorbing their neighbors
+    ShortcutRaisedSkipMinCount = 4, // the reduce phase dropped count levels it could not finish in time
+    ShortcutReduceStopped = 8, // the reduce phase stopped in the middle of a count level
+    ShortcutDeadline = 16, // the deadline passed before the table was complete; it is complete nonetheless
+};
+
+// Pixel patterns for add_bitmap_sampled.
+enum SampleMode : uint32_t {
+    SampleStride, // the middle pixel of every run of `ratio` pixels in scan order
+    SampleStratified, // one pixel at a hashed position in every cell of about `ratio` pixels
+    SampleLowDiscrepancy, // a Fibonacci lattice, evenly spread without a grid that could alias with the image
+};
+
+// Distance between colors, used to find the nearest palette color and to merge colors in get_color_table.
+enum ColorMetric : uint32_t {
+    MetricRgb, // squared Euclidean distance in sRGB
+    MetricLuma, // squared sRGB differences weighted by the luma coefficients 0.299, 0.587 and 0.114
+    MetricOklab, // squared Euclidean distance in Oklab, close to perceived difference
+};
+
+// A rectangle of pixels for tiles_quantize.
+struct TileRect {
+    size_t x;
+    size_t y;
+    size_t width;
+    size_t height;
+};
+
+using read_pixels_callback = size_t(*)(void* userData, color_t* buffer, size_t bufferLength);
+using job_callback = void(*)(void* userData, size_t colorCount);
+using task_callback = void(*)(void* taskData);
+// Must eventually call task(taskData) exactly once, on any thread.
+using executor_callback = void(*)(void* executorData, task_callback task, void* taskData);
+
+// One frame for a QuantizationQueue: extract a palette from `pixels`, then map or dither them into `indexes`.
+// Every buffer must stay valid until the job completes.
+struct QuantizationJobDesc {
+    color_t* pixels; // modified in place when dithering
+    size_t width;
+    size_t height;
+    uint8_t* indexes;
+    color_t* colorTable; // optional, receives the extracted colors
+    size_t tableLength;
+    const color_t* forceColors;
+    size_t forceColorCount;
+    bool optimize;
+    bool dither;
+    job_callback callback; // optional, runs on a worker thread before the job is marked done
+    void* userData;
+};
+
+// ========== SpaceShockColorExtractor ==========
+EXPORT_API SpaceShockColorExtractor* create();
+EXPORT_API SpaceShockColorExtractor* reset(SpaceShockColorExtractor* extractor);
+EXPORT_API void destroy(SpaceShockColorExtractor* extractor);
+EXPORT_API void add_bitmap(SpaceShockColorExtractor& extractor, const color_t* pixels, size_t pixelCount);
+EXPORT_API size_t add_bitmap_sampled(SpaceShockColorExtractor& extractor, const color_t* pixels, size_t width, size_t height, SampleMode mode, size_t ratio);
+EXPORT_API size_t add_bitmap_stream(SpaceShockColorExtractor& extractor, read_pixels_callback readPixels, void* userData, size_t bufferLength);
+EXPORT_API void remove_bitmap(SpaceShockColorExtractor& extractor, const color_t* pixels, size_t pixelCount);
+EXPORT_API void decay(SpaceShockColorExtractor& extractor, double factor);
+EXPORT_API double extractor_drift(const SpaceShockColorExtractor& extractor);
+EXPORT_API void add_histogram(SpaceShockColorExtractor& extractor, const color_t* colors, const uint32_t* counts, size_t colorCount);
+EXPORT_API size_t add_histogram_buffer(SpaceShockColorExtractor& extractor, const uint8_t* buffer, size_t bufferLength);
+EXPORT_API size_t get_histogram(const SpaceShockColorExtractor& extractor, uint8_t* buffer, size_t bufferLength);
+EXPORT_API size_t get_color_table(SpaceShockColorExtractor& extractor, color_t* colorTable, size_t tableLength, const color_t* forceColors, size_t forceColorCount);
+EXPORT_API size_t get_color_table_budget(SpaceShockColorExtractor& extractor, color_t* colorTable, size_t tableLength, const color_t* forceColors, size_t forceColorCount, const ColorTableBudget* budget, uint32_t* shortcuts);
+EXPORT_API size_t get_color_table_coarse(SpaceShockColorExtractor& extractor, color_t* colorTable, size_t tableLength, const color_t* forceColors, size_t forceColorCount, size_t channelBits);
+EXPORT_API bool extractor_set_metric(SpaceShockColorExtractor& extractor, ColorMetric metric);
+EXPORT_API bool extractor_stats(const SpaceShockColorExtractor& extractor, ExtractorStats* stats);
+
+// ========== palette ==========
+EXPORT_API Palette* palette_create(const color_t* colorTable, size_t tableLength, bool optimize);
+EXPORT_API Palette* palette_create_metric(const color_t* colorTable, size_t tableLength, bool optimize, ColorMetric metric);
+EXPORT_API ColorMetric palette_metric(const Palette& palette);
+EXPORT_API void palette_destroy(Palette* palette);
+EXPORT_API bool palette_update(Palette& palette, const uint8_t* indexes, const color_t* colors, size_t count);
+EXPORT_API void palette_map(Palette& palette, const color_t* pixels, uint8_t* indexes, size_t length);
+EXPORT_API void palette_dither(Palette& palette, color_t* pixels, uint8_t* indexes, size_t width, size_t height);
+EXPORT_API void palette_map_metrics(Palette& palette, const color_t* pixels, uint8_t* indexes, size_t length, QuantizationMetrics* metrics);
+EXPORT_API void palette_dither_metrics(Palette& palette, color_t* pixels, uint8_t* indexes, size_t width, size_t height, QuantizationMetrics* metrics);
+EXPORT_API DitherStream* palette_dither_stream_create(Palette& palette, size_t width, size_t height);
+EXPORT_API void palette_dither_stream_destroy(DitherStream* stream);
+EXPORT_API size_t palette_dither_stream_push(DitherStream& stream, color_t* pixels, uint8_t* indexes, size_t rowCount);
+EXPORT_API void palette_map_rgb(Palette& palette, const color_t* pixels, color_t* outPixels, uint8_t* indexes, size_t length);
+EXPORT_API size_t palette_packed_stride(size_t width, size_t bitDepth, size_t rowAlignment);
+EXPORT_API size_t palette_map_packed(Palette& palette, const color_t* pixels, uint8_t* indexes, size_t width, size_t height, size_t bitDepth, size_t rowAlignment);
+EXPORT_API size_t palette_dither_packed(Palette& palette, color_t* pixels, uint8_t* indexes, size_t width, size_t height, size_t bitDepth, size_t rowAlignment);
+EXPORT_API bool palette_save(Palette& palette, const char* filename, bool includeIndexMap);
+EXPORT_API Palette* palette_load(const char* filename);
+EXPORT_API const color_t* palette_color_table(const Palette& palette, size_t* tableLength);
+EXPORT_API bool palette_stats(const Palette& palette, PaletteStats* stats);
+
+// ========== scheduler ==========
+EXPORT_API bool scheduler_configure(size_t workerCount, const size_t* cpus, size_t cpuCount);
+EXPORT_API void scheduler_set_executor(executor_callback executor, void* executorData, size_t concurrency);
+EXPORT_API size_t scheduler_worker_count();
+
+// ========== job queue ==========
+EXPORT_API QuantizationQueue* job_queue_create(size_t concurrency, size_t maxPendingJobs);
+EXPORT_API void job_queue_destroy(QuantizationQueue* queue);
+EXPORT_API QuantizationJob* job_submit(QuantizationQueue& queue, const QuantizationJobDesc& desc);
+EXPORT_API bool job_done(const QuantizationJob& job);
+EXPORT_API size_t job_wait(QuantizationJob& job);
+EXPORT_API void job_release(QuantizationJob* job);
+
+// ========== tiles ==========
+EXPORT_API size_t tiles_grid(size_t width, size_t height, size_t tileWidth, size_t tileHeight, TileRect* tiles, size_t tileCapacity);
+EXPORT_API size_t tiles_quantize(const color_t* pixels, size_t width, size_t height, const TileRect* tiles, size_t tileCount, size_t tableLength, ColorMetric metric, color_t* colorTables, size_t* tableLengths, uint8_t* indexes);
@@ -7,9 +7,22 @@
 #include <algorithm>
 #include <cmath>
 #include <limits>
+#include <bit>
+#include <type_traits>
+#include <atomic>
+#include <thread>
+#include <fstream>
+#include <filesystem>
+#include "ColorQuantization.h"
 #include "default_init_allocator.h"
+#include "mapped_file.h"
+#include "stats.h"
+#include "scheduler.h"
+#include "color_metric.h"
 
-#define EXPORT_API extern "C" __declspec(dllexport)
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 #if __clang__
 #define LIKELY [[likely]]
@@ -17,42 +30,92 @@
 #define LIKELY
 #endif
 
+#if defined(_MSC_VER)
+#define NOINLINE __declspec(noinline)
+#else
+#define NOINLINE __attribute__((noinline))
+#endif
+
 using byte = uint8_t;
 using byte_vector = std::vector<byte>;
-using color_t = uint32_t;
 
 constexpr size_t N = 16;
 constexpr size_t CubeSize = 256 / N;
 constexpr size_t CubeCount = N * N * N;
+// pixels per parallel chunk; fixed so chunking never depends on the worker count
+constexpr size_t MapGrain = 0x10000;
 
-static constexpr int square_sum(int x, int y, int z) { return x * x + y * y + z * z; }
-
-static constexpr int square_sum(int x, int y) { return x * x + y * y; }
+static constexpr color_t cube_origin(size_t cubeIndex) {
+    return static_cast<color_t>((cubeIndex / (N * N) * CubeSize) << 16 | (cubeIndex / N % N * CubeSize) << 8 | (cubeIndex % N * CubeSize));
+}
 
 static constexpr int square_sum(int x) { return x * x; }
 
-static constexpr int color_distance(int r1, int g1, int b1, int r2, int g2, int b2) {
-    int dr = r1 - r2;
-    int dg = g1 - g2;
-    int db = b1 - b2;
-    return square_sum(dr, dg, db);
-}
-
 struct ListHead {
     uint32_t count, index;
 };
 
+struct NoMetrics {
+    static constexpr bool Enabled = false;
+
+    void add(color_t, color_t, byte) {}
+};
+
+struct ErrorMetrics : QuantizationMetrics {
+    static constexpr bool Enabled = true;
+
+    ErrorMetrics() : QuantizationMetrics{} {}
+
+    void add(color_t original, color_t quantized, byte index) {
+        int dr = abs(static_cast<int>((original >> 16) & 0xff) - static_cast<int>((quantized >> 16) & 0xff));
+        int dg = abs(static_cast<int>((original >> 8) & 0xff) - static_cast<int>((quantized >> 8) & 0xff));
+        int db = abs(static_cast<int>(original & 0xff) - static_cast<int>(quantized & 0xff));
+        squaredError[0] += square_sum(dr);
+        squaredError[1] += square_sum(dg);
+        squaredError[2] += square_sum(db);
+        maxError[0] = std::max<uint32_t>(maxError[0], dr);
+        maxError[1] = std::max<uint32_t>(maxError[1], dg);
+        maxError[2] = std::max<uint32_t>(maxError[2], db);
+        usage[index]++;
+        pixelCount++;
+    }
+
+    void merge(const QuantizationMetrics& other) {
+        for (size_t c = 0; c < 3; c++) {
+            squaredError[c] += other.squaredError[c];
+            maxError[c] = std::max(maxError[c], other.maxError[c]);
+        }
+        for (size_t i = 0; i < std::size(usage); i++) usage[i] += other.usage[i];
+        pixelCount += other.pixelCount;
+    }
+};
+
 
 struct Palette {
-    const std::vector<color_t> colorTable;
+    std::vector<color_t> colorTable;
+    ColorMetric metric;
+    PaletteStats stats;
 
-    Palette(const color_t* colorTable, size_t tableLength) : colorTable(color_table(colorTable, tableLength)) {
+    Palette(const color_t* colorTable, size_t tableLength, ColorMetric metric) : colorTable(color_table(colorTable, tableLength)), metric(metric), stats{} {
     }
 
-    virtual void palette_map(const color_t* pixels, byte* indexes, size_t length) = 0;
+    virtual void palette_map(const color_t* pixels, byte* indexes, size_t length, QuantizationMetrics* metrics) = 0;
+
+    virtual void palette_dither(color_t* pixels, byte* indexes, size_t width, size_t height, QuantizationMetrics* metrics) = 0;
+
+    virtual void palette_dither_rows(color_t* pixels, byte* indexes, size_t width, size_t height, size_t rowStart, size_t rowCount, int32_t* errors) = 0;
+
+    virtual void palette_map_rgb(const color_t* pixels, color_t* outPixels, byte* indexes, size_t length) = 0;
+
+    virtual void palette_map_packed(const color_t* pixels, byte* indexes, size_t width, size_t height, size_t bitDepth, size_t stride) = 0;
+
+    virtual void palette_dither_packed(color_t* pixels, byte* indexes, size_t width, size_t height, size_t bitDepth, size_t stride) = 0;
+
+    virtual const byte_vector* candidate_list() const { return nullptr; }
 
-    virtual void palette_dither(color_t* pixels, byte* indexes, size_t width, size_t height) = 0;
+    virtual bool palette_update(const byte* indexes, const color_t* colors, size_t count) = 0;
 
+    virtual void fill_index_map(byte* indexMap) = 0;
 
     virtual ~Palette() noexcept {}
 
@@ -64,36 +127,286 @@ private:
     }
 };
 
+static void count_candidates(PaletteStats& stats, uint32_t examined) {
+    if constexpr (StatsEnabled) {
+        stats_add(stats.cacheMisses);
+        stats_add(stats.candidatesExamined, examined);
+        stats_add(stats.candidateHistogram[std::min<size_t>(std::bit_width(examined - 1), std::size(stats.candidateHistogram) - 1)]);
+    }
+}
+
+static void expand_colors(const color_t* colorTable, const byte* indexes, color_t* pixels, size_t length) {
+    size_t i = 0;
+
+#if defined(__AVX2__)
+    for (; i + 8 <= length; i += 8) {
+        __m256i index8 = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(indexes + i)));
+        __m256i color8 = _mm256_i32gather_epi32(reinterpret_cast<const int*>(colorTable), index8, sizeof(color_t));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(pixels + i), color8);
+    }
+#endif
+
+    for (; i < length; i++) {
+        pixels[i] = colorTable[indexes[i]];
+    }
+}
+
+struct DitherKernel {
+    static constexpr double Attenuation = 0.75;
+    static constexpr size_t Rows = 2;
+    static constexpr size_t Cols = 3;
+    static constexpr int Matrix[Rows][Cols]{
+        { 0, 0, 7 },
+        { 3, 5, 1 },
+    };
+
+    size_t count = 0;
+    size_t rows[Rows * Cols]{};
+    size_t cols[Rows * Cols]{};
+    uint16_t weights[Rows * Cols]{};
+
+    DitherKernel() {
+        int weightSum = 0;
+
+        for (size_t y = 0; y < Rows; y++) {
+            for (size_t x = 0; x < Cols; x++) {
+                if (Matrix[y][x] == 0) continue;
+                weightSum += Matrix[y][x];
+                rows[count] = y;
+                cols[count] = x;
+                count++;
+            }
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            weights[i] = static_cast<uint16_t>(Matrix[rows[i]][cols[i]] * 65535 * Attenuation / weightSum);
+        }
+    }
+};
+
+static color_t diffuse_error(color_t dstPixel, int64_t errR, int64_t errG, int64_t errB, uint16_t weight) {
+    int64_t newR = (dstPixel & 0xff0000) + (errR * weight >> 16);
+    int64_t newG = (dstPixel & 0x00ff00) + (errG * weight >> 16);
+    int64_t newB = (dstPixel & 0x0000ff) + (errB * weight >> 16);
+    if (newR & ~0xffffffLL) newR = ~(newR >> 63);
+    if (newG & ~0x00ffffLL) newG = ~(newG >> 63);
+    if (newB & ~0x0000ffLL) newB = ~(newB >> 63) & 0x0000ff;
+    newR &= 0xff0000;
+    newG &= 0x00ff00;
+    return static_cast<color_t>(newR | newG | newB);
+}
+
+// Writes palette indexes row by row, packing 8 / Bits pixels per byte with the leftmost pixel in the
+// most significant bits (the layout of 1/2/4-bpp PNG and BMP). Rows are `stride` bytes apart and the
+// padding at the end of every row is zeroed.
+template<size_t Bits>
+struct IndexWriter {
+    static_assert(Bits == 1 || Bits == 2 || Bits == 4 || Bits == 8);
+
+    byte* row;
+    size_t stride;
+
+    void begin_row() {
+        if constexpr (Bits < 8) {
+            std::fill_n(row, stride, 0);
+        }
+    }
+
+    void write(size_t x, byte index) {
+        if constexpr (Bits == 8) {
+            row[x] = index;
+        } else {
+            constexpr size_t PixelsPerByte = 8 / Bits;
+            row[x / PixelsPerByte] |= static_cast<byte>(index << ((PixelsPerByte - 1 - x % PixelsPerByte) * Bits));
+        }
+    }
+
+    void next_row() {
+        row += stride;
+    }
+};
+
 template<typename TPalette>
 struct PaletteImpl : public Palette {
-    PaletteImpl(const color_t* colorTable, size_t tableLength) : Palette(colorTable, tableLength) {
+    PaletteImpl(const color_t* colorTable, size_t tableLength, ColorMetric metric) : Palette(colorTable, tableLength, metric) {
 
     }
 
-    void palette_map(const color_t* pixels, byte* indexes, size_t length) override final {
-        palette_map_no_dither(static_cast<TPalette*>(this), pixels, indexes, length);
+    void palette_map(const color_t* pixels, byte* indexes, size_t length, QuantizationMetrics* metrics) override final {
+        TPalette* palette = static_cast<TPalette*>(this);
+        if (metrics) {
+            // per-chunk metrics are summed in chunk order
+            std::vector<ErrorMetrics> chunkMetrics((length + MapGrain - 1) / MapGrain);
+            parallel_for(length, MapGrain, [&](size_t begin, size_t end) {
+                palette_map_no_dither(palette, pixels + begin, indexes + begin, end - begin, chunkMetrics[begin / MapGrain]);
+            });
+            ErrorMetrics errorMetrics;
+            for (const ErrorMetrics& m : chunkMetrics) errorMetrics.merge(m);
+            *metrics = errorMetrics;
+        } else {
+            parallel_for(length, MapGrain, [&](size_t begin, size_t end) {
+                NoMetrics noMetrics;
+                palette_map_no_dither(palette, pixels + begin, indexes + begin, end - begin, noMetrics);
+            });
+        }
     }
 
-    void palette_dither(color_t* pixels, byte* indexes, size_t width, size_t height) override final {
-        palette_map_dither(static_cast<TPalette*>(this), pixels, indexes, width, height);
+    void palette_dither(color_t* pixels, byte* indexes, size_t width, size_t height, QuantizationMetrics* metrics) override final {
+        if (metrics) {
+            ErrorMetrics errorMetrics;
+            palette_map_dither(static_cast<TPalette*>(this), pixels, IndexWriter<8>{ indexes, width }, width, height, errorMetrics);
+            *metrics = errorMetrics;
+        } else {
+            NoMetrics noMetrics;
+            palette_map_dither(static_cast<TPalette*>(this), pixels, IndexWriter<8>{ indexes, width }, width, height, noMetrics);
+        }
     }
 
+    void palette_dither_rows(color_t* pixels, byte* indexes, size_t width, size_t height, size_t rowStart, size_t rowCount, int32_t* errors) override final {
+        palette_map_dither_rows(static_cast<TPalette*>(this), pixels, indexes, width, height, rowStart, rowCount, errors);
+    }
 
-    static void palette_map_no_dither(TPalette* palette, const color_t* pixels, byte* indexes, size_t length) {
+    void fill_index_map(byte* indexMap) override final {
+        TPalette* palette = static_cast<TPalette*>(this);
+        parallel_for(0x1000000, MapGrain, [&](size_t begin, size_t end) {
+            for (size_t pixel = begin; pixel < end; pixel++) {
+                indexMap[pixel] = palette->palette_index(static_cast<color_t>(pixel));
+            }
+        });
+    }
+
+    void palette_map_rgb(const color_t* pixels, color_t* outPixels, byte* indexes, size_t length) override final {
+        TPalette* palette = static_cast<TPalette*>(this);
+        parallel_for(length, MapGrain, [&](size_t begin, size_t end) {
+            palette_map_expand(palette, pixels + begin, outPixels + begin, indexes ? indexes + begin : nullptr, end - begin);
+        });
+    }
+
+    void palette_map_packed(const color_t* pixels, byte* indexes, size_t width, size_t height, size_t bitDepth, size_t stride) override final {
+        TPalette* palette = static_cast<TPalette*>(this);
+        parallel_for(height, std::max<size_t>(MapGrain / std::max<size_t>(width, 1), 1), [&](size_t begin, size_t end) {
+            const color_t* rowPixels = pixels + begin * width;
+            byte* rowIndexes = indexes + begin * stride;
+            switch (bitDepth) {
+                case 1: palette_map_no_dither_packed<1>(palette, rowPixels, rowIndexes, width, end - begin, stride); break;
+                case 2: palette_map_no_dither_packed<2>(palette, rowPixels, rowIndexes, width, end - begin, stride); break;
+                case 4: palette_map_no_dither_packed<4>(palette, rowPixels, rowIndexes, width, end - begin, stride); break;
+                case 8: palette_map_no_dither_packed<8>(palette, rowPixels, rowIndexes, width, end - begin, stride); break;
+            }
+        });
+    }
+
+    void palette_dither_packed(color_t* pixels, byte* indexes, size_t width, size_t height, size_t bitDepth, size_t stride) override final {
+        NoMetrics noMetrics;
+        switch (bitDepth) {
+            case 1: palette_map_dither(static_cast<TPalette*>(this), pixels, IndexWriter<1>{ indexes, stride }, width, height, noMetrics); break;
+            case 2: palette_map_dither(static_cast<TPalette*>(this), pixels, IndexWriter<2>{ indexes, stride }, width, height, noMetrics); break;
+            case 4: palette_map_dither(static_cast<TPalette*>(this), pixels, IndexWriter<4>{ indexes, stride }, width, height, noMetrics); break;
+            case 8:
+                palette_map_dither(static_cast<TPalette*>(this), pixels, IndexWriter<8>{ indexes, stride }, width, height, noMetrics);
+                // whole-byte rows are written index by index, so their padding is cleared here
+                for (size_t y = 0; y < height; y++) std::fill(indexes + y * stride + width, indexes + (y + 1) * stride, 0);
+                break;
+        }
+    }
+
+    bool palette_update(const byte* indexes, const color_t* colors, size_t count) override final;
+
+
+    template<typename TMetrics>
+    static void palette_map_no_dither(TPalette* palette, const color_t* pixels, byte* indexes, size_t length, TMetrics& metrics) {
         for (size_t i = 0; i < length; i++) {
             indexes[i] = palette->palette_index(pixels[i] & 0xffffff);
+            if constexpr (TMetrics::Enabled) {
+                metrics.add(pixels[i], palette->colorTable[indexes[i]], indexes[i]);
+            }
+        }
+    }
+
+    // Maps one block of pixels to indexes before expanding it, so `outPixels` may alias `pixels`.
+    static void palette_map_expand(TPalette* palette, const color_t* pixels, color_t* outPixels, byte* indexes, size_t length) {
+        constexpr size_t BlockSize = 256;
+        byte blockIndexes[BlockSize];
+
+        for (size_t offset = 0; offset < length; offset += BlockSize) {
+            size_t count = std::min(BlockSize, length - offset);
+            byte* currIndexes = indexes ? indexes + offset : blockIndexes;
+
+            for (size_t i = 0; i < count; i++) {
+                currIndexes[i] = palette->palette_index(pixels[offset + i] & 0xffffff);
+            }
+
+            expand_colors(palette->colorTable.data(), currIndexes, outPixels + offset, count);
         }
     }
 
-    static void palette_map_dither(TPalette* palette, color_t* pixels, byte* indexes, size_t width, size_t height);
+    template<size_t Bits>
+    static void palette_map_no_dither_packed(TPalette* palette, const color_t* pixels, byte* indexes, size_t width, size_t height, size_t stride) {
+        constexpr size_t PixelsPerByte = 8 / Bits;
+
+        for (size_t y = 0; y < height; y++, pixels += width, indexes += stride) {
+            size_t x = 0, i = 0;
+            for (; x + PixelsPerByte <= width; i++) {
+                uint32_t packed = 0;
+                for (size_t k = 0; k < PixelsPerByte; k++, x++) {
+                    packed = (packed << Bits) | palette->palette_index(pixels[x] & 0xffffff);
+                }
+                indexes[i] = static_cast<byte>(packed);
+            }
+
+            if (x < width) {
+                uint32_t packed = 0;
+                size_t k = 0;
+                for (; x < width; k++, x++) {
+                    packed = (packed << Bits) | palette->palette_index(pixels[x] & 0xffffff);
+                }
+                indexes[i++] = static_cast<byte>(packed << ((PixelsPerByte - k) * Bits));
+            }
+
+            std::fill(indexes + i, indexes + stride, 0);
+        }
+    }
+
+    template<typename TIndexWriter, typename TMetrics>
+    static void palette_map_dither(TPalette* palette, color_t* pixels, TIndexWriter indexes, size_t width, size_t height, TMetrics& metrics);
+
+    template<typename TIndexWriter>
+    static void palette_map_dither_wavefront(TPalette* palette, color_t* pixels, TIndexWriter indexes, size_t width, size_t height);
+
+    static void palette_map_dither_rows(TPalette* palette, color_t* pixels, byte* indexes, size_t width, size_t height, size_t rowStart, size_t rowCount, int32_t* errors);
+};
+
+// Palette colors as points of the metric, so lookups never convert them again.
+template<typename TMetric>
+struct MetricPoints {
+    using Metric = TMetric;
+
+    std::vector<MetricPoint> points;
+
+    MetricPoints(const color_t* colorTable, size_t tableLength) {
+        set_points(colorTable, tableLength);
+    }
+
+    void set_points(const color_t* colorTable, size_t tableLength) {
+        points.resize(tableLength);
+        for (size_t i = 0; i < tableLength; i++) points[i] = TMetric::point(colorTable[i] & 0xffffff);
+    }
 };
 
-struct OptimizationPalette {
+template<typename TMetric>
+struct OptimizationPalette : MetricPoints<TMetric> {
+    static constexpr bool HasCandidateList = true;
+
     byte_vector list;
 
     OptimizationPalette(const color_t* colorTable, size_t tableLength);
 
-    byte slow_map(const std::vector<color_t>& colorTable, color_t pixel) const {
+    OptimizationPalette(const color_t* colorTable, size_t tableLength, byte_vector list) : MetricPoints<TMetric>(colorTable, tableLength), list(std::move(list)) {}
+
+    template<typename TCache>
+    void rebuild(const std::vector<color_t>& colorTable, const std::array<bool, 256>& changed, TCache& cache);
+
+    byte slow_map(color_t pixel, PaletteStats& stats) const {
         int r = reinterpret_cast<uint8_t*>(&pixel)[2];
         int g = reinterpret_cast<uint8_t*>(&pixel)[1];
         int b = reinterpret_cast<uint8_t*>(&pixel)[0];
@@ -104,48 +417,57 @@ struct OptimizationPalette {
         const ListHead& listHead = reinterpret_cast<const ListHead*>(list.data())[cubeIndex];
         uint32_t count = listHead.count;
         const byte* colorList = &list[CubeCount * sizeof(ListHead) + listHead.index];
-        if (count == 1) return colorList[0];
+        if (count == 1) {
+            count_candidates(stats, 1);
+            return colorList[0];
+        }
 
+        MetricPoint point = TMetric::point(pixel);
         for (uint32_t i = 0; i < count; i++) {
             int colorIndex = colorList[i];
-            int r0 = reinterpret_cast<const uint8_t*>(&colorTable[colorIndex])[2];
-            int g0 = reinterpret_cast<const uint8_t*>(&colorTable[colorIndex])[1];
-            int b0 = reinterpret_cast<const uint8_t*>(&colorTable[colorIndex])[0];
-            int dist = color_distance(r0, g0, b0, r, g, b);
-            if (dist == 0) return static_cast<byte>(colorIndex);
+            int dist = metric_distance<TMetric>(this->points[colorIndex], point);
+            if (dist == 0) {
+                count_candidates(stats, i + 1);
+                return static_cast<byte>(colorIndex);
+            }
             if (dist < minDist) {
                 minDist = dist;
                 findIndex = colorIndex;
             }
         }
 
+        count_candidates(stats, count);
         return static_cast<byte>(findIndex);
     }
 };
 
-struct NoOptimizationPalette {
-    byte slow_map(const std::vector<color_t>& colorTable, color_t pixel) const {
-        int r1 = reinterpret_cast<uint8_t*>(&pixel)[2];
-        int g1 = reinterpret_cast<uint8_t*>(&pixel)[1];
-        int b1 = reinterpret_cast<uint8_t*>(&pixel)[0];
+template<typename TMetric>
+struct NoOptimizationPalette : MetricPoints<TMetric> {
+    static constexpr bool HasCandidateList = false;
+
+    NoOptimizationPalette(const color_t* colorTable, size_t tableLength) : MetricPoints<TMetric>(colorTable, tableLength) {}
+
+    byte slow_map(color_t pixel, PaletteStats& stats) const {
+        const std::vector<MetricPoint>& points = this->points;
+        MetricPoint point = TMetric::point(pixel);
         int minDist = std::numeric_limits<int>::max();
         size_t findIndex = 0;
-        for (size_t i = 0; i < colorTable.size(); i++) {
-            color_t pixel2 = colorTable[i];
-            int r2 = reinterpret_cast<uint8_t*>(&pixel2)[2];
-            int g2 = reinterpret_cast<uint8_t*>(&pixel2)[1];
-            int b2 = reinterpret_cast<uint8_t*>(&pixel2)[0];
-            int dist = color_distance(r1, g1, b1, r2, g2, b2);
+        size_t i = 0;
+        for (; i < points.size(); i++) {
+            int dist = metric_distance<TMetric>(points[i], point);
             if (dist < minDist) {
                 findIndex = i;
                 minDist = dist;
                 if (dist == 0) break;
             }
         }
+        count_candidates(stats, static_cast<uint32_t>(std::min(i + 1, points.size())));
         return static_cast<byte>(findIndex);
     }
 };
 
+// Cache entries may be filled by several threads mapping at once. Racing writers store the same value, and in
+// the double cache the release on the mask bit publishes the index written before it.
 struct DoubleCachePalette {
     std::array<byte, 0x1000000 / 8> masks;
     std::array<byte, 0x1000000> indexMap;
@@ -154,6 +476,16 @@ struct DoubleCachePalette {
         masks.fill(0);
         indexMap.fill(0);
     }
+
+    void clear_cube(size_t cubeIndex) {
+        color_t origin = cube_origin(cubeIndex);
+        for (size_t r = 0; r < CubeSize; r++) {
+            for (size_t g = 0; g < CubeSize; g++) {
+                color_t rowStart = origin + static_cast<color_t>(r << 16 | g << 8);
+                std::fill_n(&masks[rowStart >> 3], CubeSize / 8, 0);
+            }
+        }
+    }
 };
 
 struct SingleCachePalette {
@@ -162,219 +494,171 @@ struct SingleCachePalette {
     SingleCachePalette() {
         indexMap.fill(0);
     }
+
+    void clear_cube(size_t cubeIndex) {
+        color_t origin = cube_origin(cubeIndex);
+        for (size_t r = 0; r < CubeSize; r++) {
+            for (size_t g = 0; g < CubeSize; g++) {
+                color_t rowStart = origin + static_cast<color_t>(r << 16 | g << 8);
+                std::fill_n(&indexMap[rowStart], CubeSize, 0);
+            }
+        }
+    }
 };
 
 
 
 
-struct DoubleCacheOptimizationPalette : public PaletteImpl<DoubleCacheOptimizationPalette>, public OptimizationPalette, public DoubleCachePalette {
-    DoubleCacheOptimizationPalette(const color_t* colorTable, size_t tableLength) : PaletteImpl(colorTable, tableLength), OptimizationPalette(colorTable, tableLength) {
+template<typename TMetric>
+struct DoubleCacheOptimizationPalette : public PaletteImpl<DoubleCacheOptimizationPalette<TMetric>>, public OptimizationPalette<TMetric>, public DoubleCachePalette {
+    DoubleCacheOptimizationPalette(const color_t* colorTable, size_t tableLength) : PaletteImpl<DoubleCacheOptimizationPalette>(colorTable, tableLength, TMetric::Id), OptimizationPalette<TMetric>(colorTable, tableLength) {
 
     }
 
+    DoubleCacheOptimizationPalette(const color_t* colorTable, size_t tableLength, byte_vector list) : PaletteImpl<DoubleCacheOptimizationPalette>(colorTable, tableLength, TMetric::Id), OptimizationPalette<TMetric>(colorTable, tableLength, std::move(list)) {
+
+    }
+
+    const byte_vector* candidate_list() const override {
+        return &this->list;
+    }
+
     byte palette_index(color_t pixel) {
-        if (masks[pixel >> 3] & (1 << (pixel & 7))) LIKELY{
-            return indexMap[pixel];
+        if (std::atomic_ref(masks[pixel >> 3]).load(std::memory_order_acquire) & (1 << (pixel & 7))) LIKELY{
+            stats_add(this->stats.cacheHits);
+            return std::atomic_ref(indexMap[pixel]).load(std::memory_order_relaxed);
         }
 
-        byte index = slow_map(colorTable, pixel);
-        indexMap[pixel] = index;
-        masks[pixel >> 3] |= 1 << (pixel & 7);
+        return cache_miss(pixel);
+    }
+
+    NOINLINE byte cache_miss(color_t pixel) {
+        byte index = this->slow_map(pixel, this->stats);
+        std::atomic_ref(indexMap[pixel]).store(index, std::memory_order_relaxed);
+        std::atomic_ref(masks[pixel >> 3]).fetch_or(static_cast<byte>(1 << (pixel & 7)), std::memory_order_release);
         return index;
     }
 };
 
-struct DoubleCacheEuclideanPalette : public PaletteImpl<DoubleCacheEuclideanPalette>, public NoOptimizationPalette, public DoubleCachePalette {
-    DoubleCacheEuclideanPalette(const color_t* colorTable, size_t tableLength) : PaletteImpl(colorTable, tableLength) {
+template<typename TMetric>
+struct DoubleCacheEuclideanPalette : public PaletteImpl<DoubleCacheEuclideanPalette<TMetric>>, public NoOptimizationPalette<TMetric>, public DoubleCachePalette {
+    DoubleCacheEuclideanPalette(const color_t* colorTable, size_t tableLength) : PaletteImpl<DoubleCacheEuclideanPalette>(colorTable, tableLength, TMetric::Id), NoOptimizationPalette<TMetric>(colorTable, tableLength) {
 
     }
 
     byte palette_index(color_t pixel) {
-        if (masks[pixel >> 3] & (1 << (pixel & 7))) LIKELY{
-            return indexMap[pixel];
+        if (std::atomic_ref(masks[pixel >> 3]).load(std::memory_order_acquire) & (1 << (pixel & 7))) LIKELY{
+            stats_add(this->stats.cacheHits);
+            return std::atomic_ref(indexMap[pixel]).load(std::memory_order_relaxed);
         }
 
-        byte index = slow_map(colorTable, pixel);
-        indexMap[pixel] = index;
-        masks[pixel >> 3] |= 1 << (pixel & 7);
+        return cache_miss(pixel);
+    }
+
+    NOINLINE byte cache_miss(color_t pixel) {
+        byte index = this->slow_map(pixel, this->stats);
+        std::atomic_ref(indexMap[pixel]).store(index, std::memory_order_relaxed);
+        std::atomic_ref(masks[pixel >> 3]).fetch_or(static_cast<byte>(1 << (pixel & 7)), std::memory_order_release);
         return index;
     }
 };
 
-struct SingleCacheOptimizationPalette : public PaletteImpl<SingleCacheOptimizationPalette>, public OptimizationPalette, public SingleCachePalette {
-    SingleCacheOptimizationPalette(const color_t* colorTable, size_t tableLength) : PaletteImpl(colorTable, tableLength), OptimizationPalette(colorTable, tableLength) {
+template<typename TMetric>
+struct SingleCacheOptimizationPalette : public PaletteImpl<SingleCacheOptimizationPalette<TMetric>>, public OptimizationPalette<TMetric>, public SingleCachePalette {
+    SingleCacheOptimizationPalette(const color_t* colorTable, size_t tableLength) : PaletteImpl<SingleCacheOptimizationPalette>(colorTable, tableLength, TMetric::Id), OptimizationPalette<TMetric>(colorTable, tableLength) {
+
+    }
+
+    SingleCacheOptimizationPalette(const color_t* colorTable, size_t tableLength, byte_vector list) : PaletteImpl<SingleCacheOptimizationPalette>(colorTable, tableLength, TMetric::Id), OptimizationPalette<TMetric>(colorTable, tableLength, std::move(list)) {
 
     }
 
+    const byte_vector* candidate_list() const override {
+        return &this->list;
+    }
+
     byte palette_index(color_t pixel) {
-        if (indexMap[pixel]) LIKELY{
-            return indexMap[pixel] - 1;
+        if (byte cached = std::atomic_ref(indexMap[pixel]).load(std::memory_order_relaxed)) LIKELY{
+            stats_add(this->stats.cacheHits);
+            return cached - 1;
         }
 
-        byte index = slow_map(colorTable, pixel);
-        indexMap[pixel] = index + 1;
+        return cache_miss(pixel);
+    }
+
+    NOINLINE byte cache_miss(color_t pixel) {
+        byte index = this->slow_map(pixel, this->stats);
+        std::atomic_ref(indexMap[pixel]).store(static_cast<byte>(index + 1), std::memory_order_relaxed);
         return index;
     }
 };
 
-struct SingleCacheEuclideanPalette : public PaletteImpl<SingleCacheEuclideanPalette>, public NoOptimizationPalette, public SingleCachePalette {
-    SingleCacheEuclideanPalette(const color_t* colorTable, size_t tableLength) : PaletteImpl(colorTable, tableLength) {
+template<typename TMetric>
+struct SingleCacheEuclideanPalette : public PaletteImpl<SingleCacheEuclideanPalette<TMetric>>, public NoOptimizationPalette<TMetric>, public SingleCachePalette {
+    SingleCacheEuclideanPalette(const color_t* colorTable, size_t tableLength) : PaletteImpl<SingleCacheEuclideanPalette>(colorTable, tableLength, TMetric::Id), NoOptimizationPalette<TMetric>(colorTable, tableLength) {
 
     }
 
     byte palette_index(color_t pixel) {
-        if (indexMap[pixel]) LIKELY{
-            return indexMap[pixel] - 1;
+        if (byte cached = std::atomic_ref(indexMap[pixel]).load(std::memory_order_relaxed)) LIKELY{
+            stats_add(this->stats.cacheHits);
+            return cached - 1;
         }
 
-        byte index = slow_map(colorTable, pixel);
-        indexMap[pixel] = index + 1;
+        return cache_miss(pixel);
+    }
+
+    NOINLINE byte cache_miss(color_t pixel) {
+        byte index = this->slow_map(pixel, this->stats);
+        std::atomic_ref(indexMap[pixel]).store(static_cast<byte>(index + 1), std::memory_order_relaxed);
         return index;
     }
 };
 
-static int distance_to_rect(int r, int g, int b, int rs, int re, int gs, int ge, int bs, int be) {
-    if (r < rs) {
-        if (g < gs) {
-            if (b < bs) {
-                return square_sum(r - rs, g - gs, b - bs);
-            } else if (b > be) {
-                return square_sum(r - rs, g - gs, b - be);
-            } else {
-                return square_sum(r - rs, g - gs);
-            }
-        } else if (g > ge) {
-            if (b < bs) {
-                return square_sum(r - rs, g - ge, b - bs);
-            } else if (b > be) {
-                return square_sum(r - rs, g - ge, b - be);
-            } else {
-                return square_sum(r - rs, g - ge);
-            }
-        } else {
-            if (b < bs) {
-                return square_sum(r - rs, b - bs);
-            } else if (b > be) {
-                return square_sum(r - rs, b - be);
-            } else {
-                return square_sum(r - rs);
-            }
-        }
-    } else if (r > re) {
-        if (g < gs) {
-            if (b < bs) {
-                return square_sum(r - re, g - gs, b - bs);
-            } else if (b > be) {
-                return square_sum(r - re, g - gs, b - be);
-            } else {
-                return square_sum(r - re, g - gs);
-            }
-        } else if (g > ge) {
-            if (b < bs) {
-                return square_sum(r - re, g - ge, b - bs);
-            } else if (b > be) {
-                return square_sum(r - re, g - ge, b - be);
-            } else {
-                return square_sum(r - re, g - ge);
-            }
-        } else {
-            if (b < bs) {
-                return square_sum(r - re, b - bs);
-            } else if (b > be) {
-                return square_sum(r - re, b - be);
-            } else {
-                return square_sum(r - re);
-            }
-        }
-    } else {
-        if (g < gs) {
-            if (b < bs) {
-                return square_sum(g - gs, b - bs);
-            } else if (b > be) {
-                return square_sum(g - gs, b - be);
-            } else {
-                return square_sum(g - gs);
-            }
-        } else if (g > ge) {
-            if (b < bs) {
-                return square_sum(g - ge, b - bs);
-            } else if (b > be) {
-                return square_sum(g - ge, b - be);
-            } else {
-                return square_sum(g - ge);
-            }
-        } else {
-            if (b < bs) {
-                return square_sum(b - bs);
-            } else if (b > be) {
-                return square_sum(b - be);
-            } else {
-                return 0;
-            }
-        }
+// Serves lookups straight from a fully populated inverse colormap mapped from a palette file. The map is never
+// checked as a whole, which would touch all of its pages at load; instead every lookup is clamped to the table,
+// so a corrupt file maps to wrong colors but never reads past the table.
+struct MappedPalette : public PaletteImpl<MappedPalette> {
+    MappedFile file;
+    const byte* indexMap;
+    byte lastIndex;
+
+    MappedPalette(const color_t* colorTable, size_t tableLength, ColorMetric metric, MappedFile file, const byte* indexMap) : PaletteImpl(colorTable, tableLength, metric), file(std::move(file)), indexMap(indexMap), lastIndex(static_cast<byte>(tableLength - 1)) {
+
     }
-}
 
-static int distance_to_rect_farthest(int r, int g, int b, int rs, int re, int gs, int ge, int bs, int be) {
-    if (r < (rs + re) >> 1) {
-        if (g < (gs + ge) >> 1) {
-            if (b < (bs + be) >> 1) {
-                return color_distance(r, g, b, re, ge, be);
-            } else {
-                return color_distance(r, g, b, re, ge, bs);
-            }
-        } else {
-            if (b < (bs + be) >> 1) {
-                return color_distance(r, g, b, re, gs, be);
-            } else {
-                return color_distance(r, g, b, re, gs, bs);
-            }
-        }
-    } else {
-        if (g < (gs + ge) >> 1) {
-            if (b < (bs + be) >> 1) {
-                return color_distance(r, g, b, rs, ge, be);
-            } else {
-                return color_distance(r, g, b, rs, ge, bs);
-            }
-        } else {
-            if (b < (bs + be) >> 1) {
-                return color_distance(r, g, b, rs, gs, be);
-            } else {
-                return color_distance(r, g, b, rs, gs, bs);
-            }
-        }
+    byte palette_index(color_t pixel) {
+        stats_add(stats.cacheHits);
+        return std::min(indexMap[pixel], lastIndex);
     }
+};
+
+template<typename TMetric>
+static int distance_to_rect(const MetricPoint& point, const MetricBox& box) {
+    MetricPoint nearest;
+    for (size_t i = 0; i < 3; i++) nearest.v[i] = std::clamp(point.v[i], box.lo[i], box.hi[i]);
+    return metric_distance<TMetric>(point, nearest);
 }
 
-static bool vertical_intersect_to_rect(color_t color, color_t other, int r1, int r2, int g1, int g2, int b1, int b2) {
-    uint8_t colorR = reinterpret_cast<uint8_t*>(&color)[2];
-    uint8_t colorG = reinterpret_cast<uint8_t*>(&color)[1];
-    uint8_t colorB = reinterpret_cast<uint8_t*>(&color)[0];
-    uint8_t otherR = reinterpret_cast<uint8_t*>(&other)[2];
-    uint8_t otherG = reinterpret_cast<uint8_t*>(&other)[1];
-    uint8_t otherB = reinterpret_cast<uint8_t*>(&other)[0];
-    int rc = otherR - (otherR - colorR) / 2;
-    int gc = otherG - (otherG - colorG) / 2;
-    int bc = otherB - (otherB - colorB) / 2;
-    int vr = colorR - rc;
-    int vg = colorG - gc;
-    int vb = colorB - bc;
-    int dpr1 = vr * (r1 - rc);
-    int dpr2 = vr * (r2 - rc);
-    int dpg1 = vg * (g1 - gc);
-    int dpg2 = vg * (g2 - gc);
-    int dpb1 = vb * (b1 - bc);
-    int dpb2 = vb * (b2 - bc);
-    if (dpr1 + dpg1 + dpb1 < 0) return true;
-    if (dpr1 + dpg1 + dpb2 < 0) return true;
-    if (dpr1 + dpg2 + dpb1 < 0) return true;
-    if (dpr1 + dpg2 + dpb2 < 0) return true;
-    if (dpr2 + dpg1 + dpb1 < 0) return true;
-    if (dpr2 + dpg1 + dpb2 < 0) return true;
-    if (dpr2 + dpg2 + dpb1 < 0) return true;
-    if (dpr2 + dpg2 + dpb2 < 0) return true;
-    return false;
+template<typename TMetric>
+static int distance_to_rect_farthest(const MetricPoint& point, const MetricBox& box) {
+    MetricPoint farthest;
+    for (size_t i = 0; i < 3; i++) farthest.v[i] = point.v[i] < (box.lo[i] + box.hi[i]) >> 1 ? box.hi[i] : box.lo[i];
+    return metric_distance<TMetric>(point, farthest);
+}
+
+// Whether `other` is strictly nearer than `color` to some point of the box, i.e. whether their bisecting plane
+// cuts it. Coordinates are doubled so the midpoint is exact, and the sum is largest at the corner that takes
+// the larger term on every axis.
+template<typename TMetric>
+static bool vertical_intersect_to_rect(const MetricPoint& color, const MetricPoint& other, const MetricBox& box) {
+    int largest = 0;
+    for (size_t i = 0; i < 3; i++) {
+        int v = TMetric::Weights[i] * (other.v[i] - color.v[i]);
+        int mid = color.v[i] + other.v[i];
+        largest += std::max(v * (2 * box.lo[i] - mid), v * (2 * box.hi[i] - mid));
+    }
+    return largest > 0;
 }
 
 struct DistanceInfo {
@@ -386,42 +670,99 @@ struct DistanceInfo {
     }
 };
 
-OptimizationPalette::OptimizationPalette(const color_t* colorTable, size_t tableLength) {
-    list.reserve(CubeCount * (sizeof(ListHead) + 4));
-    list.resize(CubeCount * sizeof(ListHead), 0);
+// Builds the candidate list of one cube, appending it to `list`. The metric's box of the cube holds every pixel
+// of it, so a color is left out only if it cannot be the nearest to any point of the box.
+template<typename TMetric>
+static void build_cube_list(const MetricPoint* points, size_t tableLength, const uint16_t* bucket, const int* distCache, const DistanceInfo* sortedDistCache, size_t cubeIndex, ListHead& head, byte_vector& list) {
+    MetricBox box = TMetric::box(cube_origin(cubeIndex), CubeSize);
+
+    int dist;
+    int searchRange = 0;
+    size_t findIndex = 0;
+
+    if (bucket[cubeIndex] != 0) {
+        uint16_t currIndex = bucket[cubeIndex];
+        do {
+            int i = currIndex - CubeCount;
+            int dist = distance_to_rect_farthest<TMetric>(points[i], box);
+            if (dist > searchRange) {
+                searchRange = dist;
+                findIndex = i;
+            }
+            currIndex = bucket[currIndex];
+        } while (currIndex != 0);
 
-    uint16_t bucket[CubeCount + tableLength];
-    int distCache[tableLength][tableLength];
-    DistanceInfo sortedDistCache[tableLength][tableLength];
+        searchRange <<= 2;
+    } else {
+        int minDist = std::numeric_limits<int>::max();
+
+        for (size_t i = 0; i < tableLength; i++) {
+            int dist = distance_to_rect<TMetric>(points[i], box);
+            if (dist < minDist) {
+                minDist = dist;
+                findIndex = i;
+            }
+        }
+
+        searchRange = distance_to_rect_farthest<TMetric>(points[findIndex], box) << 2;
+    }
+
+
+    size_t indexesOffset = list.size();
+    uint32_t indexesCount = 1;
+    head.index = static_cast<uint32_t>(indexesOffset);
+    list.push_back(static_cast<byte>(findIndex));
+    const DistanceInfo* sortedDistLine = &sortedDistCache[findIndex * tableLength];
+
+    for (size_t i = 1; i < tableLength; i++) {
+        if (sortedDistLine[i].distance >= searchRange) break;
+        int otherIndex = sortedDistLine[i].otherIndex;
+        const int* distCacheLine = &distCache[otherIndex * tableLength];
+        int minDistIndex = findIndex;
+        int minDist = distCacheLine[findIndex];
+        const byte* indexes = &list[indexesOffset];
+
+        for (uint32_t j = 1; j < indexesCount; j++) {
+            dist = distCacheLine[indexes[j]];
+            if (dist < minDist) {
+                minDist = dist;
+                minDistIndex = indexes[j];
+            }
+        }
+
+        if (vertical_intersect_to_rect<TMetric>(points[minDistIndex], points[otherIndex], box)) {
+            list.push_back(static_cast<byte>(otherIndex));
+            indexesCount++;
+        }
+    }
+
+    head.count = indexesCount;
+}
+
+template<typename TMetric>
+OptimizationPalette<TMetric>::OptimizationPalette(const color_t* colorTable, size_t tableLength) : MetricPoints<TMetric>(colorTable, tableLength) {
+    const MetricPoint* points = this->points.data();
+    std::vector<uint16_t> bucket(CubeCount + tableLength);
+    std::vector<int> distCache(tableLength * tableLength);
+    std::vector<DistanceInfo> sortedDistCache(tableLength * tableLength);
 
     for (size_t i = 0; i < tableLength; i++) {
         for (size_t j = 0; j < i; j++) {
-            int r1 = reinterpret_cast<const uint8_t*>(colorTable + i)[2];
-            int g1 = reinterpret_cast<const uint8_t*>(colorTable + i)[1];
-            int b1 = reinterpret_cast<const uint8_t*>(colorTable + i)[0];
-            int r2 = reinterpret_cast<const uint8_t*>(colorTable + j)[2];
-            int g2 = reinterpret_cast<const uint8_t*>(colorTable + j)[1];
-            int b2 = reinterpret_cast<const uint8_t*>(colorTable + j)[0];
-            int dist = color_distance(r1, g1, b1, r2, g2, b2);
-
-            sortedDistCache[i][j].otherIndex = j;
-            sortedDistCache[i][j].distance = dist;
-            sortedDistCache[j][i].otherIndex = i;
-            sortedDistCache[j][i].distance = dist;
-            distCache[i][j] = dist;
-            distCache[j][i] = dist;
-        }
-        sortedDistCache[i][i].otherIndex = i;
-        sortedDistCache[i][i].distance = 0;
-        distCache[i][i] = 0;
+            int dist = metric_distance<TMetric>(points[i], points[j]);
+
+            sortedDistCache[i * tableLength + j] = { static_cast<int>(j), dist };
+            sortedDistCache[j * tableLength + i] = { static_cast<int>(i), dist };
+            distCache[i * tableLength + j] = dist;
+            distCache[j * tableLength + i] = dist;
+        }
+        sortedDistCache[i * tableLength + i] = { static_cast<int>(i), 0 };
+        distCache[i * tableLength + i] = 0;
     }
 
     for (size_t i = 0; i < tableLength; i++) {
-        std::sort(sortedDistCache[i], sortedDistCache[i] + tableLength);
+        std::sort(&sortedDistCache[i * tableLength], &sortedDistCache[i * tableLength] + tableLength);
     }
 
-    std::fill_n(bucket, CubeCount, 0);
-
     for (size_t i = 0; i < tableLength; i++) {
         uint8_t ri = reinterpret_cast<const uint8_t*>(colorTable + i)[2] / CubeSize;
         uint8_t gi = reinterpret_cast<const uint8_t*>(colorTable + i)[1] / CubeSize;
@@ -431,133 +772,177 @@ OptimizationPalette::OptimizationPalette(const color_t* colorTable, size_t table
         bucket[bucketIndex] = static_cast<uint16_t>(CubeCount + i);
     }
 
-    int bucketOffset = 0;
-    for (int r = 0; r < N; r++) {
-        int rs = r * CubeSize, re = rs + CubeSize;
-        for (int g = 0; g < N; g++) {
-            int gs = g * CubeSize, ge = gs + CubeSize;
-            for (int b = 0; b < N; b++, bucketOffset++) {
-                int bs = b * CubeSize, be = bs + CubeSize;
-
-                int dist;
-                int searchRange = 0;
-                int findIndex = 0;
-
-                if (bucket[bucketOffset] != 0) {
-                    uint16_t currIndex = bucket[bucketOffset];
-                    do {
-                        int i = currIndex - CubeCount;
-                        int r0 = reinterpret_cast<const uint8_t*>(colorTable + i)[2];
-                        int g0 = reinterpret_cast<const uint8_t*>(colorTable + i)[1];
-                        int b0 = reinterpret_cast<const uint8_t*>(colorTable + i)[0];
-                        int dist = distance_to_rect_farthest(r0, g0, b0, rs, re, gs, ge, bs, be);
-                        if (dist > searchRange) {
-                            searchRange = dist;
-                            findIndex = i;
-                        }
-                        currIndex = bucket[currIndex];
-                    } while (currIndex != 0);
-
-                    searchRange <<= 2;
-                } else {
-                    int minDist = std::numeric_limits<int>::max();
-
-                    for (int i = 0; i < tableLength; i++) {
-                        int r0 = reinterpret_cast<const uint8_t*>(colorTable + i)[2];
-                        int g0 = reinterpret_cast<const uint8_t*>(colorTable + i)[1];
-                        int b0 = reinterpret_cast<const uint8_t*>(colorTable + i)[0];
-                        int dist = distance_to_rect(r0, g0, b0, rs, re, gs, ge, bs, be);
-                        if (dist < minDist) {
-                            minDist = dist;
-                            findIndex = i;
-                        }
-                    }
+    // Cubes are independent: every red slice builds its own list in parallel, and the lists are joined in cube order.
+    constexpr size_t CubesPerChunk = N * N;
+    std::array<byte_vector, CubeCount / CubesPerChunk> chunkLists;
+    std::array<ListHead, CubeCount> heads;
 
-                    int r0 = reinterpret_cast<const uint8_t*>(colorTable + findIndex)[2];
-                    int g0 = reinterpret_cast<const uint8_t*>(colorTable + findIndex)[1];
-                    int b0 = reinterpret_cast<const uint8_t*>(colorTable + findIndex)[0];
-                    searchRange = distance_to_rect_farthest(r0, g0, b0, rs, re, gs, ge, bs, be) << 2;
-                }
+    parallel_for(CubeCount, CubesPerChunk, [&](size_t begin, size_t end) {
+        for (size_t cubeIndex = begin; cubeIndex < end; cubeIndex++) {
+            byte_vector& chunkList = chunkLists[cubeIndex / CubesPerChunk];
+            if (chunkList.empty()) chunkList.reserve(CubesPerChunk * 4);
+            build_cube_list<TMetric>(points, tableLength, bucket.data(), distCache.data(), sortedDistCache.data(), cubeIndex, heads[cubeIndex], chunkList);
+        }
+    });
 
+    size_t listLength = 0;
+    for (const byte_vector& chunkList : chunkLists) listLength += chunkList.size();
+    list.reserve(CubeCount * sizeof(ListHead) + listLength);
+    list.resize(CubeCount * sizeof(ListHead));
 
-                size_t indexesOffset = list.size();
-                uint32_t indexesCount = 1;
-                reinterpret_cast<ListHead*>(&list[bucketOffset * sizeof(ListHead)])->index = static_cast<uint32_t>(indexesOffset - CubeCount * sizeof(ListHead));
-                list.push_back(static_cast<byte>(findIndex));
-                const DistanceInfo* sortedDistLine = sortedDistCache[findIndex];
-
-                for (size_t i = 1; i < tableLength; i++) {
-                    if (sortedDistLine[i].distance >= searchRange) break;
-                    int otherIndex = sortedDistLine[i].otherIndex;
-                    const int* distCacheLine = distCache[otherIndex];
-                    int minDistIndex = findIndex;
-                    int minDist = distCacheLine[findIndex];
-                    const byte* indexes = &list[indexesOffset];
-
-                    for (uint32_t j = 1; j < indexesCount; j++) {
-                        dist = distCacheLine[indexes[j]];
-                        if (dist < minDist) {
-                            minDist = dist;
-                            minDistIndex = indexes[j];
-                        }
-                    }
+    for (size_t chunk = 0; chunk < chunkLists.size(); chunk++) {
+        uint32_t chunkOffset = static_cast<uint32_t>(list.size() - CubeCount * sizeof(ListHead));
+        for (size_t cubeIndex = chunk * CubesPerChunk; cubeIndex < (chunk + 1) * CubesPerChunk; cubeIndex++) {
+            heads[cubeIndex].index += chunkOffset;
+        }
+        list.insert(list.end(), chunkLists[chunk].begin(), chunkLists[chunk].end());
+    }
+    std::copy_n(reinterpret_cast<const byte*>(heads.data()), CubeCount * sizeof(ListHead), list.data());
+}
 
-                    if (vertical_intersect_to_rect(colorTable[minDistIndex], colorTable[otherIndex], rs, re, gs, ge, bs, be)) {
-                        list.push_back(static_cast<byte>(otherIndex));
-                        indexesCount++;
-                    }
-                }
 
-                reinterpret_cast<ListHead*>(&list[bucketOffset * sizeof(ListHead)])->count = indexesCount;
+// Cached lookups in a cube stay exact as long as its candidate list is unchanged and none of its
+// candidates moved, so only the other cubes are cleared.
+template<typename TMetric>
+template<typename TCache>
+void OptimizationPalette<TMetric>::rebuild(const std::vector<color_t>& colorTable, const std::array<bool, 256>& changed, TCache& cache) {
+    OptimizationPalette rebuilt(colorTable.data(), colorTable.size());
+    const ListHead* oldHeads = reinterpret_cast<const ListHead*>(list.data());
+    const ListHead* newHeads = reinterpret_cast<const ListHead*>(rebuilt.list.data());
+
+    parallel_for(CubeCount, N * N, [&](size_t begin, size_t end) {
+        for (size_t cubeIndex = begin; cubeIndex < end; cubeIndex++) {
+            const byte* oldList = &list[CubeCount * sizeof(ListHead) + oldHeads[cubeIndex].index];
+            const byte* newList = &rebuilt.list[CubeCount * sizeof(ListHead) + newHeads[cubeIndex].index];
+            uint32_t count = newHeads[cubeIndex].count;
+
+            if (oldHeads[cubeIndex].count != count || !std::equal(newList, newList + count, oldList)
+                || std::any_of(newList, newList + count, [&](byte index) { return changed[index]; })) {
+                cache.clear_cube(cubeIndex);
             }
         }
-    }
+    });
+
+    list = std::move(rebuilt.list);
+    this->points = std::move(rebuilt.points);
 }
 
+// Without candidate lists, a cube is cleared if a moved entry, at its old or new position, could be at least
+// as near to some pixel of the cube as the nearest unmoved entry.
+template<typename TMetric, typename TCache>
+static void clear_moved_cubes(const std::vector<MetricPoint>& oldPoints, const std::vector<MetricPoint>& newPoints, const std::array<bool, 256>& changed, TCache& cache) {
+    parallel_for(CubeCount, N * N, [&](size_t begin, size_t end) {
+        for (size_t cubeIndex = begin; cubeIndex < end; cubeIndex++) {
+            MetricBox box = TMetric::box(cube_origin(cubeIndex), CubeSize);
+
+            int unchangedRange = std::numeric_limits<int>::max();
+            for (size_t i = 0; i < newPoints.size(); i++) {
+                if (changed[i]) continue;
+                unchangedRange = std::min(unchangedRange, distance_to_rect_farthest<TMetric>(newPoints[i], box));
+            }
 
-template<typename TPalette>
-void PaletteImpl<TPalette>::palette_map_dither(TPalette* palette, color_t* pixels, byte* indexes, size_t width, size_t height) {
-    constexpr double Attenuation = 0.75;
-    constexpr size_t Rows = 2;
-    constexpr size_t Cols = 3;
-    constexpr int DitherMat[Rows][Cols]{
-        { 0, 0, 7 },
-        { 3, 5, 1 },
-    };
+            for (size_t i = 0; i < newPoints.size(); i++) {
+                if (!changed[i]) continue;
+                if (distance_to_rect<TMetric>(oldPoints[i], box) <= unchangedRange || distance_to_rect<TMetric>(newPoints[i], box) <= unchangedRange) {
+                    cache.clear_cube(cubeIndex);
+                    break;
+                }
+            }
+        }
+    });
+}
 
-    int pixelOffsets[Rows * Cols];
-    uint16_t weights[Rows * Cols];
-    int weightSum = 0;
-    size_t weightCount = 0;
+template<typename TPalette>
+bool PaletteImpl<TPalette>::palette_update(const byte* indexes, const color_t* colors, size_t count) {
+    if constexpr (std::is_same_v<TPalette, MappedPalette>) {
+        return false;
+    } else {
+        if (std::any_of(indexes, indexes + count, [&](byte index) { return index >= colorTable.size(); })) return false;
+
+        std::array<bool, 256> changed{};
+        bool anyChanged = false;
+        for (size_t i = 0; i < count; i++) {
+            color_t color = colors[i] & 0xffffff;
+            if (colorTable[indexes[i]] == color) continue;
+            colorTable[indexes[i]] = color;
+            changed[indexes[i]] = true;
+            anyChanged = true;
+        }
+        if (!anyChanged) return true;
 
-    for (size_t y = 0; y < Rows; y++) {
-        for (size_t x = 0; x < Cols; x++) {
-            if (DitherMat[y][x] == 0) continue;
-            weightSum += DitherMat[y][x];
-            weights[weightCount] = DitherMat[y][x];
-            pixelOffsets[weightCount] = static_cast<int>(y * width + x - Cols / 2);
-            weightCount++;
+        TPalette* palette = static_cast<TPalette*>(this);
+        if constexpr (TPalette::HasCandidateList) {
+            palette->rebuild(colorTable, changed, *palette);
+        } else {
+            std::vector<MetricPoint> oldPoints = palette->points;
+            palette->set_points(colorTable.data(), colorTable.size());
+            clear_moved_cubes<typename TPalette::Metric>(oldPoints, palette->points, changed, *palette);
         }
+        return true;
     }
+}
+
+template<typename TPalette>
+template<typename TIndexWriter, typename TMetrics>
+void PaletteImpl<TPalette>::palette_map_dither(TPalette* palette, color_t* pixels, TIndexWriter indexes, size_t width, size_t height, TMetrics& metrics) {
+    constexpr size_t Rows = DitherKernel::Rows;
+    constexpr size_t Cols = DitherKernel::Cols;
+
+    const DitherKernel kernel;
+    const uint16_t* weights = kernel.weights;
+    const size_t weightCount = kernel.count;
+    int pixelOffsets[Rows * Cols];
 
     for (size_t i = 0; i < weightCount; i++) {
-        weights[i] = static_cast<uint16_t>(weights[i] * 65535 * Attenuation / weightSum);
+        pixelOffsets[i] = static_cast<int>(kernel.rows[i] * width + kernel.cols[i] - Cols / 2);
+    }
+
+    if constexpr (!TMetrics::Enabled) {
+        if (width > Cols && height > Rows && width * height >= MapGrain && scheduler_concurrency() > 0) {
+            palette_map_dither_wavefront(palette, pixels, indexes, width, height);
+            return;
+        }
     }
 
     if (width <= Cols || height <= Rows) {
-        for (size_t i = 0; i < width * height; i++) {
-            indexes[i] = palette->palette_index(pixels[i] & 0xffffff);
-            pixels[i] = palette->colorTable[indexes[i]];
+        for (size_t y = 0; y < height; y++, pixels += width, indexes.next_row()) {
+            indexes.begin_row();
+            for (size_t x = 0; x < width; x++) {
+                byte paletteIndex = palette->palette_index(pixels[x] & 0xffffff);
+                if constexpr (TMetrics::Enabled) {
+                    metrics.add(pixels[x], palette->colorTable[paletteIndex], paletteIndex);
+                }
+                pixels[x] = palette->colorTable[paletteIndex];
+                indexes.write(x, paletteIndex);
+            }
         }
         return;
     }
 
+    // Error diffusion overwrites the rows ahead, so metrics compare against a copy of the
+    // current and the next source row.
+    std::vector<color_t> originalRows;
+    const color_t* originalRow = nullptr;
+    if constexpr (TMetrics::Enabled) {
+        originalRows.resize(width * Rows);
+        std::copy_n(pixels, width, originalRows.begin());
+    }
+
+    for (size_t y = 0; y < height - Rows + 1; y++, pixels += width, indexes.next_row()) {
+        if constexpr (TMetrics::Enabled) {
+            originalRow = &originalRows[y % Rows * width];
+            std::copy_n(pixels + width, width, &originalRows[(y + 1) % Rows * width]);
+        }
 
-    for (size_t y = 0; y < height - Rows + 1; y++, pixels += width, indexes += width) {
+        indexes.begin_row();
         size_t x = 0;
         for (; x < Cols / 2; x++) {
-            indexes[x] = palette->palette_index(pixels[x] & 0xffffff);
-            pixels[x] = palette->colorTable[indexes[x]];
+            byte paletteIndex = palette->palette_index(pixels[x] & 0xffffff);
+            pixels[x] = palette->colorTable[paletteIndex];
+            indexes.write(x, paletteIndex);
+            if constexpr (TMetrics::Enabled) {
+                metrics.add(originalRow[x], pixels[x], paletteIndex);
+            }
         }
 
         for (; x < width - Cols / 2; x++) LIKELY{
@@ -565,7 +950,10 @@ void PaletteImpl<TPalette>::palette_map_dither(TPalette* palette, color_t* pixel
             byte paletteIndex = palette->palette_index(oldPixel);
             color_t newPixel = palette->colorTable[paletteIndex];
             pixels[x] = newPixel;
-            indexes[x] = paletteIndex;
+            indexes.write(x, paletteIndex);
+            if constexpr (TMetrics::Enabled) {
+                metrics.add(originalRow[x], newPixel, paletteIndex);
+            }
 
             int64_t errR = (static_cast<int64_t>(oldPixel) & 0xff0000) - (static_cast<int64_t>(newPixel) & 0xff0000);
             int64_t errG = (static_cast<int64_t>(oldPixel) & 0x00ff00) - (static_cast<int64_t>(newPixel) & 0x00ff00);
@@ -573,74 +961,405 @@ void PaletteImpl<TPalette>::palette_map_dither(TPalette* palette, color_t* pixel
 
             for (size_t i = 0; i < weightCount; i++) {
                 int pixelOffset = pixelOffsets[i];
-                color_t dstPixel = pixels[x + pixelOffset];
-                int64_t newR = (dstPixel & 0xff0000) + (errR * weights[i] >> 16);
-                int64_t newG = (dstPixel & 0x00ff00) + (errG * weights[i] >> 16);
-                int64_t newB = (dstPixel & 0x0000ff) + (errB * weights[i] >> 16);
-                if (newR & ~0xffffffLL) newR = ~(newR >> 63);
-                if (newG & ~0x00ffffLL) newG = ~(newG >> 63);
-                if (newB & ~0x0000ffLL) newB = ~(newB >> 63) & 0x0000ff;
-                newR &= 0xff0000;
-                newG &= 0x00ff00;
-                pixels[x + pixelOffset] = static_cast<color_t>(newR | newG | newB);
+                pixels[x + pixelOffset] = diffuse_error(pixels[x + pixelOffset], errR, errG, errB, weights[i]);
             }
         }
 
         for (; x < width; x++) {
+            byte paletteIndex = palette->palette_index(pixels[x] & 0xffffff);
+            pixels[x] = palette->colorTable[paletteIndex];
+            indexes.write(x, paletteIndex);
+            if constexpr (TMetrics::Enabled) {
+                metrics.add(originalRow[x], pixels[x], paletteIndex);
+            }
+        }
+    }
+
+    for (size_t y = height - Rows + 1; y < height; y++, pixels += width, indexes.next_row()) {
+        if constexpr (TMetrics::Enabled) {
+            originalRow = &originalRows[y % Rows * width];
+        }
+
+        indexes.begin_row();
+        for (size_t x = 0; x < width; x++) {
+            byte paletteIndex = palette->palette_index(pixels[x] & 0xffffff);
+            pixels[x] = palette->colorTable[paletteIndex];
+            indexes.write(x, paletteIndex);
+            if constexpr (TMetrics::Enabled) {
+                metrics.add(originalRow[x], pixels[x], paletteIndex);
+            }
+        }
+    }
+}
+
+
+// Dithers rows in parallel with the same result as palette_map_dither. Rows are taken in order, and a block of
+// columns in row y starts only after row y - 1 has finished two columns past the block. By then every pixel of
+// the block has received all its error from row y - 1 in serial order, and row y - 1 writes only to pixels
+// further right.
+template<typename TPalette>
+template<typename TIndexWriter>
+void PaletteImpl<TPalette>::palette_map_dither_wavefront(TPalette* palette, color_t* pixels, TIndexWriter indexes, size_t width, size_t height) {
+    constexpr size_t Rows = DitherKernel::Rows;
+    constexpr size_t Cols = DitherKernel::Cols;
+    constexpr size_t BlockSize = 64;
+    static_assert(Rows == 2, "rows wait only on the row above");
+
+    const DitherKernel kernel;
+    int pixelOffsets[Rows * Cols];
+    for (size_t i = 0; i < kernel.count; i++) {
+        pixelOffsets[i] = static_cast<int>(kernel.rows[i] * width + kernel.cols[i] - Cols / 2);
+    }
+
+    // columns finished in each row
+    std::vector<std::atomic<size_t>> progress(height);
+
+    parallel_for(height, 1, [&](size_t begin, size_t end) {
+        for (size_t y = begin; y < end; y++) {
+            color_t* row = pixels + y * width;
+            TIndexWriter rowIndexes{ indexes.row + y * indexes.stride, indexes.stride };
+            bool diffuse = y < height - Rows + 1;
+            rowIndexes.begin_row();
+
+            for (size_t blockStart = 0; blockStart < width; blockStart += BlockSize) {
+                size_t blockEnd = std::min(blockStart + BlockSize, width);
+                if (y > 0) {
+                    size_t required = std::min(blockEnd + Cols / 2 + 1, width);
+                    while (progress[y - 1].load(std::memory_order_acquire) < required) std::this_thread::yield();
+                }
+
+                for (size_t x = blockStart; x < blockEnd; x++) {
+                    color_t oldPixel = row[x] & 0xffffff;
+                    byte paletteIndex = palette->palette_index(oldPixel);
+                    color_t newPixel = palette->colorTable[paletteIndex];
+                    row[x] = newPixel;
+                    rowIndexes.write(x, paletteIndex);
+                    if (!diffuse || x < Cols / 2 || x >= width - Cols / 2) continue;
+
+                    int64_t errR = (static_cast<int64_t>(oldPixel) & 0xff0000) - (static_cast<int64_t>(newPixel) & 0xff0000);
+                    int64_t errG = (static_cast<int64_t>(oldPixel) & 0x00ff00) - (static_cast<int64_t>(newPixel) & 0x00ff00);
+                    int64_t errB = (static_cast<int64_t>(oldPixel) & 0x0000ff) - (static_cast<int64_t>(newPixel) & 0x0000ff);
+                    for (size_t i = 0; i < kernel.count; i++) {
+                        row[x + pixelOffsets[i]] = diffuse_error(row[x + pixelOffsets[i]], errR, errG, errB, kernel.weights[i]);
+                    }
+                }
+                progress[y].store(blockEnd, std::memory_order_release);
+            }
+        }
+    });
+}
+
+// Produces the same result as palette_map_dither for rows [rowStart, rowStart + rowCount) of an image,
+// without needing the rows that follow. Instead of diffusing into the next row directly, every pixel
+// records its error in `errors` (3 values per pixel), and the next row replays those contributions in
+// the order the whole-image kernel would have applied them.
+template<typename TPalette>
+void PaletteImpl<TPalette>::palette_map_dither_rows(TPalette* palette, color_t* pixels, byte* indexes, size_t width, size_t height, size_t rowStart, size_t rowCount, int32_t* errors) {
+    constexpr size_t Rows = DitherKernel::Rows;
+    constexpr size_t Cols = DitherKernel::Cols;
+    static_assert(Rows == 2, "only the next row can receive error");
+
+    const DitherKernel kernel;
+    const bool diffuse = width > Cols && height > Rows;
+
+    for (size_t y = rowStart; y < rowStart + rowCount; y++, pixels += width, indexes += width) {
+        if (diffuse && y > 0) {
+            for (size_t x = 0; x < width; x++) {
+                for (size_t i = kernel.count; i-- > 0;) {
+                    if (kernel.rows[i] == 0) continue;
+                    size_t srcX = x + Cols / 2 - kernel.cols[i];
+                    if (srcX >= width) continue;
+                    const int32_t* err = &errors[srcX * 3];
+                    pixels[x] = diffuse_error(pixels[x], err[0], err[1], err[2], kernel.weights[i]);
+                }
+            }
+        }
+
+        if (!diffuse || y >= height - Rows + 1) {
+            for (size_t x = 0; x < width; x++) {
+                indexes[x] = palette->palette_index(pixels[x] & 0xffffff);
+                pixels[x] = palette->colorTable[indexes[x]];
+            }
+            continue;
+        }
+
+        size_t x = 0;
+        for (; x < Cols / 2; x++) {
             indexes[x] = palette->palette_index(pixels[x] & 0xffffff);
             pixels[x] = palette->colorTable[indexes[x]];
+            std::fill_n(&errors[x * 3], 3, 0);
         }
-    }
 
-    for (size_t y = height - Rows + 1; y < height; y++) {
-        for (size_t x = 0; x < width; x++, pixels++, indexes++) {
-            *indexes = palette->palette_index(*pixels & 0xffffff);
-            *pixels = palette->colorTable[*indexes];
+        for (; x < width - Cols / 2; x++) LIKELY{
+            color_t oldPixel = pixels[x] & 0xffffff;
+            byte paletteIndex = palette->palette_index(oldPixel);
+            color_t newPixel = palette->colorTable[paletteIndex];
+            pixels[x] = newPixel;
+            indexes[x] = paletteIndex;
+
+            int32_t errR = static_cast<int32_t>(oldPixel & 0xff0000) - static_cast<int32_t>(newPixel & 0xff0000);
+            int32_t errG = static_cast<int32_t>(oldPixel & 0x00ff00) - static_cast<int32_t>(newPixel & 0x00ff00);
+            int32_t errB = static_cast<int32_t>(oldPixel & 0x0000ff) - static_cast<int32_t>(newPixel & 0x0000ff);
+            errors[x * 3 + 0] = errR;
+            errors[x * 3 + 1] = errG;
+            errors[x * 3 + 2] = errB;
+
+            for (size_t i = 0; i < kernel.count; i++) {
+                if (kernel.rows[i] != 0) continue;
+                size_t dstX = x + kernel.cols[i] - Cols / 2;
+                pixels[dstX] = diffuse_error(pixels[dstX], errR, errG, errB, kernel.weights[i]);
+            }
+        }
+
+        for (; x < width; x++) {
+            indexes[x] = palette->palette_index(pixels[x] & 0xffffff);
+            pixels[x] = palette->colorTable[indexes[x]];
+            std::fill_n(&errors[x * 3], 3, 0);
         }
     }
 }
 
+struct DitherStream {
+    Palette& palette;
+    size_t width, height;
+    size_t row;
+    std::vector<int32_t> errors;
 
-EXPORT_API
-Palette* palette_create(const color_t* colorTable, size_t tableLength, bool optimize) {
+    DitherStream(Palette& palette, size_t width, size_t height) : palette(palette), width(width), height(height), row(0), errors(width * 3, 0) {
+    }
+};
+
+template<typename TMetric>
+static Palette* create_palette(const color_t* colorTable, size_t tableLength, bool optimize, const byte_vector* list) {
     Palette* palette = nullptr;
 
     if (tableLength < 8) {
-        palette = new SingleCacheEuclideanPalette(colorTable, tableLength);
+        palette = new SingleCacheEuclideanPalette<TMetric>(colorTable, tableLength);
     } else if (optimize) {
         if (tableLength < 256) {
-            palette = new SingleCacheOptimizationPalette(colorTable, tableLength);
+            palette = list ? new SingleCacheOptimizationPalette<TMetric>(colorTable, tableLength, *list) : new SingleCacheOptimizationPalette<TMetric>(colorTable, tableLength);
         } else if (tableLength == 256) {
-            palette = new DoubleCacheOptimizationPalette(colorTable, tableLength);
+            palette = list ? new DoubleCacheOptimizationPalette<TMetric>(colorTable, tableLength, *list) : new DoubleCacheOptimizationPalette<TMetric>(colorTable, tableLength);
         }
     } else {
         if (tableLength < 256) {
-            palette = new SingleCacheEuclideanPalette(colorTable, tableLength);
+            palette = new SingleCacheEuclideanPalette<TMetric>(colorTable, tableLength);
         } else if (tableLength == 256) {
-            palette = new DoubleCacheEuclideanPalette(colorTable, tableLength);
+            palette = new DoubleCacheEuclideanPalette<TMetric>(colorTable, tableLength);
         }
     }
 
     return palette;
 }
 
+static Palette* create_palette(const color_t* colorTable, size_t tableLength, bool optimize, ColorMetric metric, const byte_vector* list) {
+    return with_metric(metric, static_cast<Palette*>(nullptr), [&]<typename TMetric>() {
+        return create_palette<TMetric>(colorTable, tableLength, optimize, list);
+    });
+}
+
+EXPORT_API
+Palette* palette_create(const color_t* colorTable, size_t tableLength, bool optimize) {
+    return create_palette(colorTable, tableLength, optimize, MetricRgb, nullptr);
+}
+
+// Like palette_create, with nearest colors found under `metric`. Returns null for an unknown metric.
+EXPORT_API
+Palette* palette_create_metric(const color_t* colorTable, size_t tableLength, bool optimize, ColorMetric metric) {
+    return create_palette(colorTable, tableLength, optimize, metric, nullptr);
+}
+
+EXPORT_API
+ColorMetric palette_metric(const Palette& palette) {
+    return palette.metric;
+}
+
 EXPORT_API
 void palette_destroy(Palette* palette) {
     delete palette;
 }
 
+// Moves palette entries in place. Warm cache entries survive wherever the nearest color cannot have changed.
+// Returns false if an index is out of range or the palette is read-only (loaded with an index map).
+EXPORT_API
+bool palette_update(Palette& palette, const uint8_t* indexes, const color_t* colors, size_t count) {
+    return palette.palette_update(indexes, colors, count);
+}
+
 EXPORT_API
 void palette_map(Palette& palette, const color_t* pixels, byte* indexes, size_t length) {
-    palette.palette_map(pixels, indexes, length);
+    palette.palette_map(pixels, indexes, length, nullptr);
 }
 
 EXPORT_API
 void palette_dither(Palette& palette, color_t* pixels, byte* indexes, size_t width, size_t height) {
-    palette.palette_dither(pixels, indexes, width, height);
+    palette.palette_dither(pixels, indexes, width, height, nullptr);
+}
+
+EXPORT_API
+void palette_map_metrics(Palette& palette, const color_t* pixels, byte* indexes, size_t length, QuantizationMetrics* metrics) {
+    palette.palette_map(pixels, indexes, length, metrics);
+}
+
+EXPORT_API
+void palette_dither_metrics(Palette& palette, color_t* pixels, byte* indexes, size_t width, size_t height, QuantizationMetrics* metrics) {
+    palette.palette_dither(pixels, indexes, width, height, metrics);
+}
+
+EXPORT_API
+DitherStream* palette_dither_stream_create(Palette& palette, size_t width, size_t height) {
+    return new DitherStream(palette, width, height);
+}
+
+EXPORT_API
+void palette_dither_stream_destroy(DitherStream* stream) {
+    delete stream;
+}
+
+EXPORT_API
+size_t palette_dither_stream_push(DitherStream& stream, color_t* pixels, byte* indexes, size_t rowCount) {
+    rowCount = std::min(rowCount, stream.height - stream.row);
+    stream.palette.palette_dither_rows(pixels, indexes, stream.width, stream.height, stream.row, rowCount, stream.errors.data());
+    stream.row += rowCount;
+    return rowCount;
+}
+
+EXPORT_API
+void palette_map_rgb(Palette& palette, const color_t* pixels, color_t* outPixels, byte* indexes, size_t length) {
+    palette.palette_map_rgb(pixels, outPixels, indexes, length);
+}
+
+static size_t packed_stride(size_t width, size_t bitDepth, size_t rowAlignment) {
+    if (bitDepth != 1 && bitDepth != 2 && bitDepth != 4 && bitDepth != 8) return static_cast<size_t>(-1);
+    if (rowAlignment == 0) return static_cast<size_t>(-1);
+
+    size_t rowBytes = (width * bitDepth + 7) / 8;
+    return (rowBytes + rowAlignment - 1) / rowAlignment * rowAlignment;
+}
+
+EXPORT_API
+size_t palette_packed_stride(size_t width, size_t bitDepth, size_t rowAlignment) {
+    return packed_stride(width, bitDepth, rowAlignment);
+}
+
+EXPORT_API
+size_t palette_map_packed(Palette& palette, const color_t* pixels, byte* indexes, size_t width, size_t height, size_t bitDepth, size_t rowAlignment) {
+    size_t stride = packed_stride(width, bitDepth, rowAlignment);
+    if (stride == static_cast<size_t>(-1) || palette.colorTable.size() > (size_t(1) << bitDepth)) return static_cast<size_t>(-1);
+
+    palette.palette_map_packed(pixels, indexes, width, height, bitDepth, stride);
+    return stride;
+}
+
+EXPORT_API
+size_t palette_dither_packed(Palette& palette, color_t* pixels, byte* indexes, size_t width, size_t height, size_t bitDepth, size_t rowAlignment) {
+    size_t stride = packed_stride(width, bitDepth, rowAlignment);
+    if (stride == static_cast<size_t>(-1) || palette.colorTable.size() > (size_t(1) << bitDepth)) return static_cast<size_t>(-1);
+
+    palette.palette_dither_packed(pixels, indexes, width, height, bitDepth, stride);
+    return stride;
+}
+
+// Palette file layout: header, color table, candidate list, then the optional 16 MB inverse colormap
+// at a page aligned offset so it can be mapped and shared as is.
+struct PaletteFileHeader {
+    static constexpr uint32_t Magic = 0x4c505143; // "CQPL"
+    static constexpr uint32_t Version = 1;
+    static constexpr uint32_t HasCandidateList = 1;
+    static constexpr uint32_t HasIndexMap = 2;
+    // the metric of the palette is stored in bits 8..15 of the flags
+    static constexpr uint32_t MetricShift = 8;
+
+    uint32_t magic;
+    uint32_t version;
+    uint32_t flags;
+    uint32_t tableLength;
+    uint64_t tableOffset;
+    uint64_t listOffset;
+    uint64_t listLength;
+    uint64_t indexMapOffset;
+};
+
+EXPORT_API
+bool palette_save(Palette& palette, const char* filename, bool includeIndexMap) {
+    constexpr uint64_t PageSize = 4096;
+
+    const byte_vector* list = palette.candidate_list();
+    PaletteFileHeader header{};
+    header.magic = PaletteFileHeader::Magic;
+    header.version = PaletteFileHeader::Version;
+    header.flags = (list ? PaletteFileHeader::HasCandidateList : 0) | (includeIndexMap ? PaletteFileHeader::HasIndexMap : 0) | palette.metric << PaletteFileHeader::MetricShift;
+    header.tableLength = static_cast<uint32_t>(palette.colorTable.size());
+    header.tableOffset = sizeof(PaletteFileHeader);
+    header.listOffset = header.tableOffset + palette.colorTable.size() * sizeof(color_t);
+    header.listLength = list ? list->size() : 0;
+    header.indexMapOffset = includeIndexMap ? (header.listOffset + header.listLength + PageSize - 1) / PageSize * PageSize : 0;
+
+    std::ofstream file(std::filesystem::path(reinterpret_cast<const char8_t*>(filename)), std::ios::binary | std::ios::trunc);
+    if (!file) return false;
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(palette.colorTable.data()), palette.colorTable.size() * sizeof(color_t));
+    if (list) {
+        file.write(reinterpret_cast<const char*>(list->data()), list->size());
+    }
+
+    if (includeIndexMap) {
+        byte_vector indexMap(0x1000000);
+        palette.fill_index_map(indexMap.data());
+        file.seekp(header.indexMapOffset);
+        file.write(reinterpret_cast<const char*>(indexMap.data()), indexMap.size());
+    }
+
+    return static_cast<bool>(file.flush());
+}
+
+EXPORT_API
+Palette* palette_load(const char* filename) {
+    MappedFile file(std::filesystem::path(reinterpret_cast<const char8_t*>(filename)));
+    if (!file || file.size() < sizeof(PaletteFileHeader)) return nullptr;
+
+    PaletteFileHeader header;
+    std::copy_n(file.data(), sizeof(header), reinterpret_cast<unsigned char*>(&header));
+    if (header.magic != PaletteFileHeader::Magic || header.version != PaletteFileHeader::Version) return nullptr;
+    if (header.tableLength == 0 || header.tableLength > 256) return nullptr;
+    if (header.tableOffset > file.size() || header.tableLength * sizeof(color_t) > file.size() - header.tableOffset) return nullptr;
+    if (header.listOffset > file.size() || header.listLength > file.size() - header.listOffset) return nullptr;
+
+    ColorMetric metric = static_cast<ColorMetric>(header.flags >> PaletteFileHeader::MetricShift & 0xff);
+    if (metric > MetricOklab) return nullptr;
+
+    color_t colorTable[256];
+    std::copy_n(file.data() + header.tableOffset, header.tableLength * sizeof(color_t), reinterpret_cast<unsigned char*>(colorTable));
+
+    if (header.flags & PaletteFileHeader::HasIndexMap) {
+        if (file.size() < 0x1000000 || header.indexMapOffset > file.size() - 0x1000000) return nullptr;
+        const byte* indexMap = file.data() + header.indexMapOffset;
+        return new MappedPalette(colorTable, header.tableLength, metric, std::move(file), indexMap);
+    }
+
+    if (header.flags & PaletteFileHeader::HasCandidateList) {
+        if (header.listLength < CubeCount * sizeof(ListHead)) return nullptr;
+        byte_vector list(file.data() + header.listOffset, file.data() + header.listOffset + header.listLength);
+        for (size_t i = 0; i < CubeCount; i++) {
+            const ListHead& listHead = reinterpret_cast<const ListHead*>(list.data())[i];
+            if (listHead.count == 0 || CubeCount * sizeof(ListHead) + listHead.index + listHead.count > list.size()) return nullptr;
+            const byte* colorList = &list[CubeCount * sizeof(ListHead) + listHead.index];
+            if (std::any_of(colorList, colorList + listHead.count, [&](byte index) { return index >= header.tableLength; })) return nullptr;
+        }
+        return create_palette(colorTable, header.tableLength, true, metric, &list);
+    }
+
+    return create_palette(colorTable, header.tableLength, false, metric, nullptr);
 }
 
 EXPORT_API
 const color_t* palette_color_table(const Palette& palette, size_t* tableLength) {
     *tableLength = palette.colorTable.size();
     return palette.colorTable.data();
+}
+EXPORT_API
+bool palette_stats(const Palette& palette, PaletteStats* stats) {
+    *stats = palette.stats;
+    return StatsEnabled;
 }
\ No newline at end of file
@@ -0,0 +1,230 @@
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <array>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include "ColorQuantization.h"
+#include "scheduler.h"
+
+struct QuantizationJob {
+    QuantizationJobDesc desc;
+    std::array<color_t, 256> colorTable;
+    size_t colorCount;
+    std::atomic<bool> done;
+    // one reference for the caller, one for the queue until the job completes
+    std::atomic<int> references;
+
+    explicit QuantizationJob(const QuantizationJobDesc& desc) : desc(desc), colorCount(0), done(false), references(2) {
+    }
+};
+
+static void release_job(QuantizationJob* job) {
+    if (job->references.fetch_sub(1, std::memory_order_acq_rel) == 1) delete job;
+}
+
+struct PooledPalette {
+    Palette* palette;
+    size_t tableLength;
+    bool optimize;
+};
+
+// Each job runs as two tasks, extract (add_bitmap + get_color_table) and map (palette + map/dither),
+// so while one runner dithers frame N another can already ingest frame N+1. Runners are tasks on the
+// shared scheduler that keep taking stages until none are left.
+struct QuantizationQueue {
+    size_t concurrency;
+    size_t maxPendingJobs;
+
+    std::mutex mutex;
+    std::condition_variable slotAvailable;
+    std::condition_variable idle;
+    std::deque<QuantizationJob*> extractTasks;
+    std::deque<QuantizationJob*> mapTasks;
+    size_t pendingJobs;
+    size_t runnerCount;
+
+    // Pools never hold more objects than there are runners, since only a running stage owns one.
+    // reset() only clears the colors a frame touched, and palette_update() keeps the cache of a similar palette warm.
+    std::vector<SpaceShockColorExtractor*> idleExtractors;
+    std::vector<PooledPalette> idlePalettes;
+    size_t paletteCount;
+
+    QuantizationQueue(size_t concurrency, size_t maxPendingJobs) : concurrency(concurrency), maxPendingJobs(maxPendingJobs), pendingJobs(0), runnerCount(0), paletteCount(0) {
+    }
+
+    QuantizationQueue(const QuantizationQueue&) = delete;
+
+    QuantizationQueue& operator=(const QuantizationQueue&) = delete;
+
+    ~QuantizationQueue() {
+        {
+            std::unique_lock lock(mutex);
+            idle.wait(lock, [&] { return pendingJobs == 0 && runnerCount == 0; });
+        }
+
+        for (SpaceShockColorExtractor* extractor : idleExtractors) destroy(extractor);
+        for (PooledPalette& pooled : idlePalettes) palette_destroy(pooled.palette);
+    }
+
+    QuantizationJob* submit(const QuantizationJobDesc& desc) {
+        QuantizationJob* job = new QuantizationJob(desc);
+        bool startRunner = false;
+        {
+            std::unique_lock lock(mutex);
+            slotAvailable.wait(lock, [&] { return pendingJobs < maxPendingJobs; });
+            pendingJobs++;
+            extractTasks.push_back(job);
+            if (runnerCount < concurrency) {
+                runnerCount++;
+                startRunner = true;
+            }
+        }
+
+        // Posted outside the lock: without scheduler workers the runner completes the job right here.
+        if (startRunner) {
+            scheduler_post([](void* queue) { static_cast<QuantizationQueue*>(queue)->run(); }, this);
+        }
+        return job;
+    }
+
+    void run() {
+        std::unique_lock lock(mutex);
+        while (true) {
+            // Finishing older frames first keeps latency bounded when the queue is full.
+            if (!mapTasks.empty()) {
+                QuantizationJob* job = mapTasks.front();
+                mapTasks.pop_front();
+                PooledPalette pooled = acquire_palette(job->colorCount, job->desc.optimize);
+                lock.unlock();
+                map(*job, pooled);
+                lock.lock();
+                idlePalettes.push_back(pooled);
+                pendingJobs--;
+                slotAvailable.notify_one();
+                lock.unlock();
+                complete(job);
+                lock.lock();
+            } else if (!extractTasks.empty()) {
+                QuantizationJob* job = extractTasks.front();
+                extractTasks.pop_front();
+                SpaceShockColorExtractor* extractor = nullptr;
+                if (!idleExtractors.empty()) {
+                    extractor = idleExtractors.back();
+                    idleExtractors.pop_back();
+                }
+                lock.unlock();
+                extractor = extract(*job, extractor);
+                lock.lock();
+                idleExtractors.push_back(extractor);
+                mapTasks.push_back(job);
+            } else {
+                // notified under the lock, so the queue cannot be destroyed before this runner lets go of it
+                runnerCount--;
+                idle.notify_all();
+                return;
+            }
+        }
+    }
+
+    // Prefers the most recently used palette of the same shape, whose colors are most likely to be close.
+    PooledPalette acquire_palette(size_t tableLength, bool optimize) {
+        for (size_t i = idlePalettes.size(); i-- > 0;) {
+            if (idlePalettes[i].tableLength == tableLength && idlePalettes[i].optimize == optimize) {
+                PooledPalette pooled = idlePalettes[i];
+                idlePalettes.erase(idlePalettes.begin() + i);
+                return pooled;
+            }
+        }
+
+        if (paletteCount >= concurrency && !idlePalettes.empty()) {
+            palette_destroy(idlePalettes.front().palette);
+            idlePalettes.erase(idlePalettes.begin());
+            paletteCount--;
+        }
+        paletteCount++;
+        return { nullptr, tableLength, optimize };
+    }
+
+    static SpaceShockColorExtractor* extract(QuantizationJob& job, SpaceShockColorExtractor* extractor) {
+        const QuantizationJobDesc& desc = job.desc;
+        extractor = extractor ? extractor : create();
+        add_bitmap(*extractor, desc.pixels, desc.width * desc.height);
+        job.colorCount = get_color_table(*extractor, job.colorTable.data(), desc.tableLength, desc.forceColors, desc.forceColorCount);
+        return reset(extractor);
+    }
+
+    static void map(QuantizationJob& job, PooledPalette& pooled) {
+        static constexpr auto Indexes = [] {
+            std::array<uint8_t, 256> indexes{};
+            for (size_t i = 0; i < indexes.size(); i++) indexes[i] = static_cast<uint8_t>(i);
+            return indexes;
+        }();
+
+        const QuantizationJobDesc& desc = job.desc;
+        if (desc.colorTable) std::copy_n(job.colorTable.data(), job.colorCount, desc.colorTable);
+
+        if (pooled.palette) {
+            palette_update(*pooled.palette, Indexes.data(), job.colorTable.data(), job.colorCount);
+        } else {
+            pooled.palette = palette_create(job.colorTable.data(), job.colorCount, desc.optimize);
+        }
+
+        if (desc.dither) {
+            palette_dither(*pooled.palette, desc.pixels, desc.indexes, desc.width, desc.height);
+        } else {
+            palette_map(*pooled.palette, desc.pixels, desc.indexes, desc.width * desc.height);
+        }
+    }
+
+    static void complete(QuantizationJob* job) {
+        if (job->desc.callback) job->desc.callback(job->desc.userData, job->colorCount);
+        job->done.store(true, std::memory_order_release);
+        job->done.notify_all();
+        release_job(job);
+    }
+};
+
+
+// Runs quantization jobs on the shared scheduler, at most `concurrency` stages at a time (0 for one per scheduler
+// worker). job_submit blocks while `maxPendingJobs` jobs are unfinished (0 for twice the concurrency).
+EXPORT_API
+QuantizationQueue* job_queue_create(size_t concurrency, size_t maxPendingJobs) {
+    if (concurrency == 0) concurrency = std::max<size_t>(scheduler_concurrency(), 1);
+    if (maxPendingJobs == 0) maxPendingJobs = concurrency * 2;
+    return new QuantizationQueue(concurrency, maxPendingJobs);
+}
+
+// Waits for every submitted job to complete.
+EXPORT_API
+void job_queue_destroy(QuantizationQueue* queue) {
+    delete queue;
+}
+
+// Returns null if the table length is not in [1, 256], is smaller than the force color count, or the image is empty.
+// The returned handle must be passed to job_release, which may happen before the job completes.
+EXPORT_API
+QuantizationJob* job_submit(QuantizationQueue& queue, const QuantizationJobDesc& desc) {
+    if (desc.tableLength == 0 || desc.tableLength > 256 || desc.tableLength < desc.forceColorCount) return nullptr;
+    if (desc.width == 0 || desc.height == 0) return nullptr;
+    return queue.submit(desc);
+}
+
+EXPORT_API
+bool job_done(const QuantizationJob& job) {
+    return job.done.load(std::memory_order_acquire);
+}
+
+// Returns the number of extracted colors.
+EXPORT_API
+size_t job_wait(QuantizationJob& job) {
+    job.done.wait(false, std::memory_order_acquire);
+    return job.colorCount;
+}
+
+EXPORT_API
+void job_release(QuantizationJob* job) {
+    if (job) release_job(job);
+}
\ No newline at end of file
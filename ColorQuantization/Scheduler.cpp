@@ -0,0 +1,315 @@
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include "ColorQuantization.h"
+#include "scheduler.h"
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+struct Task {
+    task_callback run;
+    void* data;
+};
+
+// Every worker owns a deque: it pushes and pops its own tasks at the back and, when empty, steals from the
+// front of the others. Tasks posted from outside the pool go to a shared injection queue.
+class ThreadPool {
+public:
+    ThreadPool(size_t workerCount, const size_t* cpus, size_t cpuCount) : queued(0), stopping(false), pinned(true) {
+        for (size_t i = 0; i < workerCount; i++) {
+            workers.push_back(std::make_unique<Worker>());
+        }
+        for (size_t i = 0; i < workerCount; i++) {
+            workers[i]->thread = std::thread([this, i] { run(i); });
+            if (cpuCount) pinned &= pin(workers[i]->thread, cpus[i % cpuCount]);
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Runs every queued task before the workers exit.
+    ~ThreadPool() {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers) worker->thread.join();
+    }
+
+    size_t size() const { return workers.size(); }
+
+    bool all_pinned() const { return pinned; }
+
+    void post(Task task) {
+        {
+            std::lock_guard lock(mutex);
+            queued++;
+        }
+
+        if (currentPool == this) {
+            std::lock_guard lock(workers[currentWorker]->mutex);
+            workers[currentWorker]->tasks.push_back(task);
+        } else {
+            std::lock_guard lock(injectedMutex);
+            injected.push_back(task);
+        }
+        wake.notify_one();
+    }
+
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+        std::thread thread;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::mutex injectedMutex;
+    std::deque<Task> injected;
+
+    // tasks posted but not yet taken, guarded by `mutex` so sleeping workers cannot miss a post
+    std::mutex mutex;
+    std::condition_variable wake;
+    size_t queued;
+    bool stopping;
+    bool pinned;
+
+    static thread_local ThreadPool* currentPool;
+    static thread_local size_t currentWorker;
+
+    bool try_take(size_t self, Task& task) {
+        {
+            Worker& worker = *workers[self];
+            std::lock_guard lock(worker.mutex);
+            if (!worker.tasks.empty()) {
+                task = worker.tasks.back();
+                worker.tasks.pop_back();
+                return true;
+            }
+        }
+        {
+            std::lock_guard lock(injectedMutex);
+            if (!injected.empty()) {
+                task = injected.front();
+                injected.pop_front();
+                return true;
+            }
+        }
+        for (size_t i = 1; i < workers.size(); i++) {
+            Worker& victim = *workers[(self + i) % workers.size()];
+            std::lock_guard lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = victim.tasks.front();
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run(size_t self) {
+        currentPool = this;
+        currentWorker = self;
+
+        while (true) {
+            {
+                std::unique_lock lock(mutex);
+                wake.wait(lock, [&] { return queued > 0 || stopping; });
+                if (queued == 0) return;
+            }
+
+            // A post counts the task before pushing it, so the deques may briefly look empty.
+            Task task;
+            if (!try_take(self, task)) {
+                std::this_thread::yield();
+                continue;
+            }
+            {
+                std::lock_guard lock(mutex);
+                queued--;
+            }
+            task.run(task.data);
+        }
+    }
+
+    static bool pin(std::thread& thread, size_t cpu) {
+#if defined(_WIN32)
+        if (cpu >= 64) return false;
+        return SetThreadAffinityMask(thread.native_handle(), DWORD_PTR{ 1 } << cpu) != 0;
+#elif defined(__linux__)
+        if (cpu >= CPU_SETSIZE) return false;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        return pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) == 0;
+#else
+        return false;
+#endif
+    }
+};
+
+thread_local ThreadPool* ThreadPool::currentPool = nullptr;
+thread_local size_t ThreadPool::currentWorker = 0;
+
+// CPUs this process may run on, which respects taskset / cgroup-style affinity limits on Linux.
+static size_t available_cpus() {
+#if defined(__linux__)
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) return std::max(CPU_COUNT(&set), 1);
+#endif
+    return std::max<size_t>(std::thread::hardware_concurrency(), 1);
+}
+
+struct Scheduler {
+    std::mutex mutex;
+    bool configured = false;
+    std::shared_ptr<ThreadPool> pool;
+    executor_callback executor = nullptr;
+    void* executorData = nullptr;
+    size_t executorConcurrency = 0;
+};
+
+// Never destroyed: joining worker threads during static destruction or library unload can deadlock.
+static Scheduler& scheduler = *new Scheduler();
+
+// Snapshot of the scheduler taken for one call, so reconfiguring never pulls a pool from under a running call.
+struct Target {
+    std::shared_ptr<ThreadPool> pool;
+    executor_callback executor;
+    void* executorData;
+    size_t concurrency;
+
+    void post(task_callback task, void* taskData) const {
+        if (executor) {
+            executor(executorData, task, taskData);
+        } else if (pool) {
+            pool->post({ task, taskData });
+        } else {
+            task(taskData);
+        }
+    }
+};
+
+static Target current_target() {
+    std::lock_guard lock(scheduler.mutex);
+    if (!scheduler.configured) {
+        // the calling thread always helps, so one CPU is left for it
+        size_t workerCount = available_cpus() - 1;
+        scheduler.pool = workerCount ? std::make_shared<ThreadPool>(workerCount, nullptr, 0) : nullptr;
+        scheduler.configured = true;
+    }
+
+    if (scheduler.executor) return { nullptr, scheduler.executor, scheduler.executorData, scheduler.executorConcurrency };
+    return { scheduler.pool, nullptr, nullptr, scheduler.pool ? scheduler.pool->size() : 0 };
+}
+
+size_t scheduler_concurrency() {
+    return current_target().concurrency;
+}
+
+void scheduler_post(task_callback task, void* taskData) {
+    current_target().post(task, taskData);
+}
+
+struct ParallelJob {
+    void (*run)(void* context, size_t chunk);
+    void* context;
+    size_t chunkCount;
+    std::atomic<size_t> next;
+    std::atomic<size_t> finished;
+    // the caller and every posted helper; a helper that starts after all chunks are taken only drops its reference
+    std::atomic<size_t> references;
+
+    ParallelJob(void (*run)(void*, size_t), void* context, size_t chunkCount, size_t helperCount)
+        : run(run), context(context), chunkCount(chunkCount), next(0), finished(0), references(helperCount + 1) {
+    }
+
+    // Chunks are taken in increasing order, so a chunk may wait on an earlier one knowing it is already running.
+    void work() {
+        for (size_t chunk; (chunk = next.fetch_add(1, std::memory_order_relaxed)) < chunkCount;) {
+            run(context, chunk);
+            if (finished.fetch_add(1, std::memory_order_acq_rel) + 1 == chunkCount) finished.notify_all();
+        }
+    }
+
+    void release() {
+        if (references.fetch_sub(1, std::memory_order_acq_rel) == 1) delete this;
+    }
+};
+
+void parallel_run(size_t chunkCount, void (*run)(void* context, size_t chunk), void* context) {
+    Target target = current_target();
+    size_t helperCount = std::min(chunkCount - 1, target.concurrency);
+    ParallelJob* job = new ParallelJob(run, context, chunkCount, helperCount);
+
+    for (size_t i = 0; i < helperCount; i++) {
+        target.post([](void* p) {
+            ParallelJob* job = static_cast<ParallelJob*>(p);
+            job->work();
+            job->release();
+        }, job);
+    }
+
+    job->work();
+    for (size_t finished; (finished = job->finished.load(std::memory_order_acquire)) < chunkCount;) {
+        job->finished.wait(finished, std::memory_order_acquire);
+    }
+    job->release();
+}
+
+
+// Replaces the library's worker threads: `workerCount` threads (0 runs everything on the calling thread),
+// optionally pinning worker i to CPU cpus[i % cpuCount]. Call it while no other library call is running.
+// Returns false if some worker could not be pinned; the workers still run unpinned.
+EXPORT_API
+bool scheduler_configure(size_t workerCount, const size_t* cpus, size_t cpuCount) {
+    std::shared_ptr<ThreadPool> pool = workerCount ? std::make_shared<ThreadPool>(workerCount, cpus, cpuCount) : nullptr;
+    bool pinned = !pool || pool->all_pinned();
+
+    std::shared_ptr<ThreadPool> old;
+    {
+        std::lock_guard lock(scheduler.mutex);
+        old = std::exchange(scheduler.pool, std::move(pool));
+        scheduler.executor = nullptr;
+        scheduler.configured = true;
+    }
+    return pinned;
+}
+
+// Hands every task to `executor` instead of library threads, at most `concurrency` at a time per parallel call.
+// A null executor returns to the default worker threads.
+EXPORT_API
+void scheduler_set_executor(executor_callback executor, void* executorData, size_t concurrency) {
+    std::shared_ptr<ThreadPool> old;
+    std::lock_guard lock(scheduler.mutex);
+    old = std::exchange(scheduler.pool, nullptr);
+    scheduler.configured = executor != nullptr;
+    scheduler.executor = executor;
+    scheduler.executorData = executorData;
+    scheduler.executorConcurrency = concurrency;
+}
+
+EXPORT_API
+size_t scheduler_worker_count() {
+    return scheduler_concurrency();
+}
\ No newline at end of file
@@ -7,27 +7,45 @@
 #include <algorithm>
 #include <cmath>
 #include <limits>
+#include <chrono>
+#include <type_traits>
+#include <bit>
+#include "ColorQuantization.h"
 #include "default_init_allocator.h"
+#include "stats.h"
+#include "color_metric.h"
+#include "scheduler.h"
 
-#define EXPORT_API extern "C" __declspec(dllexport)
-
-using color_t = uint32_t;
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 using u32allocator = default_init_allocator<uint32_t>;
 using u16allocator = default_init_allocator<uint16_t>;
 
-struct CountNode {
-    uint32_t count;
-    uint32_t node;
-};
+// Marks a color whose count dropped to 0 through remove_bitmap or decay but which is still on colorList.
+constexpr uint32_t StaleNode = std::numeric_limits<uint32_t>::max();
 
 struct SpaceShockColorExtractor {
     std::vector<color_t> colorList;
     size_t pixelTotalCount;
-    std::array<CountNode, 0x1000000> colorCounts;
-
-    SpaceShockColorExtractor() : pixelTotalCount(0) {
-        colorCounts.fill({});
+    // counts and bucket-list nodes in separate planes, so absorb_color scans runs of counts with vector loads
+    std::array<uint32_t, 0x1000000> colorCounts;
+    std::array<uint32_t, 0x1000000> colorNodes;
+    ExtractorStats stats;
+    size_t staleCount;
+    uint32_t decayEpoch;
+    // histogram mass added, removed or decayed since the last get_color_table, and the mass at that time
+    uint64_t driftCount;
+    uint64_t tablePixelCount;
+    // counts get_color_table lowered, as color << 32 | old count, for CountSnapshot to put back
+    std::vector<uint64_t> countJournal;
+    // kept across reset, like any other setting
+    ColorMetric metric;
+
+    SpaceShockColorExtractor() : pixelTotalCount(0), stats{}, staleCount(0), decayEpoch(0), driftCount(0), tablePixelCount(0), metric(MetricRgb) {
+        colorCounts.fill(0);
+        colorNodes.fill(0);
         colorList.reserve(0x100000);
     }
 
@@ -47,11 +65,17 @@ SpaceShockColorExtractor* reset(SpaceShockColorExtractor* extractor) {
     if (extractor == nullptr) return create();
 
     for (color_t color : extractor->colorList) {
-        extractor->colorCounts[color] = {};
+        extractor->colorCounts[color] = 0;
+        extractor->colorNodes[color] = 0;
     }
 
     extractor->colorList.clear();
     extractor->pixelTotalCount = 0;
+    extractor->stats = {};
+    extractor->staleCount = 0;
+    extractor->decayEpoch = 0;
+    extractor->driftCount = 0;
+    extractor->tablePixelCount = 0;
     return extractor;
 }
 
@@ -60,31 +84,398 @@ void destroy(SpaceShockColorExtractor* extractor) {
     delete extractor;
 }
 
+// Called when the count of a color becomes non-zero.
+static void list_color(SpaceShockColorExtractor& extractor, color_t color) {
+    uint32_t& node = extractor.colorNodes[color];
+    if (node == StaleNode) {
+        node = 0;
+        extractor.staleCount--;
+    } else {
+        extractor.colorList.push_back(color);
+    }
+}
+
+// Called when the count of a color drops to 0; the color stays on colorList until compaction.
+static void unlist_color(SpaceShockColorExtractor& extractor, color_t color) {
+    extractor.colorNodes[color] = StaleNode;
+    extractor.staleCount++;
+}
+
+static void compact_color_list(SpaceShockColorExtractor& extractor) {
+    if (extractor.staleCount * 2 <= extractor.colorList.size()) return;
+
+    std::erase_if(extractor.colorList, [&](color_t color) {
+        if (extractor.colorCounts[color] != 0) return false;
+        extractor.colorNodes[color] = 0;
+        return true;
+    });
+    extractor.staleCount = 0;
+}
+
 EXPORT_API
 void add_bitmap(SpaceShockColorExtractor& extractor, const color_t* pixels, size_t pixelCount) {
     for (size_t i = 0; i < pixelCount; i++) {
         color_t pixel = pixels[i] & 0xffffff;
-        uint32_t count = extractor.colorCounts[pixel].count++;
+        uint32_t count = extractor.colorCounts[pixel]++;
+        if (count == 0) {
+            list_color(extractor, pixel);
+        }
+    }
+
+    extractor.pixelTotalCount += pixelCount;
+    extractor.driftCount += pixelCount;
+}
+
+// Takes the pixels of a frame leaving a sliding window back out of the histogram.
+EXPORT_API
+void remove_bitmap(SpaceShockColorExtractor& extractor, const color_t* pixels, size_t pixelCount) {
+    size_t removeCount = 0;
+
+    for (size_t i = 0; i < pixelCount; i++) {
+        color_t pixel = pixels[i] & 0xffffff;
+        uint32_t& count = extractor.colorCounts[pixel];
+        if (count == 0) continue;
+        if (--count == 0) {
+            unlist_color(extractor, pixel);
+        }
+        removeCount++;
+    }
+
+    extractor.pixelTotalCount -= removeCount;
+    extractor.driftCount += removeCount;
+    compact_color_list(extractor);
+}
+
+static uint32_t hash_color(color_t color, uint32_t seed) {
+    uint32_t h = color * 0x9e3779b1u ^ seed * 0x85ebca77u;
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return h;
+}
+
+// Multiplies every count by `factor` for an exponentially decayed histogram. Rounding is dithered per color
+// so that small counts still decay at the expected rate instead of getting stuck or vanishing at once.
+EXPORT_API
+void decay(SpaceShockColorExtractor& extractor, double factor) {
+    uint64_t scale = static_cast<uint64_t>(std::clamp(factor, 0.0, 1.0) * 65536);
+    if (scale >= 65536) return;
+
+    uint32_t seed = ++extractor.decayEpoch;
+    size_t pixelTotalCount = 0;
+
+    for (color_t color : extractor.colorList) {
+        uint32_t& count = extractor.colorCounts[color];
+        if (count == 0) continue;
+
+        uint32_t newCount = static_cast<uint32_t>((count * scale + (hash_color(color, seed) & 0xffff)) >> 16);
+        extractor.driftCount += count - newCount;
+        count = newCount;
+        if (newCount == 0) {
+            unlist_color(extractor, color);
+        }
+        pixelTotalCount += newCount;
+    }
+
+    extractor.pixelTotalCount = pixelTotalCount;
+    compact_color_list(extractor);
+}
+
+// Share of the histogram that changed since the last get_color_table, infinite before the first one.
+EXPORT_API
+double extractor_drift(const SpaceShockColorExtractor& extractor) {
+    if (extractor.tablePixelCount == 0) return std::numeric_limits<double>::infinity();
+    return static_cast<double>(extractor.driftCount) / extractor.tablePixelCount;
+}
+
+EXPORT_API
+size_t add_bitmap_stream(SpaceShockColorExtractor& extractor, read_pixels_callback readPixels, void* userData, size_t bufferLength) {
+    std::vector<color_t, u32allocator> buffer(bufferLength);
+    size_t totalCount = 0;
+
+    while (size_t pixelCount = readPixels(userData, buffer.data(), bufferLength)) {
+        add_bitmap(extractor, buffer.data(), pixelCount);
+        totalCount += pixelCount;
+    }
+
+    return totalCount;
+}
+
+// Histogram buffer: "CQHG", version byte, varint color count, then per color in colorList order a zigzag
+// varint delta from the previous color (starting from 0) and a varint count. Keeping colorList order makes
+// merging shards exactly equivalent to calling add_bitmap on them one after another.
+constexpr uint32_t HistogramMagic = 0x47485143;
+constexpr uint8_t HistogramVersion = 1;
+constexpr size_t HistogramHeaderSize = 5;
+
+static size_t varint_size(uint64_t value) {
+    size_t size = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
+
+static uint8_t* write_varint(uint8_t* p, uint64_t value) {
+    while (value >= 0x80) {
+        *p++ = static_cast<uint8_t>(value | 0x80);
+        value >>= 7;
+    }
+    *p++ = static_cast<uint8_t>(value);
+    return p;
+}
+
+static bool read_varint(const uint8_t*& p, const uint8_t* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+        uint8_t b = *p++;
+        value |= static_cast<uint64_t>(b & 0x7f) << shift;
+        if ((b & 0x80) == 0) return true;
+    }
+    return false;
+}
+
+static uint64_t zigzag(int64_t value) {
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+static int64_t unzigzag(uint64_t value) {
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+static void add_color(SpaceShockColorExtractor& extractor, color_t color, uint64_t count) {
+    if (count == 0) return;
+
+    uint32_t& colorCount = extractor.colorCounts[color];
+    if (colorCount == 0) {
+        list_color(extractor, color);
+    }
+    colorCount = static_cast<uint32_t>(std::min<uint64_t>(colorCount + count, std::numeric_limits<uint32_t>::max()));
+    extractor.pixelTotalCount += count;
+    extractor.driftCount += count;
+}
+
+EXPORT_API
+void add_histogram(SpaceShockColorExtractor& extractor, const color_t* colors, const uint32_t* counts, size_t colorCount) {
+    for (size_t i = 0; i < colorCount; i++) {
+        add_color(extractor, colors[i] & 0xffffff, counts[i]);
+    }
+}
+
+// Returns the encoded size; a null buffer only queries it.
+EXPORT_API
+size_t get_histogram(const SpaceShockColorExtractor& extractor, uint8_t* buffer, size_t bufferLength) {
+    size_t colorCount = 0, size = 0;
+    color_t prevColor = 0;
+    for (color_t color : extractor.colorList) {
+        uint32_t count = extractor.colorCounts[color];
+        if (count == 0) continue;
+        size += varint_size(zigzag(static_cast<int64_t>(color) - prevColor)) + varint_size(count);
+        prevColor = color;
+        colorCount++;
+    }
+    size += HistogramHeaderSize + varint_size(colorCount);
+
+    if (buffer == nullptr) return size;
+    if (bufferLength < size) return static_cast<size_t>(-1);
+
+    uint8_t* p = buffer;
+    for (int i = 0; i < 4; i++) {
+        *p++ = static_cast<uint8_t>(HistogramMagic >> (i * 8));
+    }
+    *p++ = HistogramVersion;
+    p = write_varint(p, colorCount);
+    prevColor = 0;
+    for (color_t color : extractor.colorList) {
+        uint32_t count = extractor.colorCounts[color];
+        if (count == 0) continue;
+        p = write_varint(p, zigzag(static_cast<int64_t>(color) - prevColor));
+        p = write_varint(p, count);
+        prevColor = color;
+    }
+    return size;
+}
+
+// Walks a histogram buffer, calling `visit(color, count)` per entry. Returns false if the buffer is malformed.
+template<typename TVisitor>
+static bool read_histogram(const uint8_t* buffer, size_t bufferLength, TVisitor&& visit) {
+    if (bufferLength < HistogramHeaderSize) return false;
+
+    uint32_t magic = 0;
+    for (int i = 0; i < 4; i++) {
+        magic |= static_cast<uint32_t>(buffer[i]) << (i * 8);
+    }
+    if (magic != HistogramMagic || buffer[4] != HistogramVersion) return false;
+
+    const uint8_t* p = buffer + HistogramHeaderSize;
+    const uint8_t* end = buffer + bufferLength;
+    uint64_t colorCount;
+    if (!read_varint(p, end, colorCount) || colorCount > 0x1000000) return false;
+
+    int64_t color = 0;
+    for (uint64_t i = 0; i < colorCount; i++) {
+        uint64_t delta, count;
+        if (!read_varint(p, end, delta) || !read_varint(p, end, count) || delta > 0x1ffffff) return false;
+        color += unzigzag(delta);
+        if (color < 0 || color > 0xffffff || count == 0 || count > std::numeric_limits<uint32_t>::max()) return false;
+        visit(static_cast<color_t>(color), count);
+    }
+    return p == end;
+}
+
+// Returns the number of colors merged, or -1 without touching the extractor if the buffer is malformed.
+EXPORT_API
+size_t add_histogram_buffer(SpaceShockColorExtractor& extractor, const uint8_t* buffer, size_t bufferLength) {
+    size_t colorCount = 0;
+    if (!read_histogram(buffer, bufferLength, [&](color_t, uint64_t) { colorCount++; })) return static_cast<size_t>(-1);
+
+    read_histogram(buffer, bufferLength, [&](color_t color, uint64_t count) { add_color(extractor, color, count); });
+    return colorCount;
+}
+
+// Ingests about one pixel in `ratio`, each counted as the pixels it stands for, so counts and pixelTotalCount
+// match a full add_bitmap up to sampling noise and get_color_table schedules its kernels the same way.
+// Returns the number of pixels read, or -1 for an unknown mode; a ratio of 0 or 1 reads every pixel.
+EXPORT_API
+size_t add_bitmap_sampled(SpaceShockColorExtractor& extractor, const color_t* pixels, size_t width, size_t height, SampleMode mode, size_t ratio) {
+    if (mode > SampleLowDiscrepancy) return static_cast<size_t>(-1);
+
+    size_t pixelCount = width * height;
+    ratio = std::min<size_t>({ ratio, pixelCount, std::numeric_limits<uint32_t>::max() });
+    if (ratio <= 1) {
+        add_bitmap(extractor, pixels, pixelCount);
+        return pixelCount;
+    }
+
+    // The weights of every mode sum to exactly pixelCount.
+    size_t sampleCount = 0;
+    auto sample = [&](size_t x, size_t y, size_t weight) {
+        color_t pixel = pixels[y * width + x] & 0xffffff;
+        uint32_t& count = extractor.colorCounts[pixel];
         if (count == 0) {
-            extractor.colorList.push_back(pixel);
+            list_color(extractor, pixel);
+        }
+        count = static_cast<uint32_t>(std::min<uint64_t>(uint64_t{ count } + weight, std::numeric_limits<uint32_t>::max()));
+        sampleCount++;
+    };
+
+    switch (mode) {
+        case SampleStride:
+            // the middle pixel of each run of `ratio`
+            for (size_t i = 0; i < pixelCount; i += ratio) {
+                size_t run = std::min(ratio, pixelCount - i);
+                size_t center = i + run / 2;
+                sample(center % width, center / width, run);
+            }
+            break;
+
+        case SampleStratified: {
+            // cells as square as `ratio` allows, with one hashed position per cell
+            size_t cellHeight = std::min<size_t>(std::max<size_t>(static_cast<size_t>(std::sqrt(static_cast<double>(ratio))), 1), height);
+            size_t cellWidth = std::min(ratio / cellHeight, width);
+            uint32_t cellIndex = 0;
+            for (size_t y0 = 0; y0 < height; y0 += cellHeight) {
+                size_t h = std::min(cellHeight, height - y0);
+                for (size_t x0 = 0; x0 < width; x0 += cellWidth, cellIndex++) {
+                    size_t w = std::min(cellWidth, width - x0);
+                    uint32_t jitter = hash_color(cellIndex, 0);
+                    sample(x0 + ((jitter & 0xffff) * w >> 16), y0 + ((jitter >> 16) * h >> 16), w * h);
+                }
+            }
+            break;
+        }
+
+        case SampleLowDiscrepancy: {
+            // Fibonacci lattice: point k sits on row k * height / n and at the golden-ratio Weyl sequence
+            // (0.64 fixed point) across it, so points come in scan order and never line up into columns.
+            constexpr uint64_t GoldenStep = 0x9e3779b97f4a7c15;
+            size_t pointCount = pixelCount / ratio;
+            uint64_t u = uint64_t{ 1 } << 63;
+            for (size_t k = 0; k < pointCount; k++, u += GoldenStep) {
+                size_t x = static_cast<size_t>((u >> 32) * width >> 32);
+                size_t y = k * height / pointCount;
+                sample(x, y, pixelCount * (k + 1) / pointCount - pixelCount * k / pointCount);
+            }
+            break;
         }
     }
 
     extractor.pixelTotalCount += pixelCount;
+    extractor.driftCount += pixelCount;
+    return sampleCount;
+}
+
+// A histogram as its colors in ascending order with their counts, for a tile of tiles_quantize or the coarse grid
+// of get_color_table_coarse. Either holds far too few colors to be worth the dense table of an extractor.
+struct SparseHistogram {
+    std::vector<color_t> colorList;
+    std::vector<uint32_t> colorCounts;
+    std::vector<uint32_t> colorNodes;
+    size_t pixelTotalCount;
+    ExtractorStats stats;
+};
+
+// Sorts keys by the color in their high 32 bits, keeping the order of equal colors. Byte passes are skipped where
+// all keys share the byte.
+static void sort_by_color(std::vector<uint64_t>& keys, std::vector<uint64_t>& scratch) {
+    scratch.resize(keys.size());
+    for (int shift = 32; shift < 56; shift += 8) {
+        std::array<size_t, 257> offsets{};
+        for (uint64_t key : keys) offsets[(key >> shift & 0xff) + 1]++;
+        if (std::find(offsets.begin(), offsets.end(), keys.size()) != offsets.end()) continue;
+        for (size_t i = 1; i < offsets.size(); i++) offsets[i] += offsets[i - 1];
+        for (uint64_t key : keys) scratch[offsets[key >> shift & 0xff]++] = key;
+        keys.swap(scratch);
+    }
+}
+
+// get_color_table runs on either histogram through the following accessors.
+static uint32_t& color_count(SpaceShockColorExtractor& extractor, color_t color) {
+    return extractor.colorCounts[color];
+}
+
+static uint32_t& color_count(SparseHistogram& histogram, color_t color) {
+    auto it = std::lower_bound(histogram.colorList.begin(), histogram.colorList.end(), color);
+    return histogram.colorCounts[it - histogram.colorList.begin()];
+}
+
+// Called before get_color_table lowers a count. A sparse histogram is scratch and is not restored.
+static void journal_count(SpaceShockColorExtractor& extractor, color_t color, uint32_t count) {
+    extractor.countJournal.push_back(static_cast<uint64_t>(color) << 32 | count);
+}
+
+static void journal_count(SparseHistogram&, color_t, uint32_t) {}
+
+template<typename TVisitor>
+static void for_each_color(SpaceShockColorExtractor& extractor, TVisitor&& visit) {
+    for (color_t color : extractor.colorList) {
+        visit(color, extractor.colorCounts[color], extractor.colorNodes[color]);
+    }
+}
+
+template<typename TVisitor>
+static void for_each_color(SparseHistogram& histogram, TVisitor&& visit) {
+    for (size_t i = 0; i < histogram.colorList.size(); i++) {
+        visit(histogram.colorList[i], histogram.colorCounts[i], histogram.colorNodes[i]);
+    }
 }
 
 constexpr size_t BaseLength = 1024;
 
-static std::pair<std::vector<uint32_t, u32allocator>, std::map<uint32_t, uint32_t>> sort_colors(SpaceShockColorExtractor& extractor) {
+template<typename THistogram>
+static std::pair<std::vector<uint32_t, u32allocator>, std::map<uint32_t, uint32_t>> sort_colors(THistogram& histogram) {
     std::vector<uint32_t, u32allocator> sortedBuffer;
     std::map<uint32_t, uint32_t> sortedMap;
-    sortedBuffer.reserve(BaseLength * 1024);
+    sortedBuffer.reserve(std::min(BaseLength * 1024, BaseLength + histogram.colorList.size() * 4));
     sortedBuffer.resize(BaseLength, 0);
     uint32_t lastNewIndex = BaseLength;
 
-    for (color_t color : extractor.colorList) {
+    for_each_color(histogram, [&](color_t color, uint32_t count, uint32_t& node) {
         uint32_t lastIndex;
-        uint32_t count = extractor.colorCounts[color].count;
+        if (count == 0) return;
 
         if (count <= BaseLength) {
             uint32_t index = count - 1;
@@ -97,6 +488,7 @@ static std::pair<std::vector<uint32_t, u32allocator>, std::map<uint32_t, uint32_
         } else {
             uint32_t& listHead = sortedMap[count];
             if (listHead == 0) {
+                stats_add(histogram.stats.mapInserts);
                 sortedBuffer.resize(lastNewIndex + 4);
                 listHead = lastNewIndex++;
                 lastIndex = 0;
@@ -111,9 +503,9 @@ static std::pair<std::vector<uint32_t, u32allocator>, std::map<uint32_t, uint32_
         sortedBuffer[lastNewIndex + 0] = color;
         sortedBuffer[lastNewIndex + 1] = lastIndex;
         sortedBuffer[lastNewIndex + 2] = 0;
-        extractor.colorCounts[color].node = lastNewIndex;
+        node = lastNewIndex;
         lastNewIndex += 3;
-    }
+    });
 
     return std::make_pair(std::move(sortedBuffer), std::move(sortedMap));
 }
@@ -152,89 +544,313 @@ static void create_kernel(std::vector<uint16_t, u16allocator>& kernel, int kerne
     }
 }
 
-static size_t absorb_color(SpaceShockColorExtractor& extractor, std::vector<uint32_t, u32allocator>& sortedBuffer, std::map<uint32_t, uint32_t>& sortedMap, const std::vector<uint16_t, u16allocator>& kernel, int kernelSize, color_t color, uint32_t kernelHeight) {
+// Absorb weights by position in the kernel cube. The dense histogram visits every cell of the cube and reads them
+// from a table; a sparse histogram holds too few colors to repay filling a table of up to 57^3 cells for each
+// kernel, so it evaluates the same expression per visited color.
+class KernelTable {
+public:
+    void build(int kernelSize, double affect) {
+        create_kernel(weights, kernelSize, affect);
+        baseSize = kernelSize * 2 + 1;
+    }
+
+    const uint16_t* row(int r, int g) const {
+        return &weights[(r * baseSize + g) * baseSize];
+    }
+
+private:
+    std::vector<uint16_t, u16allocator> weights;
+    int baseSize;
+};
+
+class KernelFunction {
+public:
+    void build(int kernelSize, double affect) {
+        size = kernelSize;
+        cache.resize(kernelSize + 1);
+        for (int i = 0; i <= kernelSize; i++) {
+            double v = (i - kernelSize) / (double)kernelSize;
+            cache[i] = -(v * v / affect);
+        }
+    }
+
+    uint16_t weight(int r, int g, int b) const {
+        double w = exp(cache[fold(b)] + cache[fold(g)] + cache[fold(r)]);
+        return static_cast<uint16_t>(w * 65535);
+    }
+
+private:
+    std::vector<double> cache;
+    int size;
+
+    int fold(int i) const { return i <= size ? i : size * 2 - i; }
+};
+
+// Count left to a color after absorbing kernelHeight * weight / 65536 of its pixels into the picked color.
+static uint32_t absorbed_count(uint32_t count, uint32_t kernelHeight, uint16_t weight) {
+    return static_cast<uint32_t>(std::max<int64_t>(count - ((static_cast<int64_t>(kernelHeight) * weight) >> 16), 0));
+}
+
+// Lowers the count of every color of the box by what the kernel placed at the box start absorbs, and calls
+// changed(color, node, oldCount, newCount) for each count that dropped, in ascending color order. Returns the
+// number of non-zero counts seen, counted only for extractor_stats.
+template<typename TVisitor>
+static uint64_t absorb_box(SpaceShockColorExtractor& extractor, const int* start, const int* end, const KernelTable& kernel, uint32_t kernelHeight, TVisitor&& changed) {
+    int runLength = end[2] - start[2] + 1;
+    uint64_t nonEmpty = 0;
+#if defined(__AVX2__)
+    // kernelHeight split at bit 16, so both partial products of a weight fit in 32 bits and so does their sum
+    __m256i heightHigh = _mm256_set1_epi32(static_cast<int>(kernelHeight >> 16));
+    __m256i heightLow = _mm256_set1_epi32(static_cast<int>(kernelHeight & 0xffff));
+#endif
+
+    for (int r = start[0]; r <= end[0]; r++) {
+        for (int g = start[1]; g <= end[1]; g++) {
+            const uint16_t* rgKernel = kernel.row(r - start[0], g - start[1]);
+            color_t runStart = static_cast<color_t>((r << 16) | (g << 8) | start[2]);
+            uint32_t* counts = &extractor.colorCounts[runStart];
+            int b = 0;
+
+#if defined(__AVX2__)
+            for (; b + 8 <= runLength; b += 8) {
+                __m256i count8 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(counts + b));
+                __m256i weight8 = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(rgKernel + b)));
+                __m256i absorb8 = _mm256_add_epi32(_mm256_mullo_epi32(heightHigh, weight8), _mm256_srli_epi32(_mm256_mullo_epi32(heightLow, weight8), 16));
+                __m256i newCount8 = _mm256_sub_epi32(_mm256_max_epu32(count8, absorb8), absorb8);
+                uint32_t changedMask = ~_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(newCount8, count8))) & 0xff;
+                if constexpr (StatsEnabled) {
+                    nonEmpty += std::popcount(~_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(count8, _mm256_setzero_si256()))) & 0xffu);
+                }
+                if (changedMask == 0) continue;
+
+                alignas(32) uint32_t oldCounts[8];
+                _mm256_store_si256(reinterpret_cast<__m256i*>(oldCounts), count8);
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(counts + b), newCount8);
+                for (; changedMask != 0; changedMask &= changedMask - 1) {
+                    int lane = std::countr_zero(changedMask);
+                    color_t color = runStart + b + lane;
+                    changed(color, extractor.colorNodes[color], oldCounts[lane], counts[b + lane]);
+                }
+            }
+#endif
+
+            for (; b < runLength; b++) {
+                uint32_t count = counts[b];
+                if (count == 0) continue;
+                if constexpr (StatsEnabled) nonEmpty++;
+                uint32_t newCount = absorbed_count(count, kernelHeight, rgKernel[b]);
+                if (newCount == count) continue;
+
+                counts[b] = newCount;
+                changed(runStart + b, extractor.colorNodes[runStart + b], count, newCount);
+            }
+        }
+    }
+
+    return nonEmpty;
+}
+
+// Searches each red plane of the box for its first color and scans the sorted colors from there.
+template<typename TVisitor>
+static uint64_t absorb_box(SparseHistogram& histogram, const int* start, const int* end, const KernelFunction& kernel, uint32_t kernelHeight, TVisitor&& changed) {
+    uint64_t nonEmpty = 0;
+    auto first = histogram.colorList.begin(), last = histogram.colorList.end();
+    for (int r = start[0]; r <= end[0]; r++) {
+        color_t planeEnd = static_cast<color_t>((r << 16) | (end[1] << 8) | end[2]);
+        first = std::lower_bound(first, last, static_cast<color_t>((r << 16) | (start[1] << 8) | start[2]));
+        for (; first != last && *first <= planeEnd; ++first) {
+            int g = *first >> 8 & 0xff;
+            int b = *first & 0xff;
+            if (b < start[2] || b > end[2]) continue;
+            size_t i = first - histogram.colorList.begin();
+            uint32_t count = histogram.colorCounts[i];
+            if (count == 0) continue;
+            if constexpr (StatsEnabled) nonEmpty++;
+            uint32_t newCount = absorbed_count(count, kernelHeight, kernel.weight(r - start[0], g - start[1], b - start[2]));
+            if (newCount == count) continue;
+
+            histogram.colorCounts[i] = newCount;
+            changed(*first, histogram.colorNodes[i], count, newCount);
+        }
+    }
+    return nonEmpty;
+}
+
+template<typename THistogram, typename TKernel>
+static size_t absorb_color(THistogram& histogram, std::vector<uint32_t, u32allocator>& sortedBuffer, std::map<uint32_t, uint32_t>& sortedMap, const TKernel& kernel, int kernelSize, color_t color, uint32_t kernelHeight, uint64_t& cellsVisited) {
     int rCenter = reinterpret_cast<uint8_t*>(&color)[2];
     int gCenter = reinterpret_cast<uint8_t*>(&color)[1];
     int bCenter = reinterpret_cast<uint8_t*>(&color)[0];
-    int rStart = std::max(rCenter - kernelSize, 0);
-    int gStart = std::max(gCenter - kernelSize, 0);
-    int bStart = std::max(bCenter - kernelSize, 0);
-    int rEnd = std::min(rCenter + kernelSize, 255);
-    int gEnd = std::min(gCenter + kernelSize, 255);
-    int bEnd = std::min(bCenter + kernelSize, 255);
-
-    int kernelBaseSize = kernelSize * 2 + 1;
+    int start[3] = { std::max(rCenter - kernelSize, 0), std::max(gCenter - kernelSize, 0), std::max(bCenter - kernelSize, 0) };
+    int end[3] = { std::min(rCenter + kernelSize, 255), std::min(gCenter + kernelSize, 255), std::min(bCenter + kernelSize, 255) };
+
     size_t pixelCount = 0;
 
-    for (int r = rStart; r <= rEnd; r++) {
-        const uint16_t* rKernel = &kernel[(r - rStart) * kernelBaseSize * kernelBaseSize];
-        for (int g = gStart; g <= gEnd; g++) {
-            const uint16_t* rgKernel = rKernel + (g - gStart) * kernelBaseSize;
-            for (int b = bStart; b <= bEnd; b++) {
-                color_t otherRgb = static_cast<color_t>((r << 16) | (g << 8) | b);
-                uint32_t otherCount = extractor.colorCounts[otherRgb].count;
-                if (otherCount == 0) continue;
-                uint16_t weight = rgKernel[b - bStart];
-                uint32_t newCount = static_cast<uint32_t>(std::max(otherCount - ((static_cast<int64_t>(kernelHeight) * weight) >> 16), 0LL));
-                if (newCount == otherCount) continue;
-
-                pixelCount += otherCount - newCount;
-
-                extractor.colorCounts[otherRgb].count = newCount;
-                uint32_t lastNode = extractor.colorCounts[otherRgb].node;
-                uint32_t prevIndex = sortedBuffer[lastNode + 1];
-                uint32_t nextIndex = sortedBuffer[lastNode + 2];
-                uint32_t listHead = otherCount > BaseLength ? sortedMap[otherCount] : otherCount - 1;
-
-                if (prevIndex != 0) {
-                    sortedBuffer[prevIndex + 2] = nextIndex;
-                    if (nextIndex != 0) {
-                        sortedBuffer[nextIndex + 1] = prevIndex;
-                    } else {
-                        sortedBuffer[listHead] = prevIndex;
-                    }
-                } else {
-                    if (nextIndex == 0) {
-                        sortedBuffer[listHead] = 0;
-                        if (otherCount > BaseLength) {
-                            sortedMap.erase(otherCount);
-                        }
-                    } else {
-                        sortedBuffer[nextIndex + 1] = prevIndex;
-                    }
-                }
+    uint64_t cellCount = static_cast<uint64_t>(end[0] - start[0] + 1) * (end[1] - start[1] + 1) * (end[2] - start[2] + 1);
+    cellsVisited += cellCount;
+    stats_add(histogram.stats.absorbCalls);
+    stats_add(histogram.stats.absorbCellsVisited, cellCount);
 
-                if (newCount != 0) {
-                    if (newCount > BaseLength) {
-                        uint32_t& oldListHead = sortedMap[newCount];
-                        if (oldListHead == 0) {
-                            listHead = sortedBuffer.size();
-                            oldListHead = listHead;
-                            sortedBuffer.push_back(0);
-                        } else {
-                            listHead = oldListHead;
-                        }
-                    } else {
-                        listHead = newCount - 1;
-                    }
+    uint64_t nonEmpty = absorb_box(histogram, start, end, kernel, kernelHeight, [&](color_t otherRgb, uint32_t lastNode, uint32_t otherCount, uint32_t newCount) {
+        stats_add(histogram.stats.absorbCellsChanged);
+        journal_count(histogram, otherRgb, otherCount);
+        pixelCount += otherCount - newCount;
 
-                    if (sortedBuffer[listHead] != 0) {
-                        sortedBuffer[sortedBuffer[listHead] + 2] = lastNode;
-                    }
-                    sortedBuffer[lastNode + 0] = otherRgb;
-                    sortedBuffer[lastNode + 1] = sortedBuffer[listHead];
-                    sortedBuffer[lastNode + 2] = 0;
-                    sortedBuffer[listHead] = lastNode;
+        uint32_t prevIndex = sortedBuffer[lastNode + 1];
+        uint32_t nextIndex = sortedBuffer[lastNode + 2];
+        uint32_t listHead = otherCount > BaseLength ? sortedMap[otherCount] : otherCount - 1;
+
+        if (prevIndex != 0) {
+            sortedBuffer[prevIndex + 2] = nextIndex;
+            if (nextIndex != 0) {
+                sortedBuffer[nextIndex + 1] = prevIndex;
+            } else {
+                sortedBuffer[listHead] = prevIndex;
+            }
+        } else {
+            if (nextIndex == 0) {
+                sortedBuffer[listHead] = 0;
+                if (otherCount > BaseLength) {
+                    sortedMap.erase(otherCount);
+                    stats_add(histogram.stats.mapErases);
                 }
+            } else {
+                sortedBuffer[nextIndex + 1] = prevIndex;
             }
         }
-    }
+
+        if (newCount != 0) {
+            if (newCount > BaseLength) {
+                uint32_t& oldListHead = sortedMap[newCount];
+                if (oldListHead == 0) {
+                    stats_add(histogram.stats.mapInserts);
+                    listHead = sortedBuffer.size();
+                    oldListHead = listHead;
+                    sortedBuffer.push_back(0);
+                } else {
+                    listHead = oldListHead;
+                }
+            } else {
+                listHead = newCount - 1;
+            }
+
+            if (sortedBuffer[listHead] != 0) {
+                sortedBuffer[sortedBuffer[listHead] + 2] = lastNode;
+            }
+            sortedBuffer[lastNode + 0] = otherRgb;
+            sortedBuffer[lastNode + 1] = sortedBuffer[listHead];
+            sortedBuffer[lastNode + 2] = 0;
+            sortedBuffer[listHead] = lastNode;
+        }
+    });
+    stats_add(histogram.stats.absorbCellsNonEmpty, nonEmpty);
 
     return pixelCount;
 }
 
+// get_color_table consumes counts as it selects and absorbs colors. Each count is journaled before it is lowered
+// and the journal is replayed backwards afterwards, so the histogram is left intact for frame-by-frame updates at a
+// cost that follows what the call touched rather than the size of the histogram.
+class CountSnapshot {
+public:
+    explicit CountSnapshot(SpaceShockColorExtractor& extractor) : extractor(extractor) {
+        extractor.countJournal.clear();
+    }
+
+    CountSnapshot(const CountSnapshot&) = delete;
+
+    CountSnapshot& operator=(const CountSnapshot&) = delete;
+
+    ~CountSnapshot() {
+        StageClock clock;
+        for (auto it = extractor.countJournal.crbegin(); it != extractor.countJournal.crend(); ++it) {
+            extractor.colorCounts[static_cast<color_t>(*it >> 32)] = static_cast<uint32_t>(*it);
+        }
+        extractor.countJournal.clear();
+        clock.lap(extractor.stats.restoreNanoseconds);
+    }
+
+private:
+    SpaceShockColorExtractor& extractor;
+};
+
 struct ColorInfo {
     double r, g, b, count;
+    // the rounded mean as a point of a nonlinear metric
+    MetricPoint point;
+};
+
+static color_t mean_color(const ColorInfo& info) {
+    uint32_t r = static_cast<uint32_t>(round(info.r));
+    uint32_t g = static_cast<uint32_t>(round(info.g));
+    uint32_t b = static_cast<uint32_t>(round(info.b));
+    return (r << 16) | (g << 8) | b;
+}
+
+// The counter a reduce-phase color merges into. Metrics that weight RGB compare against the exact means.
+template<typename TMetric>
+static size_t nearest_counter(const ColorInfo* counter, size_t infoCount, color_t rgb) {
+    size_t reduceIndex = 0;
+
+    if constexpr (TMetric::Nonlinear) {
+        MetricPoint point = TMetric::point(rgb);
+        int minDist = std::numeric_limits<int>::max();
+        for (size_t i = 0; i < infoCount; i++) {
+            int dist = metric_distance<TMetric>(counter[i].point, point);
+            if (dist < minDist) {
+                minDist = dist;
+                reduceIndex = i;
+            }
+        }
+    } else {
+        double r = reinterpret_cast<uint8_t*>(&rgb)[2];
+        double g = reinterpret_cast<uint8_t*>(&rgb)[1];
+        double b = reinterpret_cast<uint8_t*>(&rgb)[0];
+        double minVar = std::numeric_limits<double>::infinity();
+        for (size_t i = 0; i < infoCount; i++) {
+            double dr = r - counter[i].r;
+            double dg = g - counter[i].g;
+            double db = b - counter[i].b;
+            double currVar = TMetric::Weights[0] * dr * dr + TMetric::Weights[1] * dg * dg + TMetric::Weights[2] * db * db;
+            if (currVar < minVar) {
+                minVar = currVar;
+                reduceIndex = i;
+            }
+        }
+    }
+
+    return reduceIndex;
+}
+
+// Progress against a ColorTableBudget: the share of it spent so far, the larger of the time and work shares.
+class TableBudget {
+public:
+    uint64_t work;
+    uint32_t shortcuts;
+
+    explicit TableBudget(const ColorTableBudget* budget) : work(0), shortcuts(0), start(std::chrono::steady_clock::now()),
+        deadlineNanoseconds(budget ? budget->deadlineNanoseconds : 0), maxWork(budget ? budget->maxWork : 0) {
+    }
+
+    bool limited() const { return deadlineNanoseconds != 0 || maxWork != 0; }
+
+    bool past_deadline() const {
+        return deadlineNanoseconds != 0 && static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count()) > deadlineNanoseconds;
+    }
+
+    double spent() const {
+        double share = maxWork ? static_cast<double>(work) / maxWork : 0;
+        if (deadlineNanoseconds) {
+            auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+            share = std::max(share, static_cast<double>(elapsed) / deadlineNanoseconds);
+        }
+        return share;
+    }
+
+private:
+    std::chrono::steady_clock::time_point start;
+    uint64_t deadlineNanoseconds;
+    uint64_t maxWork;
 };
 
 static constexpr double smooth(double x) {
@@ -244,13 +860,15 @@ static constexpr double smooth(double x) {
     return y;
 }
 
-EXPORT_API
-size_t get_color_table(SpaceShockColorExtractor& extractor, color_t* colorTable, size_t tableLength, const color_t* forceColors, size_t forceColorCount) {
+template<typename TMetric, typename THistogram>
+static size_t color_table(THistogram& histogram, color_t* colorTable, size_t tableLength, const color_t* forceColors, size_t forceColorCount, TableBudget& budget) {
     if (tableLength < forceColorCount) return static_cast<size_t>(-1);
 
     constexpr double E = 2.7182818284590451;
     constexpr double PI = 3.1415926535897931;
     constexpr uint32_t SkipMinCount = 3;
+    // share of a limited budget the select phase may spend; the reduce phase fits itself into the rest
+    constexpr double SelectShare = 0.75;
 
     color_t forceColorList[forceColorCount];
     for (size_t i = 0; i < forceColorCount; i++) {
@@ -258,8 +876,11 @@ size_t get_color_table(SpaceShockColorExtractor& extractor, color_t* colorTable,
     }
 
     ColorInfo counter[tableLength];
-    std::vector<uint16_t, u16allocator> kernel;
-    auto [sortedBuffer, sortedMap] = sort_colors(extractor);
+    std::conditional_t<std::is_same_v<THistogram, SparseHistogram>, KernelFunction, KernelTable> kernel;
+    StageClock clock;
+    stats_add(histogram.stats.colorTableCalls);
+    auto [sortedBuffer, sortedMap] = sort_colors(histogram);
+    clock.lap(histogram.stats.sortNanoseconds);
 
     uint32_t maxPixelCount;
     if (!sortedMap.empty()) {
@@ -274,28 +895,34 @@ size_t get_color_table(SpaceShockColorExtractor& extractor, color_t* colorTable,
     const int MaxKernelSize = 28;
     const int MinKernelSize = std::clamp<int>(static_cast<int>(MaxKernelSize * exp((tableLength - forceColorCount) / -64.0)), 2, MaxKernelSize - 1);
     size_t outIndex = 0;
-    double pixelTotalCount = extractor.pixelTotalCount;
+    double pixelTotalCount = histogram.pixelTotalCount;
 
     if (forceColorCount) {
-        create_kernel(kernel, MinKernelSize, 1 / PI);
+        kernel.build(MinKernelSize, 1 / PI);
+        stats_add(histogram.stats.kernelRebuilds);
 
         for (color_t color : forceColorList) {
-            pixelTotalCount -= absorb_color(extractor, sortedBuffer, sortedMap, kernel, MinKernelSize, color, maxPixelCount);
+            pixelTotalCount -= absorb_color(histogram, sortedBuffer, sortedMap, kernel, MinKernelSize, color, maxPixelCount, budget.work);
             colorTable[outIndex++] = color;
         }
     }
 
-
+    clock.lap(histogram.stats.forceNanoseconds);
     if (outIndex == tableLength) return outIndex;
 
     uint32_t pixelCount;
     uint32_t decrementPixelCount = BaseLength;
     uint32_t listHead, lastNode;
     color_t rgb;
+    // Shape of the kernel last built. Picks that skip absorbing leave it as is, and the first pick always builds
+    // since kernel sizes start at 2, so prevAffect is never compared before it is set.
     uint32_t prevKernelSize = 0;
-    double prevAffect;
+    double prevAffect = 0;
     double x0 = 0;
     double consumePixelCount = 0;
+    int kernelCap = MaxKernelSize;
+    double selectStart = budget.spent();
+    uint64_t selectStartWork = budget.work;
 
     for (; outIndex < tableLength; outIndex++) {
         if (!sortedMap.empty()) {
@@ -305,6 +932,7 @@ size_t get_color_table(SpaceShockColorExtractor& extractor, color_t* colorTable,
             sortedBuffer[listHead] = sortedBuffer[lastNode + 1];
             if (sortedBuffer[listHead] == 0) {
                 sortedMap.erase(--sortedMap.cend());
+                stats_add(histogram.stats.mapErases);
             }
         } else {
             for (;; decrementPixelCount--) {
@@ -322,7 +950,10 @@ size_t get_color_table(SpaceShockColorExtractor& extractor, color_t* colorTable,
             }
         }
 
-        extractor.colorCounts[rgb].count = 0;
+        stats_add(histogram.stats.selectIterations);
+        uint32_t& selectedCount = color_count(histogram, rgb);
+        journal_count(histogram, rgb, selectedCount);
+        selectedCount = 0;
         colorTable[outIndex] = rgb;
         ColorInfo& colorInfo = counter[outIndex - forceColorCount];
 
@@ -337,27 +968,64 @@ size_t get_color_table(SpaceShockColorExtractor& extractor, color_t* colorTable,
         dx += dx * smooth(8 * ((reference - b0) * (1 - a0) + (reference - x0) * a0));
         x0 = std::clamp<double>(x0 + dx, 0, 1);
 
-        if (prevKernelSize != kernelSize || abs(prevAffect - affect) > 0.01) {
-            create_kernel(kernel, kernelSize, affect);
+        bool absorb = true;
+        if (budget.limited() && budget.work - selectStartWork >= 0x10000) {
+            // Caps the kernel to the cells this and every later pick can still afford at the cost per cell
+            // measured so far. The cap never grows back, which bounds kernel rebuilds. Without room even for
+            // the smallest kernel, colors from the low-count range are picked without absorbing their neighbors.
+            double spent = budget.spent();
+            double cellShare = (spent - selectStart) / (budget.work - selectStartWork);
+            double cellsPerPick = (SelectShare - spent) / cellShare / (tableLength - outIndex);
+            int affordable = cellsPerPick > 1 ? static_cast<int>((std::cbrt(cellsPerPick) - 1) / 2) : 0;
+            kernelCap = std::min(kernelCap, std::max(affordable, 1));
+            if (static_cast<int>(kernelSize) > kernelCap) {
+                kernelSize = kernelCap;
+                budget.shortcuts |= ShortcutSmallKernels;
+            }
+            if (affordable == 0 && pixelCount <= BaseLength) {
+                absorb = false;
+                budget.shortcuts |= ShortcutSkipAbsorb;
+            }
+        }
+
+        if (absorb && (prevKernelSize != kernelSize || std::abs(prevAffect - affect) > 0.01)) {
+            kernel.build(kernelSize, affect);
+            stats_add(histogram.stats.kernelRebuilds);
             prevKernelSize = kernelSize;
             prevAffect = affect;
         }
 
 
-        size_t absorbCount = absorb_color(extractor, sortedBuffer, sortedMap, kernel, kernelSize, rgb, pixelCount);
+        size_t absorbCount = absorb ? absorb_color(histogram, sortedBuffer, sortedMap, kernel, kernelSize, rgb, pixelCount, budget.work) : 0;
         consumePixelCount += pixelCount + absorbCount;
         colorInfo.r = reinterpret_cast<uint8_t*>(&rgb)[2];
         colorInfo.g = reinterpret_cast<uint8_t*>(&rgb)[1];
         colorInfo.b = reinterpret_cast<uint8_t*>(&rgb)[0];
         colorInfo.count = pixelCount + absorbCount;
+        if constexpr (TMetric::Nonlinear) colorInfo.point = TMetric::point(rgb);
     }
 
 
 ReduceBegin:
+    clock.lap(histogram.stats.selectNanoseconds);
     if (outIndex < tableLength) return outIndex;
 
     size_t infoCount = tableLength - forceColorCount;
 
+    // With a limited budget, the colors left at each count level let the reduce phase drop whole levels it
+    // cannot finish at the pace measured so far, which raises SkipMinCount for this call.
+    std::vector<size_t> levelSizes;
+    uint32_t currentLevel = 0;
+    size_t reduceIterations = 0;
+    double reduceStart = 0;
+    if (budget.limited()) {
+        levelSizes.resize(BaseLength + 1);
+        for (uint32_t level = SkipMinCount + 1; level <= std::min<uint32_t>(decrementPixelCount, BaseLength); level++) {
+            for (uint32_t node = sortedBuffer[level - 1]; node != 0; node = sortedBuffer[node + 1]) levelSizes[level]++;
+        }
+        reduceStart = budget.spent();
+    }
+
     while (true) {
         if (!sortedMap.empty()) {
             std::tie(pixelCount, listHead) = *sortedMap.crbegin();
@@ -366,6 +1034,7 @@ ReduceBegin:
             sortedBuffer[listHead] = sortedBuffer[lastNode + 1];
             if (sortedBuffer[listHead] == 0) {
                 sortedMap.erase(--sortedMap.cend());
+                stats_add(histogram.stats.mapErases);
             }
         } else {
             for (;; decrementPixelCount--) {
@@ -375,6 +1044,15 @@ ReduceBegin:
                 if (lastNode != 0) break;
             }
 
+            if (budget.limited() && decrementPixelCount != currentLevel) {
+                currentLevel = decrementPixelCount;
+                double spent = budget.spent();
+                if (reduceIterations >= 256 && spent + (spent - reduceStart) / reduceIterations * levelSizes[currentLevel] > 1) {
+                    budget.shortcuts |= ShortcutRaisedSkipMinCount;
+                    goto Return;
+                }
+            }
+
             rgb = sortedBuffer[lastNode];
             pixelCount = decrementPixelCount;
             sortedBuffer[listHead] = sortedBuffer[lastNode + 1];
@@ -383,22 +1061,17 @@ ReduceBegin:
             }
         }
 
+        stats_add(histogram.stats.reduceIterations);
+        if (budget.limited() && (++reduceIterations & 1023) == 0 && budget.spent() >= 1) {
+            budget.shortcuts |= ShortcutReduceStopped;
+            goto Return;
+        }
+        budget.work += infoCount;
+
         double r = reinterpret_cast<uint8_t*>(&rgb)[2];
         double g = reinterpret_cast<uint8_t*>(&rgb)[1];
         double b = reinterpret_cast<uint8_t*>(&rgb)[0];
-        double minVar = std::numeric_limits<double>::infinity();
-        size_t reduceIndex;
-
-        for (size_t i = 0; i < infoCount; i++) {
-            double dr = r - counter[i].r;
-            double dg = g - counter[i].g;
-            double db = b - counter[i].b;
-            double currVar = dr * dr + dg * dg + db * db;
-            if (currVar < minVar) {
-                minVar = currVar;
-                reduceIndex = i;
-            }
-        }
+        size_t reduceIndex = nearest_counter<TMetric>(counter, infoCount, rgb);
 
         double newPixelCount = pixelCount;
         double totalCount = counter[reduceIndex].count + newPixelCount;
@@ -406,14 +1079,381 @@ ReduceBegin:
         counter[reduceIndex].g = (counter[reduceIndex].g * counter[reduceIndex].count + g * newPixelCount) / totalCount;
         counter[reduceIndex].b = (counter[reduceIndex].b * counter[reduceIndex].count + b * newPixelCount) / totalCount;
         counter[reduceIndex].count = totalCount;
+        if constexpr (TMetric::Nonlinear) counter[reduceIndex].point = TMetric::point(mean_color(counter[reduceIndex]));
     }
 
 Return:
+    clock.lap(histogram.stats.reduceNanoseconds);
     for (size_t i = 0; i < infoCount; i++) {
-        uint32_t r = static_cast<uint32_t>(round(counter[i].r));
-        uint32_t g = static_cast<uint32_t>(round(counter[i].g));
-        uint32_t b = static_cast<uint32_t>(round(counter[i].b));
-        colorTable[forceColorCount + i] = (r << 16) | (g << 8) | b;
+        colorTable[forceColorCount + i] = mean_color(counter[i]);
     }
     return tableLength;
-}
\ No newline at end of file
+}
+
+static size_t extractor_color_table(SpaceShockColorExtractor& extractor, color_t* colorTable, size_t tableLength, const color_t* forceColors, size_t forceColorCount, TableBudget& budget) {
+    if (tableLength < forceColorCount) return static_cast<size_t>(-1);
+
+    CountSnapshot snapshot(extractor);
+    extractor.tablePixelCount = extractor.pixelTotalCount;
+    extractor.driftCount = 0;
+
+    return with_metric(extractor.metric, static_cast<size_t>(-1), [&]<typename TMetric>() {
+        return color_table<TMetric>(extractor, colorTable, tableLength, forceColors, forceColorCount, budget);
+    });
+}
+
+EXPORT_API
+size_t get_color_table(SpaceShockColorExtractor& extractor, color_t* colorTable, size_t tableLength, const color_t* forceColors, size_t forceColorCount) {
+    TableBudget budget(nullptr);
+    return extractor_color_table(extractor, colorTable, tableLength, forceColors, forceColorCount, budget);
+}
+
+// Like get_color_table, but trades quality for staying within `budget`: smaller absorb kernels, no absorption for
+// low-count colors and a shorter reduce phase. The table is always complete; `shortcuts` receives the
+// ColorTableShortcut flags of what was cut.
+EXPORT_API
+size_t get_color_table_budget(SpaceShockColorExtractor& extractor, color_t* colorTable, size_t tableLength, const color_t* forceColors, size_t forceColorCount, const ColorTableBudget* budget, uint32_t* shortcuts) {
+    TableBudget tableBudget(budget);
+    size_t colorCount = extractor_color_table(extractor, colorTable, tableLength, forceColors, forceColorCount, tableBudget);
+    if (tableBudget.past_deadline()) tableBudget.shortcuts |= ShortcutDeadline;
+    if (shortcuts) *shortcuts = tableBudget.shortcuts;
+    return colorCount;
+}
+
+// Reduces the histogram to channelBits bits per channel. The colors of each cell of the coarse grid merge into one
+// at their count-weighted centroid, which lies inside the cell, so no two cells share a color.
+static void build_coarse_histogram(const SpaceShockColorExtractor& extractor, int channelBits, SparseHistogram& histogram) {
+    struct Cell {
+        uint64_t count, r, g, b;
+    };
+
+    int shift = 8 - channelBits;
+    std::vector<Cell> cells(size_t{ 1 } << (channelBits * 3));
+    for (color_t color : extractor.colorList) {
+        uint32_t count = extractor.colorCounts[color];
+        if (count == 0) continue;
+
+        uint32_t r = color >> 16 & 0xff, g = color >> 8 & 0xff, b = color & 0xff;
+        Cell& cell = cells[(r >> shift) << (channelBits * 2) | (g >> shift) << channelBits | (b >> shift)];
+        cell.count += count;
+        cell.r += uint64_t{ count } * r;
+        cell.g += uint64_t{ count } * g;
+        cell.b += uint64_t{ count } * b;
+    }
+
+    // centroids with their counts in the low 32 bits, in the order of their cells until sorted
+    std::vector<uint64_t> keys, scratch;
+    for (const Cell& cell : cells) {
+        if (cell.count == 0) continue;
+        uint64_t half = cell.count / 2;
+        uint64_t color = (cell.r + half) / cell.count << 16 | (cell.g + half) / cell.count << 8 | (cell.b + half) / cell.count;
+        keys.push_back(color << 32 | std::min<uint64_t>(cell.count, std::numeric_limits<uint32_t>::max()));
+    }
+    sort_by_color(keys, scratch);
+
+    histogram.colorList.resize(keys.size());
+    histogram.colorCounts.resize(keys.size());
+    histogram.colorNodes.resize(keys.size());
+    histogram.pixelTotalCount = 0;
+    for (size_t i = 0; i < keys.size(); i++) {
+        histogram.colorList[i] = static_cast<color_t>(keys[i] >> 32);
+        histogram.colorCounts[i] = static_cast<uint32_t>(keys[i]);
+        histogram.pixelTotalCount += histogram.colorCounts[i];
+    }
+}
+
+// Colors of the full histogram in some cells of a grid of channelBits bits per channel, with their counts: a cell
+// with a slot s holds colors[starts[s]..ends[s]).
+struct CellMembers {
+    static constexpr uint32_t NoSlot = std::numeric_limits<uint32_t>::max();
+
+    int channelBits;
+    std::vector<uint32_t> slots;
+    std::vector<uint32_t> starts, ends;
+    std::vector<color_t> colors;
+    std::vector<uint32_t> counts;
+
+    size_t cell_index(int r, int g, int b) const {
+        int shift = 8 - channelBits;
+        return static_cast<size_t>(r >> shift) << (channelBits * 2) | static_cast<size_t>(g >> shift) << channelBits | static_cast<size_t>(b >> shift);
+    }
+
+    size_t cell_index(color_t color) const {
+        return cell_index(color >> 16 & 0xff, color >> 8 & 0xff, color & 0xff);
+    }
+};
+
+// Visits the cells overlapped by the box of `radius` around `color`, at most two per channel for half a cell.
+template<typename TVisitor>
+static void for_each_cell_in_box(int channelBits, color_t color, int radius, TVisitor&& visit) {
+    int shift = 8 - channelBits;
+    int center[3] = { static_cast<int>(color >> 16 & 0xff), static_cast<int>(color >> 8 & 0xff), static_cast<int>(color & 0xff) };
+    int start[3], last[3];
+    for (size_t c = 0; c < 3; c++) {
+        start[c] = std::max(center[c] - radius, 0) >> shift << shift;
+        last[c] = std::min(center[c] + radius, 255);
+    }
+    for (int r = start[0]; r <= last[0]; r += 1 << shift) {
+        for (int g = start[1]; g <= last[1]; g += 1 << shift) {
+            for (int b = start[2]; b <= last[2]; b += 1 << shift) {
+                visit(r, g, b);
+            }
+        }
+    }
+}
+
+// Collects the members of the cells the refined entries can reach: one pass over colorList keeps the colors of
+// those cells, usually a small share, and a counting sort groups them by cell.
+static void gather_cell_members(const SpaceShockColorExtractor& extractor, int channelBits, const color_t* colorTable, size_t colorCount, size_t forceColorCount, int radius, CellMembers& members) {
+    members.channelBits = channelBits;
+    members.slots.assign(size_t{ 1 } << (channelBits * 3), CellMembers::NoSlot);
+    uint32_t slotCount = 0;
+    for (size_t i = forceColorCount; i < colorCount; i++) {
+        for_each_cell_in_box(channelBits, colorTable[i], radius, [&](int r, int g, int b) {
+            uint32_t& slot = members.slots[members.cell_index(r, g, b)];
+            if (slot == CellMembers::NoSlot) slot = slotCount++;
+        });
+    }
+
+    // reached colors with their counts in the low 32 bits
+    std::vector<uint64_t> reached;
+    members.starts.assign(slotCount + 1, 0);
+    for (color_t color : extractor.colorList) {
+        uint32_t slot = members.slots[members.cell_index(color)];
+        if (slot == CellMembers::NoSlot) continue;
+        uint32_t count = extractor.colorCounts[color];
+        if (count == 0) continue;
+        reached.push_back(uint64_t{ color } << 32 | count);
+        members.starts[slot + 1]++;
+    }
+    for (uint32_t s = 0; s < slotCount; s++) {
+        members.starts[s + 1] += members.starts[s];
+    }
+
+    members.ends.assign(members.starts.begin(), members.starts.end() - 1);
+    members.colors.resize(reached.size());
+    members.counts.resize(reached.size());
+    for (uint64_t key : reached) {
+        color_t color = static_cast<color_t>(key >> 32);
+        uint32_t& end = members.ends[members.slots[members.cell_index(color)]];
+        members.colors[end] = color;
+        members.counts[end] = static_cast<uint32_t>(key);
+        end++;
+    }
+}
+
+// One bounded k-means step against the full histogram: every entry after the forced colors moves to the
+// count-weighted mean of the colors within `radius` of it per channel that map to it, or stays if none do. A
+// radius of half a cell reaches at most two cells per channel, whose members are the only colors visited.
+// Whether a color maps to entry i is decided as an unoptimized palette would, but since every metric is a
+// squared Euclidean distance, an entry j can only be as near to color m as i is when d(i, j) <= 4 d(i, m); the
+// other entries are tried in order of their distance to i up to that bound.
+template<typename TMetric>
+static void refine_color_table(const CellMembers& members, color_t* colorTable, size_t colorCount, size_t forceColorCount, int radius) {
+    MetricPoint points[256];
+    for (size_t i = 0; i < colorCount; i++) points[i] = TMetric::point(colorTable[i]);
+    std::vector<color_t> refined(colorTable, colorTable + colorCount);
+
+    parallel_for(colorCount - forceColorCount, 1, [&](size_t begin, size_t end) {
+        std::vector<std::pair<int, uint32_t>> neighbors;
+        for (size_t i = forceColorCount + begin; i < forceColorCount + end; i++) {
+            neighbors.clear();
+            for (uint32_t j = 0; j < colorCount; j++) {
+                if (j != i) neighbors.emplace_back(metric_distance<TMetric>(points[i], points[j]), j);
+            }
+            std::sort(neighbors.begin(), neighbors.end());
+
+            int center[3] = { static_cast<int>(colorTable[i] >> 16 & 0xff), static_cast<int>(colorTable[i] >> 8 & 0xff), static_cast<int>(colorTable[i] & 0xff) };
+            uint64_t count = 0, sum[3] = {};
+            for_each_cell_in_box(members.channelBits, colorTable[i], radius, [&](int r, int g, int b) {
+                uint32_t slot = members.slots[members.cell_index(r, g, b)];
+                for (uint32_t k = members.starts[slot]; k < members.ends[slot]; k++) {
+                    color_t color = members.colors[k];
+                    int channels[3] = { static_cast<int>(color >> 16 & 0xff), static_cast<int>(color >> 8 & 0xff), static_cast<int>(color & 0xff) };
+                    if (std::abs(channels[0] - center[0]) > radius || std::abs(channels[1] - center[1]) > radius || std::abs(channels[2] - center[2]) > radius) continue;
+
+                    MetricPoint point = TMetric::point(color);
+                    int dist = metric_distance<TMetric>(points[i], point);
+                    bool nearest = true;
+                    for (auto [between, j] : neighbors) {
+                        if (between > int64_t{ dist } * 4) break;
+                        int other = metric_distance<TMetric>(points[j], point);
+                        if (other < dist || (other == dist && j < i)) {
+                            nearest = false;
+                            break;
+                        }
+                    }
+                    if (!nearest) continue;
+
+                    uint64_t weight = members.counts[k];
+                    count += weight;
+                    for (size_t c = 0; c < 3; c++) sum[c] += weight * channels[c];
+                }
+            });
+            if (count == 0) continue;
+
+            uint64_t half = count / 2;
+            refined[i] = static_cast<color_t>((sum[0] + half) / count << 16 | (sum[1] + half) / count << 8 | (sum[2] + half) / count);
+        }
+    });
+
+    std::copy(refined.begin(), refined.end(), colorTable);
+}
+
+// Like get_color_table, but for histograms of many distinct colors: extracts from a copy reduced to channelBits
+// bits per channel, then refines each extracted entry against the full histogram around it. Far fewer colors to
+// sort, absorb and merge at some loss of quality. Only 5 and 6 bits are accepted, the grids measured to beat
+// get_color_table; coarser ones leave more colors to refine per entry. Tables are limited to 256 colors, as for a
+// palette.
+EXPORT_API
+size_t get_color_table_coarse(SpaceShockColorExtractor& extractor, color_t* colorTable, size_t tableLength, const color_t* forceColors, size_t forceColorCount, size_t channelBits) {
+    if (tableLength < forceColorCount || tableLength > 256 || channelBits < 5 || channelBits > 6) return static_cast<size_t>(-1);
+
+    SparseHistogram coarse{};
+    build_coarse_histogram(extractor, static_cast<int>(channelBits), coarse);
+    coarse.stats = extractor.stats;
+    extractor.tablePixelCount = extractor.pixelTotalCount;
+    extractor.driftCount = 0;
+
+    TableBudget budget(nullptr);
+    size_t colorCount = with_metric(extractor.metric, static_cast<size_t>(-1), [&]<typename TMetric>() {
+        size_t count = color_table<TMetric>(coarse, colorTable, tableLength, forceColors, forceColorCount, budget);
+        if (count != static_cast<size_t>(-1) && count > forceColorCount) {
+            int radius = 1 << (7 - channelBits);
+            CellMembers members;
+            gather_cell_members(extractor, static_cast<int>(channelBits), colorTable, count, forceColorCount, radius, members);
+            refine_color_table<TMetric>(members, colorTable, count, forceColorCount, radius);
+        }
+        return count;
+    });
+    extractor.stats = coarse.stats;
+    return colorCount;
+}
+
+// Sets the metric get_color_table merges colors under in its reduce phase, which should match the metric of the
+// palette the table is used with. Returns false for an unknown metric.
+EXPORT_API
+bool extractor_set_metric(SpaceShockColorExtractor& extractor, ColorMetric metric) {
+    if (metric > MetricOklab) return false;
+    extractor.metric = metric;
+    return true;
+}
+
+EXPORT_API
+bool extractor_stats(const SpaceShockColorExtractor& extractor, ExtractorStats* stats) {
+    *stats = extractor.stats;
+    return StatsEnabled;
+}
+
+// ========== tiles ==========
+
+// Fills `keys` with the pixels of a tile sorted by color, the color in the high and the position in the tile in
+// the low 32 bits, and counts them into `histogram`. Byte passes are stable, so each color keeps scan order.
+static void build_tile_histogram(const color_t* pixels, size_t width, const TileRect& tile, std::vector<uint64_t>& keys, std::vector<uint64_t>& scratch, SparseHistogram& histogram) {
+    size_t area = tile.width * tile.height;
+    keys.resize(area);
+    for (size_t y = 0; y < tile.height; y++) {
+        const color_t* row = pixels + (tile.y + y) * width + tile.x;
+        for (size_t x = 0; x < tile.width; x++) {
+            keys[y * tile.width + x] = static_cast<uint64_t>(row[x] & 0xffffff) << 32 | (y * tile.width + x);
+        }
+    }
+
+    sort_by_color(keys, scratch);
+
+    histogram.colorList.clear();
+    histogram.colorCounts.clear();
+    for (uint64_t key : keys) {
+        color_t color = static_cast<color_t>(key >> 32);
+        if (histogram.colorList.empty() || histogram.colorList.back() != color) {
+            histogram.colorList.push_back(color);
+            histogram.colorCounts.push_back(0);
+        }
+        histogram.colorCounts.back()++;
+    }
+    histogram.colorNodes.resize(histogram.colorCounts.size());
+    histogram.pixelTotalCount = area;
+}
+
+// Looks up each color of the tile once, exactly as an unoptimized palette would, and writes its index to every
+// pixel of that color.
+template<typename TMetric>
+static void map_tile(const std::vector<uint64_t>& keys, const color_t* colorTable, size_t tableLength, uint8_t* indexes) {
+    MetricPoint points[256];
+    for (size_t i = 0; i < tableLength; i++) points[i] = TMetric::point(colorTable[i]);
+
+    color_t prevColor = static_cast<color_t>(-1);
+    uint8_t index = 0;
+    for (uint64_t key : keys) {
+        color_t color = static_cast<color_t>(key >> 32);
+        if (color != prevColor) {
+            MetricPoint point = TMetric::point(color);
+            int minDist = std::numeric_limits<int>::max();
+            for (size_t i = 0; i < tableLength; i++) {
+                int dist = metric_distance<TMetric>(points[i], point);
+                if (dist < minDist) {
+                    index = static_cast<uint8_t>(i);
+                    minDist = dist;
+                    if (dist == 0) break;
+                }
+            }
+            prevColor = color;
+        }
+        indexes[static_cast<uint32_t>(key)] = index;
+    }
+}
+
+// Splits the image into tiles of tileWidth x tileHeight in row-major order, the last column and row cut to the
+// image. Returns the tile count; a null `tiles` only queries it, and a smaller `tileCapacity` returns -1.
+EXPORT_API
+size_t tiles_grid(size_t width, size_t height, size_t tileWidth, size_t tileHeight, TileRect* tiles, size_t tileCapacity) {
+    if (tileWidth == 0 || tileHeight == 0) return 0;
+
+    size_t columns = (width + tileWidth - 1) / tileWidth;
+    size_t rows = (height + tileHeight - 1) / tileHeight;
+    if (tiles == nullptr) return columns * rows;
+    if (tileCapacity < columns * rows) return static_cast<size_t>(-1);
+
+    for (size_t row = 0; row < rows; row++) {
+        for (size_t column = 0; column < columns; column++) {
+            size_t x = column * tileWidth, y = row * tileHeight;
+            tiles[row * columns + column] = { x, y, std::min(tileWidth, width - x), std::min(tileHeight, height - y) };
+        }
+    }
+    return columns * rows;
+}
+
+// Extracts a table of up to `tableLength` colors for every tile and maps the tile with it, tiles in parallel.
+// Each tile gets a compact histogram of its own, built from a single read of its pixels. The table of tile i
+// goes to colorTables + i * tableLength, zero-padded, with its length in tableLengths[i]; its indexes follow
+// those of tile i - 1 in `indexes`, row by row. Returns the number of indexes written, or -1 for a tile outside
+// the image, a table longer than 256 colors or an unknown metric.
+EXPORT_API
+size_t tiles_quantize(const color_t* pixels, size_t width, size_t height, const TileRect* tiles, size_t tileCount, size_t tableLength, ColorMetric metric, color_t* colorTables, size_t* tableLengths, uint8_t* indexes) {
+    if (tableLength == 0 || tableLength > 256) return static_cast<size_t>(-1);
+
+    std::vector<size_t> offsets(tileCount + 1);
+    for (size_t i = 0; i < tileCount; i++) {
+        const TileRect& tile = tiles[i];
+        if (tile.x > width || tile.width > width - tile.x || tile.y > height || tile.height > height - tile.y) return static_cast<size_t>(-1);
+        if (tile.width * tile.height > std::numeric_limits<uint32_t>::max()) return static_cast<size_t>(-1);
+        offsets[i + 1] = offsets[i] + tile.width * tile.height;
+    }
+
+    return with_metric(metric, static_cast<size_t>(-1), [&]<typename TMetric>() {
+        parallel_for(tileCount, 1, [&](size_t begin, size_t end) {
+            SparseHistogram histogram{};
+            std::vector<uint64_t> keys, scratch;
+            for (size_t i = begin; i < end; i++) {
+                color_t* colorTable = colorTables + i * tableLength;
+                build_tile_histogram(pixels, width, tiles[i], keys, scratch, histogram);
+                TableBudget budget(nullptr);
+                size_t colorCount = color_table<TMetric>(histogram, colorTable, tableLength, nullptr, 0, budget);
+                std::fill(colorTable + colorCount, colorTable + tableLength, 0);
+                tableLengths[i] = colorCount;
+                map_tile<TMetric>(keys, colorTable, colorCount, indexes + offsets[i]);
+            }
+        });
+        return offsets[tileCount];
+    });
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <array>
+#include <algorithm>
+#include "ColorQuantization.h"
+
+// A color as a point of the space a metric measures in. Every metric is a weighted squared Euclidean distance
+// between points, so box bounds and bisecting planes prune candidates the same way under all of them.
+struct MetricPoint {
+    int v[3];
+};
+
+// Bounds of the points of every color in an RGB cube.
+struct MetricBox {
+    int lo[3], hi[3];
+};
+
+template<typename TMetric>
+inline int metric_distance(const MetricPoint& p, const MetricPoint& q) {
+    int d0 = p.v[0] - q.v[0];
+    int d1 = p.v[1] - q.v[1];
+    int d2 = p.v[2] - q.v[2];
+    return TMetric::Weights[0] * d0 * d0 + TMetric::Weights[1] * d1 * d1 + TMetric::Weights[2] * d2 * d2;
+}
+
+struct RgbMetric {
+    static constexpr ColorMetric Id = MetricRgb;
+    static constexpr int Weights[3] = { 1, 1, 1 };
+    // points are the RGB channels themselves, so means of colors can be compared without rounding them
+    static constexpr bool Nonlinear = false;
+
+    static MetricPoint point(color_t color) {
+        return { { static_cast<int>(color >> 16 & 0xff), static_cast<int>(color >> 8 & 0xff), static_cast<int>(color & 0xff) } };
+    }
+
+    // The cube of `size` values per channel starting at `origin`, closed one past its last value.
+    static MetricBox box(color_t origin, int size) {
+        MetricPoint lo = point(origin);
+        return { { lo.v[0], lo.v[1], lo.v[2] }, { lo.v[0] + size, lo.v[1] + size, lo.v[2] + size } };
+    }
+};
+
+struct LumaMetric : RgbMetric {
+    static constexpr ColorMetric Id = MetricLuma;
+    static constexpr int Weights[3] = { 299, 587, 114 };
+};
+
+// Oklab scaled so that L spans 0..4096. Points are computed in integers from two tables, so they are
+// reproducible and every step is monotone: the box of a cube follows exactly from its two extreme corners.
+struct OklabMetric {
+    static constexpr ColorMetric Id = MetricOklab;
+    static constexpr int Weights[3] = { 1, 1, 1 };
+    static constexpr bool Nonlinear = true;
+
+    // linear sRGB to LMS, 16 fractional bits; all positive, so LMS grows with every channel
+    static constexpr int Lms[3][3] = {
+        { 27015, 35149, 3372 },
+        { 13887, 44610, 7038 },
+        { 5787, 18463, 41286 },
+    };
+    // cube-rooted LMS to L, a, b, 12 fractional bits
+    static constexpr int Lab[3][3] = {
+        { 862, 3251, -17 },
+        { 8102, -9948, 1846 },
+        { 106, 3206, -3312 },
+    };
+
+    struct Tables {
+        std::array<int, 256> linear;      // sRGB channel to linear light, 0..65535
+        std::array<uint16_t, 65536> cbrt; // cube root of LMS / 65535, 0..4096
+
+        Tables() {
+            for (size_t i = 0; i < linear.size(); i++) {
+                double c = i / 255.0;
+                linear[i] = static_cast<int>(std::lround((c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4)) * 65535));
+            }
+            for (size_t i = 0; i < cbrt.size(); i++) {
+                cbrt[i] = static_cast<uint16_t>(std::lround(std::cbrt(i / 65535.0) * 4096));
+            }
+        }
+    };
+
+    static const Tables& tables() {
+        static const Tables instance;
+        return instance;
+    }
+
+    static int lms(const Tables& t, const int* row, color_t color) {
+        int64_t sum = int64_t{ row[0] } * t.linear[color >> 16 & 0xff] + int64_t{ row[1] } * t.linear[color >> 8 & 0xff] + int64_t{ row[2] } * t.linear[color & 0xff];
+        return t.cbrt[std::min<int64_t>(sum >> 16, 65535)];
+    }
+
+    static int lab(const int* row, int l, int m, int s) {
+        return (row[0] * l + row[1] * m + row[2] * s + 2048) >> 12;
+    }
+
+    static MetricPoint point(color_t color) {
+        const Tables& t = tables();
+        int l = lms(t, Lms[0], color), m = lms(t, Lms[1], color), s = lms(t, Lms[2], color);
+        return { { lab(Lab[0], l, m, s), lab(Lab[1], l, m, s), lab(Lab[2], l, m, s) } };
+    }
+
+    // The cube of `size` values per channel starting at `origin`.
+    static MetricBox box(color_t origin, int size) {
+        const Tables& t = tables();
+        color_t last = origin + static_cast<color_t>((size - 1) * 0x010101);
+        int lo[3], hi[3];
+        for (size_t i = 0; i < 3; i++) {
+            lo[i] = lms(t, Lms[i], origin);
+            hi[i] = lms(t, Lms[i], last);
+        }
+
+        MetricBox box;
+        for (size_t i = 0; i < 3; i++) {
+            const int* row = Lab[i];
+            box.lo[i] = lab(row, row[0] < 0 ? hi[0] : lo[0], row[1] < 0 ? hi[1] : lo[1], row[2] < 0 ? hi[2] : lo[2]);
+            box.hi[i] = lab(row, row[0] < 0 ? lo[0] : hi[0], row[1] < 0 ? lo[1] : hi[1], row[2] < 0 ? lo[2] : hi[2]);
+        }
+        return box;
+    }
+};
+
+// Calls f.template operator()<TMetric>() with the policy of `metric`, or returns `fallback` for an unknown one.
+template<typename TFunc, typename TResult>
+inline TResult with_metric(ColorMetric metric, TResult fallback, TFunc&& f) {
+    switch (metric) {
+        case MetricRgb: return f.template operator()<RgbMetric>();
+        case MetricLuma: return f.template operator()<LumaMetric>();
+        case MetricOklab: return f.template operator()<OklabMetric>();
+        default: return fallback;
+    }
+}
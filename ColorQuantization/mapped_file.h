@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstddef>
+#include <utility>
+#include <filesystem>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read-only view of a whole file. Pages are shared between every process mapping the same file.
+class MappedFile {
+public:
+    MappedFile() = default;
+
+    explicit MappedFile(const std::filesystem::path& filename) {
+#if defined(_WIN32)
+        HANDLE file = CreateFileW(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return;
+
+        LARGE_INTEGER fileSize;
+        if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0) {
+            HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping != nullptr) {
+                ptr = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                if (ptr != nullptr) length = static_cast<size_t>(fileSize.QuadPart);
+                CloseHandle(mapping);
+            }
+        }
+        CloseHandle(file);
+#else
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0) return;
+
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* view = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+            if (view != MAP_FAILED) {
+                ptr = view;
+                length = static_cast<size_t>(st.st_size);
+            }
+        }
+        close(fd);
+#endif
+    }
+
+    MappedFile(MappedFile&& other) noexcept : ptr(std::exchange(other.ptr, nullptr)), length(std::exchange(other.length, 0)) {
+    }
+
+    MappedFile& operator=(MappedFile&& other) noexcept {
+        if (this != &other) {
+            unmap();
+            ptr = std::exchange(other.ptr, nullptr);
+            length = std::exchange(other.length, 0);
+        }
+        return *this;
+    }
+
+    MappedFile(const MappedFile&) = delete;
+
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        unmap();
+    }
+
+    const unsigned char* data() const { return static_cast<const unsigned char*>(ptr); }
+
+    size_t size() const { return length; }
+
+    explicit operator bool() const { return ptr != nullptr; }
+
+private:
+    void* ptr = nullptr;
+    size_t length = 0;
+
+    void unmap() {
+        if (ptr == nullptr) return;
+#if defined(_WIN32)
+        UnmapViewOfFile(ptr);
+#else
+        munmap(ptr, length);
+#endif
+        ptr = nullptr;
+        length = 0;
+    }
+};
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <utility>
+#include <algorithm>
+#include "ColorQuantization.h"
+
+// Number of tasks the scheduler runs at once besides the calling thread, 0 when everything runs inline.
+size_t scheduler_concurrency();
+
+// Runs `task` on a scheduler worker, or inline when there are no workers.
+void scheduler_post(task_callback task, void* taskData);
+
+// Runs run(context, chunk) for every chunk in [0, chunkCount); the calling thread takes part and returns once all chunks are done.
+void parallel_run(size_t chunkCount, void (*run)(void* context, size_t chunk), void* context);
+
+// Calls body(begin, end) for consecutive chunks of `grain` items covering [0, count).
+// Chunk boundaries depend only on count and grain, never on the worker count, so a body that writes nothing
+// but its own chunk's outputs gives byte-identical results for any number of threads.
+template<typename TBody>
+void parallel_for(size_t count, size_t grain, TBody&& body) {
+    size_t chunkCount = (count + grain - 1) / grain;
+    if (chunkCount <= 1 || scheduler_concurrency() == 0) {
+        if (count) body(size_t{ 0 }, count);
+        return;
+    }
+
+    struct Context {
+        TBody& body;
+        size_t count, grain;
+    } context{ body, count, grain };
+
+    parallel_run(chunkCount, [](void* p, size_t chunk) {
+        Context& context = *static_cast<Context*>(p);
+        size_t begin = chunk * context.grain;
+        context.body(begin, std::min(begin + context.grain, context.count));
+    }, &context);
+}
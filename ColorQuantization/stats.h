@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <chrono>
+#include <atomic>
+
+#if defined(COLORQUANTIZATION_STATS)
+constexpr bool StatsEnabled = true;
+#else
+constexpr bool StatsEnabled = false;
+#endif
+
+// Every call compiles away unless the library is built with COLORQUANTIZATION_STATS.
+// Atomic because palettes are shared by the threads of a parallel map.
+inline void stats_add(uint64_t& counter, uint64_t value = 1) {
+    if constexpr (StatsEnabled) std::atomic_ref(counter).fetch_add(value, std::memory_order_relaxed);
+}
+
+// Splits a run into consecutive stages, adding the wall time of each stage to its own counter.
+class StageClock {
+public:
+    StageClock() {
+        if constexpr (StatsEnabled) last = std::chrono::steady_clock::now();
+    }
+
+    void lap(uint64_t& nanoseconds) {
+        if constexpr (StatsEnabled) {
+            auto now = std::chrono::steady_clock::now();
+            nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(now - last).count();
+            last = now;
+        }
+    }
+
+private:
+    std::chrono::steady_clock::time_point last;
+};
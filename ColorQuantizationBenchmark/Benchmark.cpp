@@ -0,0 +1,735 @@
+#include <cinttypes>
+#include <cstdlib>
+#include <cstddef>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <functional>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <concepts>
+#include "ColorQuantization.h"
+
+using Clock = std::chrono::steady_clock;
+
+// SplitMix64, so generated images are identical on every platform and run.
+struct Random {
+    uint64_t state;
+
+    explicit Random(uint64_t seed) : state(seed) {}
+
+    uint64_t next() {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    int next_int(int minValue, int maxValue) {
+        return minValue + static_cast<int>(next() % static_cast<uint64_t>(maxValue - minValue + 1));
+    }
+};
+
+struct Image {
+    std::string name;
+    size_t width, height;
+    std::vector<color_t> pixels;
+
+    size_t size() const { return pixels.size(); }
+};
+
+static color_t make_rgb(int r, int g, int b) {
+    r = std::clamp(r, 0, 255);
+    g = std::clamp(g, 0, 255);
+    b = std::clamp(b, 0, 255);
+    return 0xff000000u | (static_cast<color_t>(r) << 16) | (static_cast<color_t>(g) << 8) | static_cast<color_t>(b);
+}
+
+static Image gradient_image(size_t width, size_t height) {
+    Image image{ "gradient", width, height, std::vector<color_t>(width * height) };
+    for (size_t y = 0; y < height; y++) {
+        for (size_t x = 0; x < width; x++) {
+            int r = static_cast<int>(x * 255 / std::max<size_t>(width - 1, 1));
+            int g = static_cast<int>(y * 255 / std::max<size_t>(height - 1, 1));
+            int b = static_cast<int>((x + y) * 255 / std::max<size_t>(width + height - 2, 1));
+            image.pixels[y * width + x] = make_rgb(r, g, 255 - b);
+        }
+    }
+    return image;
+}
+
+static Image noise_image(size_t width, size_t height) {
+    Image image{ "noise", width, height, std::vector<color_t>(width * height) };
+    Random random(1);
+    for (color_t& pixel : image.pixels) {
+        pixel = 0xff000000u | static_cast<color_t>(random.next() & 0xffffff);
+    }
+    return image;
+}
+
+static double lattice_value(uint32_t seed, int64_t x, int64_t y) {
+    Random random(seed * 0x100000001b3ULL ^ static_cast<uint64_t>(x) * 0x9e3779b1ULL ^ static_cast<uint64_t>(y) * 0x85ebca77ULL);
+    return (random.next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Fractal value noise in [0, 1): smooth large-scale structure with finer detail on top.
+static double value_noise(uint32_t seed, double x, double y) {
+    double sum = 0, amplitude = 0.5, total = 0;
+    for (int octave = 0; octave < 4; octave++) {
+        double fx = x - static_cast<int64_t>(x), fy = y - static_cast<int64_t>(y);
+        int64_t ix = static_cast<int64_t>(x), iy = static_cast<int64_t>(y);
+        double sx = fx * fx * (3 - 2 * fx), sy = fy * fy * (3 - 2 * fy);
+        double v00 = lattice_value(seed + octave, ix, iy), v10 = lattice_value(seed + octave, ix + 1, iy);
+        double v01 = lattice_value(seed + octave, ix, iy + 1), v11 = lattice_value(seed + octave, ix + 1, iy + 1);
+        double v = (v00 + (v10 - v00) * sx) + ((v01 + (v11 - v01) * sx) - (v00 + (v10 - v00) * sx)) * sy;
+        sum += v * amplitude;
+        total += amplitude;
+        amplitude *= 0.5;
+        x *= 2;
+        y *= 2;
+    }
+    return sum / total;
+}
+
+// Smooth color fields, flat-shaded shapes with hard edges and sensor-like noise.
+static Image photo_image(size_t width, size_t height) {
+    Image image{ "photo", width, height, std::vector<color_t>(width * height) };
+    Random random(2);
+    double scale = 6.0 / std::max(width, height);
+
+    struct Circle { double cx, cy, radius; int r, g, b; };
+    std::vector<Circle> circles(12);
+    for (Circle& circle : circles) {
+        circle.cx = random.next_int(0, static_cast<int>(width));
+        circle.cy = random.next_int(0, static_cast<int>(height));
+        circle.radius = random.next_int(8, static_cast<int>(std::max<size_t>(std::min(width, height) / 6, 9)));
+        circle.r = random.next_int(0, 255);
+        circle.g = random.next_int(0, 255);
+        circle.b = random.next_int(0, 255);
+    }
+
+    for (size_t y = 0; y < height; y++) {
+        for (size_t x = 0; x < width; x++) {
+            double u = x * scale, v = y * scale;
+            double light = value_noise(10, u * 0.5, v * 0.5);
+            int r = static_cast<int>(255 * light * (0.4 + 0.8 * value_noise(11, u, v)));
+            int g = static_cast<int>(255 * light * (0.4 + 0.8 * value_noise(12, u, v)));
+            int b = static_cast<int>(255 * light * (0.4 + 0.8 * value_noise(13, u, v)));
+
+            for (const Circle& circle : circles) {
+                double dx = x - circle.cx, dy = y - circle.cy;
+                if (dx * dx + dy * dy < circle.radius * circle.radius) {
+                    double shade = 0.75 + 0.25 * (dy / circle.radius);
+                    r = static_cast<int>(circle.r * shade);
+                    g = static_cast<int>(circle.g * shade);
+                    b = static_cast<int>(circle.b * shade);
+                }
+            }
+
+            int grain = random.next_int(-3, 3);
+            image.pixels[y * width + x] = make_rgb(r + grain, g + random.next_int(-3, 3), b + grain);
+        }
+    }
+    return image;
+}
+
+struct Field {
+    std::string key;
+    std::string json;
+};
+
+static Field field(const char* key, const std::string& value) {
+    std::string json = "\"";
+    for (char c : value) {
+        if (c == '"' || c == '\\') json += '\\';
+        json += c;
+    }
+    return { key, json + "\"" };
+}
+
+static Field field(const char* key, const char* value) { return field(key, std::string(value)); }
+
+template<std::unsigned_integral T>
+static Field field(const char* key, T value) { return { key, std::to_string(value) }; }
+
+static Field field(const char* key, bool value) { return { key, value ? "true" : "false" }; }
+
+static std::string format_double(double value);
+
+static Field field(const char* key, double value) { return { key, format_double(value) }; }
+
+static std::string format_double(double value) {
+    char buffer[64];
+    std::snprintf(buffer, sizeof(buffer), "%.6g", value);
+    return buffer;
+}
+
+struct Result {
+    std::string name;
+    std::vector<Field> fields;
+    size_t pixelCount;
+    double medianMs, minMs, maxMs;
+    std::vector<Field> stats;
+};
+
+class Benchmark {
+public:
+    Benchmark(size_t iterations, std::string filter) : iterations(iterations), filter(std::move(filter)) {}
+
+    bool enabled(const std::string& name) const {
+        return filter.empty() || name.find(filter) != std::string::npos;
+    }
+
+    // Times `body` once per iteration; `setup` and `teardown` run around it but outside the timer.
+    // The returned result stays valid until the next measurement and is null when the case is filtered out.
+    Result* measure(const std::string& name, std::vector<Field> fields, size_t pixelCount,
+        const std::function<void()>& setup, const std::function<void()>& body, const std::function<void()>& teardown = [] {}) {
+        if (!enabled(name)) return nullptr;
+
+        std::vector<double> times;
+        for (size_t i = 0; i < iterations; i++) {
+            setup();
+            auto start = Clock::now();
+            body();
+            auto end = Clock::now();
+            teardown();
+            times.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+        }
+
+        std::sort(times.begin(), times.end());
+        Result result{ name, std::move(fields), pixelCount, times[times.size() / 2], times.front(), times.back(), {} };
+        report(result);
+        results.push_back(std::move(result));
+        return &results.back();
+    }
+
+    void write_json(std::ostream& out, const std::vector<Field>& config) const {
+        out << "{\n  \"config\": {";
+        for (size_t i = 0; i < config.size(); i++) {
+            out << (i ? ", " : "") << '"' << config[i].key << "\": " << config[i].json;
+        }
+        out << "},\n  \"results\": [\n";
+        for (size_t i = 0; i < results.size(); i++) {
+            const Result& result = results[i];
+            out << "    {\"name\": \"" << result.name << '"';
+            for (const Field& f : result.fields) {
+                out << ", \"" << f.key << "\": " << f.json;
+            }
+            if (!result.stats.empty()) {
+                out << ", \"stats\": {";
+                for (size_t j = 0; j < result.stats.size(); j++) {
+                    out << (j ? ", " : "") << '"' << result.stats[j].key << "\": " << result.stats[j].json;
+                }
+                out << '}';
+            }
+            out << ", \"median_ms\": " << format_double(result.medianMs)
+                << ", \"min_ms\": " << format_double(result.minMs)
+                << ", \"max_ms\": " << format_double(result.maxMs);
+            if (result.pixelCount) {
+                out << ", \"pixels\": " << result.pixelCount
+                    << ", \"mpps\": " << format_double(result.pixelCount / 1e3 / result.medianMs);
+            }
+            out << '}' << (i + 1 < results.size() ? "," : "") << '\n';
+        }
+        out << "  ]\n}\n";
+    }
+
+private:
+    size_t iterations;
+    std::string filter;
+    std::vector<Result> results;
+
+    static void report(const Result& result) {
+        std::string line = result.name;
+        for (const Field& f : result.fields) {
+            line += ' ' + f.key + '=' + f.json;
+        }
+        std::fprintf(stderr, "%-72s %10.3f ms", line.c_str(), result.medianMs);
+        if (result.pixelCount) {
+            std::fprintf(stderr, " %9.2f MP/s", result.pixelCount / 1e3 / result.medianMs);
+        }
+        std::fprintf(stderr, "\n");
+    }
+};
+
+// Counters of the last iteration, present only when the library is built with COLORQUANTIZATION_STATS.
+static void attach_stats(Result* result, const SpaceShockColorExtractor& extractor) {
+    ExtractorStats stats;
+    if (result == nullptr || !extractor_stats(extractor, &stats)) return;
+
+    result->stats = {
+        field("absorb_calls", stats.absorbCalls),
+        field("absorb_cells_visited", stats.absorbCellsVisited),
+        field("absorb_cells_non_empty", stats.absorbCellsNonEmpty),
+        field("absorb_cells_changed", stats.absorbCellsChanged),
+        field("kernel_rebuilds", stats.kernelRebuilds),
+        field("map_inserts", stats.mapInserts),
+        field("map_erases", stats.mapErases),
+        field("select_iterations", stats.selectIterations),
+        field("reduce_iterations", stats.reduceIterations),
+        field("sort_ms", stats.sortNanoseconds / 1e6),
+        field("force_ms", stats.forceNanoseconds / 1e6),
+        field("select_ms", stats.selectNanoseconds / 1e6),
+        field("reduce_ms", stats.reduceNanoseconds / 1e6),
+        field("restore_ms", stats.restoreNanoseconds / 1e6),
+    };
+}
+
+static void attach_stats(Result* result, const PaletteStats& stats, bool available) {
+    if (result == nullptr || !available) return;
+
+    std::string histogram = "[";
+    for (size_t i = 0; i < std::size(stats.candidateHistogram); i++) {
+        histogram += (i ? ", " : "") + std::to_string(stats.candidateHistogram[i]);
+    }
+    result->stats = {
+        field("cache_hits", stats.cacheHits),
+        field("cache_misses", stats.cacheMisses),
+        field("candidates_examined", stats.candidatesExamined),
+        { "candidate_histogram", histogram + "]" },
+    };
+}
+
+static const color_t ForceColors[] = { 0x000000, 0xffffff, 0xff0000, 0x00ff00, 0x0000ff, 0xffff00, 0xff00ff, 0x00ffff };
+
+static size_t force_color_count(size_t tableLength) {
+    return std::min<size_t>(std::size(ForceColors), tableLength / 2);
+}
+
+static void run_extractor(Benchmark& benchmark, SpaceShockColorExtractor* extractor, const std::vector<Image>& images) {
+    SpaceShockColorExtractor* created = nullptr;
+    benchmark.measure("create", {}, 0, [] {}, [&] { created = create(); }, [&] { destroy(created); });
+
+    for (const Image& image : images) {
+        benchmark.measure("add_bitmap", { field("image", image.name) }, image.size(),
+            [&] { reset(extractor); },
+            [&] { add_bitmap(*extractor, image.pixels.data(), image.size()); });
+
+        benchmark.measure("reset", { field("image", image.name) }, 0,
+            [&] { reset(extractor); add_bitmap(*extractor, image.pixels.data(), image.size()); },
+            [&] { reset(extractor); });
+
+        benchmark.measure("remove_bitmap", { field("image", image.name) }, image.size(),
+            [&] { reset(extractor); add_bitmap(*extractor, image.pixels.data(), image.size()); },
+            [&] { remove_bitmap(*extractor, image.pixels.data(), image.size()); });
+
+        benchmark.measure("decay", { field("image", image.name), field("factor", 0.9) }, image.size(),
+            [&] { reset(extractor); add_bitmap(*extractor, image.pixels.data(), image.size()); },
+            [&] { decay(*extractor, 0.9); });
+
+        std::vector<uint8_t> histogram;
+        reset(extractor);
+        add_bitmap(*extractor, image.pixels.data(), image.size());
+        histogram.resize(get_histogram(*extractor, nullptr, 0));
+        std::vector<Field> histogramFields{ field("image", image.name), field("bytes", histogram.size()) };
+
+        benchmark.measure("get_histogram", histogramFields, image.size(), [] {},
+            [&] { get_histogram(*extractor, histogram.data(), histogram.size()); });
+
+        benchmark.measure("add_histogram_buffer", histogramFields, image.size(),
+            [&] { reset(extractor); },
+            [&] { add_histogram_buffer(*extractor, histogram.data(), histogram.size()); });
+
+        for (size_t tableLength = 2; tableLength <= 256; tableLength *= 2) {
+            for (bool force : { false, true }) {
+                std::vector<color_t> colorTable(tableLength);
+                size_t forceCount = force ? force_color_count(tableLength) : 0;
+                Result* result = benchmark.measure("get_color_table", { field("image", image.name), field("table", tableLength), field("force", forceCount) }, image.size(),
+                    [&] { reset(extractor); add_bitmap(*extractor, image.pixels.data(), image.size()); },
+                    [&] { get_color_table(*extractor, colorTable.data(), tableLength, ForceColors, forceCount); });
+                attach_stats(result, *extractor);
+            }
+        }
+    }
+}
+
+static void run_palette(Benchmark& benchmark, SpaceShockColorExtractor* extractor, const std::vector<Image>& images) {
+    for (const Image& image : images) {
+        std::vector<color_t> pixels(image.size());
+        std::vector<uint8_t> indexes(image.size());
+
+        for (size_t tableLength : { 4, 16, 64, 256 }) {
+            std::vector<color_t> colorTable(tableLength);
+            reset(extractor);
+            add_bitmap(*extractor, image.pixels.data(), image.size());
+            colorTable.resize(get_color_table(*extractor, colorTable.data(), tableLength, nullptr, 0));
+
+            for (bool optimize : { true, false }) {
+                std::vector<Field> fields{ field("image", image.name), field("table", tableLength), field("optimize", optimize) };
+                Palette* palette = nullptr;
+
+                benchmark.measure("palette_create", fields, 0, [] {},
+                    [&] { palette = palette_create(colorTable.data(), colorTable.size(), optimize); },
+                    [&] { palette_destroy(palette); });
+
+                PaletteStats paletteStats;
+                bool statsAvailable = false;
+                Result* result = benchmark.measure("palette_map_cold", fields, image.size(),
+                    [&] { palette = palette_create(colorTable.data(), colorTable.size(), optimize); },
+                    [&] { palette_map(*palette, image.pixels.data(), indexes.data(), image.size()); },
+                    [&] { statsAvailable = palette_stats(*palette, &paletteStats); palette_destroy(palette); });
+                attach_stats(result, paletteStats, statsAvailable);
+
+                palette = palette_create(colorTable.data(), colorTable.size(), optimize);
+                palette_map(*palette, image.pixels.data(), indexes.data(), image.size());
+
+                benchmark.measure("palette_map_warm", fields, image.size(), [] {},
+                    [&] { palette_map(*palette, image.pixels.data(), indexes.data(), image.size()); });
+
+                benchmark.measure("palette_map_rgb_warm", fields, image.size(), [] {},
+                    [&] { palette_map_rgb(*palette, image.pixels.data(), pixels.data(), nullptr, image.size()); });
+
+                benchmark.measure("palette_dither", fields, image.size(),
+                    [&] { std::copy(image.pixels.begin(), image.pixels.end(), pixels.begin()); },
+                    [&] { palette_dither(*palette, pixels.data(), indexes.data(), image.width, image.height); });
+
+                // Nudges the first entry back and forth, like a palette drifting between video frames.
+                uint8_t movedIndex = 0;
+                color_t movedColor = colorTable[0];
+                auto move_entry = [&] {
+                    movedColor ^= 0x010101;
+                    palette_update(*palette, &movedIndex, &movedColor, 1);
+                };
+
+                benchmark.measure("palette_update", fields, 0, [] {}, move_entry);
+
+                benchmark.measure("palette_map_after_update", fields, image.size(), move_entry,
+                    [&] { palette_map(*palette, image.pixels.data(), indexes.data(), image.size()); });
+
+                palette_destroy(palette);
+            }
+        }
+    }
+}
+
+// PSNR over all three channels of the image mapped to `colorTable`.
+static double palette_psnr(const std::vector<color_t>& colorTable, const Image& image, ColorMetric metric = MetricRgb) {
+    std::vector<uint8_t> indexes(image.size());
+    Palette* palette = palette_create_metric(colorTable.data(), colorTable.size(), true, metric);
+    QuantizationMetrics metrics;
+    palette_map_metrics(*palette, image.pixels.data(), indexes.data(), image.size(), &metrics);
+    palette_destroy(palette);
+
+    double mse = static_cast<double>(metrics.squaredError[0] + metrics.squaredError[1] + metrics.squaredError[2]) / (3.0 * metrics.pixelCount);
+    return mse > 0 ? 10 * std::log10(255.0 * 255.0 / mse) : 99.0;
+}
+
+static double palette_psnr(SpaceShockColorExtractor* extractor, const Image& image, size_t tableLength) {
+    std::vector<color_t> colorTable(tableLength);
+    colorTable.resize(get_color_table(*extractor, colorTable.data(), tableLength, nullptr, 0));
+    return palette_psnr(colorTable, image);
+}
+
+// Each metric end to end: the table extracted under it, its palette built and mapped cold, and the RGB PSNR
+// of the result, which the perceptual metrics trade for closer perceived colors.
+static void run_metrics(Benchmark& benchmark, SpaceShockColorExtractor* extractor, const std::vector<Image>& images) {
+    const std::pair<ColorMetric, const char*> metrics[] = { { MetricRgb, "rgb" }, { MetricLuma, "luma" }, { MetricOklab, "oklab" } };
+    if (!benchmark.enabled("get_color_table_metric") && !benchmark.enabled("palette_create_metric") && !benchmark.enabled("palette_map_cold_metric")) return;
+
+    for (const Image& image : images) {
+        std::vector<uint8_t> indexes(image.size());
+
+        for (size_t tableLength : { 16, 256 }) {
+            for (auto [metric, metricName] : metrics) {
+                extractor_set_metric(*extractor, metric);
+                std::vector<color_t> colorTable(tableLength);
+                reset(extractor);
+                add_bitmap(*extractor, image.pixels.data(), image.size());
+                colorTable.resize(get_color_table(*extractor, colorTable.data(), tableLength, nullptr, 0));
+                std::vector<Field> fields{ field("image", image.name), field("table", tableLength), field("metric", metricName), field("psnr", palette_psnr(colorTable, image, metric)) };
+
+                benchmark.measure("get_color_table_metric", fields, image.size(),
+                    [&] { reset(extractor); add_bitmap(*extractor, image.pixels.data(), image.size()); },
+                    [&] { get_color_table(*extractor, colorTable.data(), colorTable.size(), nullptr, 0); });
+
+                Palette* palette = nullptr;
+                benchmark.measure("palette_create_metric", fields, 0, [] {},
+                    [&] { palette = palette_create_metric(colorTable.data(), colorTable.size(), true, metric); },
+                    [&] { palette_destroy(palette); });
+
+                PaletteStats paletteStats;
+                bool statsAvailable = false;
+                Result* result = benchmark.measure("palette_map_cold_metric", fields, image.size(),
+                    [&] { palette = palette_create_metric(colorTable.data(), colorTable.size(), true, metric); },
+                    [&] { palette_map(*palette, image.pixels.data(), indexes.data(), image.size()); },
+                    [&] { statsAvailable = palette_stats(*palette, &paletteStats); palette_destroy(palette); });
+                attach_stats(result, paletteStats, statsAvailable);
+            }
+        }
+    }
+    extractor_set_metric(*extractor, MetricRgb);
+}
+
+static std::string shortcut_names(uint32_t shortcuts) {
+    const std::pair<uint32_t, const char*> names[] = {
+        { ShortcutSmallKernels, "small_kernels" },
+        { ShortcutSkipAbsorb, "skip_absorb" },
+        { ShortcutRaisedSkipMinCount, "raised_skip_min_count" },
+        { ShortcutReduceStopped, "reduce_stopped" },
+        { ShortcutDeadline, "deadline" },
+    };
+    std::string result;
+    for (auto [flag, name] : names) {
+        if ((shortcuts & flag) == 0) continue;
+        if (!result.empty()) result += '|';
+        result += name;
+    }
+    return result.empty() ? "none" : result;
+}
+
+// get_color_table under a deadline: the time actually taken, the shortcuts of the last run, and psnr_loss
+// against the unlimited table.
+static void run_budget(Benchmark& benchmark, SpaceShockColorExtractor* extractor, const std::vector<Image>& images) {
+    constexpr size_t TableLength = 256;
+
+    for (const Image& image : images) {
+        if (!benchmark.enabled("get_color_table_budget")) return;
+
+        std::vector<color_t> colorTable(TableLength);
+        reset(extractor);
+        add_bitmap(*extractor, image.pixels.data(), image.size());
+        colorTable.resize(get_color_table(*extractor, colorTable.data(), TableLength, nullptr, 0));
+        double fullPsnr = palette_psnr(colorTable, image);
+
+        for (uint64_t deadlineMs : { 2, 10, 50 }) {
+            ColorTableBudget budget{ deadlineMs * 1000000, 0 };
+            uint32_t shortcuts = 0;
+            colorTable.resize(TableLength);
+            colorTable.resize(get_color_table_budget(*extractor, colorTable.data(), TableLength, nullptr, 0, &budget, &shortcuts));
+            double psnr = palette_psnr(colorTable, image);
+
+            benchmark.measure("get_color_table_budget", { field("image", image.name), field("table", TableLength), field("deadline_ms", deadlineMs),
+                field("shortcuts", shortcut_names(shortcuts)), field("psnr", psnr), field("psnr_loss", fullPsnr - psnr) }, image.size(), [] {},
+                [&] { get_color_table_budget(*extractor, colorTable.data(), TableLength, nullptr, 0, &budget, &shortcuts); });
+        }
+    }
+}
+
+// Coarse-to-fine extraction by grid precision, with psnr_loss and time against the full-resolution table.
+static void run_coarse(Benchmark& benchmark, SpaceShockColorExtractor* extractor, const std::vector<Image>& images) {
+    if (!benchmark.enabled("get_color_table_coarse")) return;
+
+    for (const Image& image : images) {
+        reset(extractor);
+        add_bitmap(*extractor, image.pixels.data(), image.size());
+
+        for (size_t tableLength : { 16, 256 }) {
+            std::vector<color_t> colorTable(tableLength);
+            colorTable.resize(get_color_table(*extractor, colorTable.data(), tableLength, nullptr, 0));
+            double fullPsnr = palette_psnr(colorTable, image);
+            // bits=8 is get_color_table itself, the time the coarse rows have to beat
+            benchmark.measure("get_color_table_coarse", { field("image", image.name), field("table", tableLength), field("bits", size_t{ 8 }),
+                field("psnr", fullPsnr), field("psnr_loss", 0.0) }, image.size(), [] {},
+                [&] { get_color_table(*extractor, colorTable.data(), tableLength, nullptr, 0); });
+
+            // every depth get_color_table_coarse accepts, from the lowest
+            for (size_t channelBits : { 5, 6 }) {
+                colorTable.resize(tableLength);
+                colorTable.resize(get_color_table_coarse(*extractor, colorTable.data(), tableLength, nullptr, 0, channelBits));
+                double psnr = palette_psnr(colorTable, image);
+
+                benchmark.measure("get_color_table_coarse", { field("image", image.name), field("table", tableLength), field("bits", channelBits),
+                    field("psnr", psnr), field("psnr_loss", fullPsnr - psnr) }, image.size(), [] {},
+                    [&] { get_color_table_coarse(*extractor, colorTable.data(), tableLength, nullptr, 0, channelBits); });
+            }
+        }
+    }
+}
+
+// Sampled ingest speed next to the quality it costs: psnr_loss is how much worse the image maps to the
+// sampled palette than to the palette of a full add_bitmap.
+static void run_sampling(Benchmark& benchmark, SpaceShockColorExtractor* extractor, const std::vector<Image>& images) {
+    constexpr size_t TableLength = 256;
+    const std::pair<SampleMode, const char*> modes[] = { { SampleStride, "stride" }, { SampleStratified, "stratified" }, { SampleLowDiscrepancy, "low_discrepancy" } };
+
+    for (const Image& image : images) {
+        if (!benchmark.enabled("add_bitmap_sampled")) return;
+
+        reset(extractor);
+        add_bitmap(*extractor, image.pixels.data(), image.size());
+        double fullPsnr = palette_psnr(extractor, image, TableLength);
+
+        for (auto [mode, modeName] : modes) {
+            for (size_t ratio : { 4, 16, 64 }) {
+                reset(extractor);
+                size_t sampleCount = add_bitmap_sampled(*extractor, image.pixels.data(), image.width, image.height, mode, ratio);
+                double psnr = palette_psnr(extractor, image, TableLength);
+
+                benchmark.measure("add_bitmap_sampled", { field("image", image.name), field("mode", modeName), field("ratio", ratio),
+                    field("samples", sampleCount), field("table", TableLength), field("psnr", psnr), field("psnr_loss", fullPsnr - psnr) }, image.size(),
+                    [&] { reset(extractor); },
+                    [&] { add_bitmap_sampled(*extractor, image.pixels.data(), image.width, image.height, mode, ratio); });
+            }
+        }
+    }
+}
+
+// Independent palettes per tile: tiles_quantize against what it replaces, one extractor and palette per tile
+// in turn. tile_pixels is the tile side; the serial loop copies each tile out, as the caller would have to.
+static void run_tiles(Benchmark& benchmark, SpaceShockColorExtractor* extractor, const std::vector<Image>& images) {
+    constexpr size_t TableLength = 16;
+
+    if (!benchmark.enabled("tiles_quantize") && !benchmark.enabled("tiles_serial")) return;
+
+    for (const Image& image : images) {
+        for (size_t tileSize : { 32, 64, 256 }) {
+            std::vector<TileRect> tiles(tiles_grid(image.width, image.height, tileSize, tileSize, nullptr, 0));
+            tiles_grid(image.width, image.height, tileSize, tileSize, tiles.data(), tiles.size());
+            std::vector<color_t> colorTables(tiles.size() * TableLength);
+            std::vector<size_t> tableLengths(tiles.size());
+            std::vector<uint8_t> indexes(image.size());
+            std::vector<Field> fields{ field("image", image.name), field("tile_pixels", tileSize), field("tiles", tiles.size()), field("table", TableLength) };
+
+            benchmark.measure("tiles_quantize", fields, image.size(), [] {}, [&] {
+                tiles_quantize(image.pixels.data(), image.width, image.height, tiles.data(), tiles.size(), TableLength, MetricRgb,
+                    colorTables.data(), tableLengths.data(), indexes.data());
+            });
+
+            benchmark.measure("tiles_serial", fields, image.size(), [] {}, [&] {
+                std::vector<color_t> tilePixels;
+                uint8_t* tileIndexes = indexes.data();
+                for (size_t i = 0; i < tiles.size(); i++) {
+                    const TileRect& tile = tiles[i];
+                    tilePixels.clear();
+                    for (size_t y = tile.y; y < tile.y + tile.height; y++) {
+                        const color_t* row = &image.pixels[y * image.width + tile.x];
+                        tilePixels.insert(tilePixels.end(), row, row + tile.width);
+                    }
+                    reset(extractor);
+                    add_bitmap(*extractor, tilePixels.data(), tilePixels.size());
+                    size_t colorCount = get_color_table(*extractor, &colorTables[i * TableLength], TableLength, nullptr, 0);
+                    Palette* palette = palette_create(&colorTables[i * TableLength], colorCount, false);
+                    palette_map(*palette, tilePixels.data(), tileIndexes, tilePixels.size());
+                    palette_destroy(palette);
+                    tileIndexes += tilePixels.size();
+                }
+            });
+        }
+    }
+}
+
+// A short clip: the photo scrolling down a few rows per frame, extracted and dithered to 256 colors.
+static void run_jobs(Benchmark& benchmark, const Image& image) {
+    constexpr size_t FrameCount = 8, TableLength = 256;
+    std::vector<std::vector<color_t>> frames(FrameCount);
+    std::vector<std::vector<uint8_t>> indexes(FrameCount, std::vector<uint8_t>(image.size()));
+    auto load_frames = [&] {
+        for (size_t f = 0; f < FrameCount; f++) {
+            size_t shift = f * 4 % image.height * image.width;
+            frames[f].assign(image.pixels.begin() + shift, image.pixels.end());
+            frames[f].insert(frames[f].end(), image.pixels.begin(), image.pixels.begin() + shift);
+        }
+    };
+
+    // the queue runs its jobs on the shared scheduler, so report what --workers (or the default) actually gave it
+    std::vector<Field> fields{ field("image", image.name), field("frames", FrameCount), field("table", TableLength), field("workers", scheduler_worker_count()) };
+
+    benchmark.measure("frames_blocking", fields, image.size() * FrameCount, load_frames, [&] {
+        for (size_t f = 0; f < FrameCount; f++) {
+            color_t colorTable[TableLength];
+            SpaceShockColorExtractor* extractor = create();
+            add_bitmap(*extractor, frames[f].data(), image.size());
+            size_t colorCount = get_color_table(*extractor, colorTable, TableLength, nullptr, 0);
+            destroy(extractor);
+            Palette* palette = palette_create(colorTable, colorCount, true);
+            palette_dither(*palette, frames[f].data(), indexes[f].data(), image.width, image.height);
+            palette_destroy(palette);
+        }
+    });
+
+    QuantizationQueue* queue = job_queue_create(0, 0);
+    benchmark.measure("job_queue", fields, image.size() * FrameCount, load_frames, [&] {
+        std::vector<QuantizationJob*> jobs;
+        for (size_t f = 0; f < FrameCount; f++) {
+            QuantizationJobDesc desc{};
+            desc.pixels = frames[f].data();
+            desc.width = image.width;
+            desc.height = image.height;
+            desc.indexes = indexes[f].data();
+            desc.tableLength = TableLength;
+            desc.optimize = true;
+            desc.dither = true;
+            jobs.push_back(job_submit(*queue, desc));
+        }
+        for (QuantizationJob* job : jobs) {
+            job_wait(*job);
+            job_release(job);
+        }
+    });
+    job_queue_destroy(queue);
+}
+
+static void usage() {
+    std::fprintf(stderr,
+        "usage: ColorQuantizationBenchmark [options]\n"
+        "  --width N         image width (default 1024)\n"
+        "  --height N        image height (default 1024)\n"
+        "  --iterations N    timed runs per case, the median is reported (default 5)\n"
+        "  --filter TEXT     only run cases whose name contains TEXT\n"
+        "  --workers N       scheduler worker threads, 0 runs serially (default: one per CPU but the caller's)\n"
+        "  --json FILE       write results as JSON to FILE instead of stdout\n");
+}
+
+int main(int argc, char** argv) {
+    size_t width = 1024, height = 1024, iterations = 5;
+    std::string filter, jsonPath;
+    bool configureWorkers = false;
+    size_t workers = 0;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--width" && hasValue) width = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--height" && hasValue) height = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--iterations" && hasValue) iterations = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--filter" && hasValue) filter = argv[++i];
+        else if (arg == "--json" && hasValue) jsonPath = argv[++i];
+        else if (arg == "--workers" && hasValue) {
+            configureWorkers = true;
+            workers = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else {
+            usage();
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+
+    if (width == 0 || height == 0 || iterations == 0) {
+        usage();
+        return 1;
+    }
+
+    if (configureWorkers) scheduler_configure(workers, nullptr, 0);
+
+    std::vector<Image> images{ gradient_image(width, height), photo_image(width, height), noise_image(width, height) };
+    Benchmark benchmark(iterations, filter);
+    SpaceShockColorExtractor* extractor = create();
+
+    run_extractor(benchmark, extractor, images);
+    run_palette(benchmark, extractor, images);
+    run_metrics(benchmark, extractor, images);
+    run_sampling(benchmark, extractor, images);
+    run_budget(benchmark, extractor, images);
+    run_coarse(benchmark, extractor, images);
+    run_tiles(benchmark, extractor, images);
+    run_jobs(benchmark, images[1]);
+
+    destroy(extractor);
+
+    std::vector<Field> config{ field("width", width), field("height", height), field("iterations", iterations), field("workers", scheduler_worker_count()) };
+    if (jsonPath.empty()) {
+        benchmark.write_json(std::cout, config);
+    } else {
+        std::ofstream out(jsonPath);
+        benchmark.write_json(out, config);
+        if (!out) {
+            std::fprintf(stderr, "cannot write %s\n", jsonPath.c_str());
+            return 1;
+        }
+    }
+    return 0;
+}
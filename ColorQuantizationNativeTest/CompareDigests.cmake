@@ -0,0 +1,17 @@
+# Runs the scalar and the AVX2 test executables with --digest and fails unless every digest matches.
+# Usage: cmake -DSCALAR=<executable> -DVECTOR=<executable> -P CompareDigests.cmake
+
+execute_process(COMMAND ${VECTOR} --digest OUTPUT_VARIABLE vectorDigests RESULT_VARIABLE vectorResult)
+if(vectorResult EQUAL 77)
+    message("skipped: this CPU does not support AVX2")
+    return()
+endif()
+execute_process(COMMAND ${SCALAR} --digest OUTPUT_VARIABLE scalarDigests RESULT_VARIABLE scalarResult)
+
+if(NOT scalarResult EQUAL 0 OR NOT vectorResult EQUAL 0)
+    message(FATAL_ERROR "--digest failed: scalar ${scalarResult}, AVX2 ${vectorResult}")
+endif()
+if(NOT scalarDigests STREQUAL vectorDigests)
+    message(FATAL_ERROR "AVX2 results differ from scalar results\nscalar:\n${scalarDigests}\nAVX2:\n${vectorDigests}")
+endif()
+message("AVX2 results match scalar results")
@@ -0,0 +1,1100 @@
+#include <cinttypes>
+#include <cstdlib>
+#include <cstddef>
+#include <cstdio>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include "ColorQuantization.h"
+
+// Equivalence checks of the native library: each test runs a fast, incremental or parallel path next to the plain
+// one it has to reproduce. Pass a name to run only the tests containing it, or --digest to print hashes of results
+// for comparing two builds.
+
+struct TestCase {
+    const char* name;
+    void (*run)();
+};
+
+static std::vector<TestCase>& registry() {
+    static std::vector<TestCase> tests;
+    return tests;
+}
+
+#define TEST(name) \
+    static void name(); \
+    static const bool name##Registered = (registry().push_back({ #name, name }), true); \
+    static void name()
+
+static size_t failureCount = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            failureCount++; \
+        } \
+    } while (0)
+
+// SplitMix64, so generated images are identical on every platform and run.
+struct Random {
+    uint64_t state;
+
+    explicit Random(uint64_t seed) : state(seed) {}
+
+    uint64_t next() {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+};
+
+struct Image {
+    size_t width, height;
+    std::vector<color_t> pixels;
+
+    size_t size() const { return pixels.size(); }
+};
+
+// Smooth color fields with per-pixel grain: many distinct colors, yet enough structure for a meaningful palette.
+static Image test_image(size_t width, size_t height, uint64_t seed) {
+    Image image{ width, height, std::vector<color_t>(width * height) };
+    Random random(seed);
+    for (size_t y = 0; y < height; y++) {
+        for (size_t x = 0; x < width; x++) {
+            int grain = static_cast<int>(random.next() % 9) - 4;
+            int r = static_cast<int>(127 + 120 * std::sin(x * 0.031 + y * 0.017)) + grain;
+            int g = static_cast<int>(127 + 120 * std::sin(x * 0.013 - y * 0.029 + 1)) - grain;
+            int b = static_cast<int>((x * 3 + y * 5) & 0xff);
+            r = std::clamp(r, 0, 255);
+            g = std::clamp(g, 0, 255);
+            image.pixels[y * width + x] = 0xff000000u | static_cast<color_t>(r << 16 | g << 8 | b);
+        }
+    }
+    return image;
+}
+
+static std::vector<color_t> extract(const Image& image, size_t tableLength) {
+    SpaceShockColorExtractor* extractor = create();
+    add_bitmap(*extractor, image.pixels.data(), image.size());
+    std::vector<color_t> colorTable(tableLength);
+    colorTable.resize(get_color_table(*extractor, colorTable.data(), tableLength, nullptr, 0));
+    destroy(extractor);
+    return colorTable;
+}
+
+static std::vector<uint8_t> map_with(Palette& palette, const Image& image) {
+    std::vector<uint8_t> indexes(image.size());
+    palette_map(palette, image.pixels.data(), indexes.data(), image.size());
+    return indexes;
+}
+
+static std::vector<uint8_t> map_pixels(const std::vector<color_t>& colorTable, const Image& image, bool optimize) {
+    Palette* palette = palette_create(colorTable.data(), colorTable.size(), optimize);
+    std::vector<uint8_t> indexes(image.size());
+    palette_map(*palette, image.pixels.data(), indexes.data(), image.size());
+    palette_destroy(palette);
+    return indexes;
+}
+
+static std::vector<uint8_t> dither_pixels(const std::vector<color_t>& colorTable, const Image& image, std::vector<color_t>* dithered = nullptr) {
+    Palette* palette = palette_create(colorTable.data(), colorTable.size(), true);
+    std::vector<color_t> pixels = image.pixels;
+    std::vector<uint8_t> indexes(image.size());
+    palette_dither(*palette, pixels.data(), indexes.data(), image.width, image.height);
+    palette_destroy(palette);
+    if (dithered) *dithered = std::move(pixels);
+    return indexes;
+}
+
+static int squared_distance(color_t a, color_t b) {
+    int dr = static_cast<int>(a >> 16 & 0xff) - static_cast<int>(b >> 16 & 0xff);
+    int dg = static_cast<int>(a >> 8 & 0xff) - static_cast<int>(b >> 8 & 0xff);
+    int db = static_cast<int>(a & 0xff) - static_cast<int>(b & 0xff);
+    return dr * dr + dg * dg + db * db;
+}
+
+// ========== extraction and mapping ==========
+
+TEST(color_table_is_repeatable) {
+    Image image = test_image(97, 61, 1);
+    SpaceShockColorExtractor* extractor = create();
+    add_bitmap(*extractor, image.pixels.data(), image.size());
+
+    for (size_t tableLength : { 2, 16, 256 }) {
+        std::vector<color_t> first(tableLength), second(tableLength);
+        size_t firstLength = get_color_table(*extractor, first.data(), tableLength, nullptr, 0);
+        size_t secondLength = get_color_table(*extractor, second.data(), tableLength, nullptr, 0);
+        CHECK(firstLength == tableLength);
+        CHECK(firstLength == secondLength && first == second);
+    }
+    destroy(extractor);
+}
+
+TEST(palette_map_finds_nearest_color) {
+    Image image = test_image(97, 61, 2);
+    for (size_t tableLength : { 2, 16, 256 }) {
+        std::vector<color_t> colorTable = extract(image, tableLength);
+        std::vector<uint8_t> optimized = map_pixels(colorTable, image, true);
+        std::vector<uint8_t> plain = map_pixels(colorTable, image, false);
+
+        for (size_t i = 0; i < image.size(); i++) {
+            int best = std::numeric_limits<int>::max();
+            for (color_t color : colorTable) best = std::min(best, squared_distance(image.pixels[i], color));
+            CHECK(optimized[i] < colorTable.size() && squared_distance(image.pixels[i], colorTable[optimized[i]]) == best);
+            CHECK(plain[i] < colorTable.size() && squared_distance(image.pixels[i], colorTable[plain[i]]) == best);
+        }
+    }
+}
+
+TEST(color_table_budget_is_repeatable) {
+    Image image = test_image(256, 256, 12);
+    SpaceShockColorExtractor* extractor = create();
+    add_bitmap(*extractor, image.pixels.data(), image.size());
+    std::vector<color_t> expected(256);
+    expected.resize(get_color_table(*extractor, expected.data(), expected.size(), nullptr, 0));
+
+    ColorTableBudget unlimited{};
+    uint32_t shortcuts = 0;
+    std::vector<color_t> colorTable(256);
+    colorTable.resize(get_color_table_budget(*extractor, colorTable.data(), colorTable.size(), nullptr, 0, &unlimited, &shortcuts));
+    CHECK(colorTable == expected && shortcuts == 0);
+
+    // work limits tight enough that later picks skip absorbing, and so skip rebuilding the kernel
+    uint32_t seenShortcuts = 0;
+    for (uint64_t maxWork : { 0x100000, 0x10000 }) {
+        ColorTableBudget budget{ 0, maxWork };
+        std::vector<color_t> first(256), second(256);
+        uint32_t firstShortcuts = 0, secondShortcuts = 0;
+        first.resize(get_color_table_budget(*extractor, first.data(), first.size(), nullptr, 0, &budget, &firstShortcuts));
+        second.resize(get_color_table_budget(*extractor, second.data(), second.size(), nullptr, 0, &budget, &secondShortcuts));
+        CHECK(first.size() == 256);
+        CHECK(first == second && firstShortcuts == secondShortcuts);
+        seenShortcuts |= firstShortcuts;
+    }
+    CHECK((seenShortcuts & ShortcutSkipAbsorb) != 0);
+    destroy(extractor);
+}
+
+TEST(expired_deadline_gives_full_table) {
+    Image image = test_image(256, 256, 13);
+    SpaceShockColorExtractor* extractor = create();
+    add_bitmap(*extractor, image.pixels.data(), image.size());
+    const color_t forceColors[2] = { 0x000000, 0xffffff };
+
+    // a deadline of 1 ns has passed before the first color is picked
+    ColorTableBudget expired{ 1, 0 };
+    for (size_t tableLength : { 16, 256 }) {
+        std::vector<color_t> colorTable(tableLength, 0xff000000);
+        uint32_t shortcuts = 0;
+        CHECK(get_color_table_budget(*extractor, colorTable.data(), tableLength, forceColors, 2, &expired, &shortcuts) == tableLength);
+        CHECK((shortcuts & ShortcutDeadline) != 0);
+        CHECK(colorTable[0] == forceColors[0] && colorTable[1] == forceColors[1]);
+        CHECK(std::all_of(colorTable.begin(), colorTable.end(), [](color_t color) { return color <= 0xffffff; }));
+    }
+
+    ColorTableBudget generous{ 60000000000ULL, 0 };
+    std::vector<color_t> colorTable(16);
+    uint32_t shortcuts = 0;
+    CHECK(get_color_table_budget(*extractor, colorTable.data(), colorTable.size(), nullptr, 0, &generous, &shortcuts) == 16);
+    CHECK(shortcuts == 0);
+    destroy(extractor);
+}
+
+static uint64_t squared_error(const std::vector<color_t>& colorTable, const Image& image) {
+    std::vector<uint8_t> indexes = map_pixels(colorTable, image, true);
+    uint64_t error = 0;
+    for (size_t i = 0; i < image.size(); i++) error += squared_distance(image.pixels[i], colorTable[indexes[i]]);
+    return error;
+}
+
+TEST(coarse_color_table_stays_close_to_full) {
+    Image image = test_image(256, 256, 14);
+    SpaceShockColorExtractor* extractor = create();
+    add_bitmap(*extractor, image.pixels.data(), image.size());
+    const color_t forceColors[2] = { 0x000000, 0xffffff };
+
+    std::vector<color_t> colorTable(16);
+    for (size_t channelBits : { 0, 4, 7, 8 }) {
+        CHECK(get_color_table_coarse(*extractor, colorTable.data(), colorTable.size(), nullptr, 0, channelBits) == static_cast<size_t>(-1));
+    }
+
+    for (size_t tableLength : { 16, 256 }) {
+        std::vector<color_t> full(tableLength);
+        full.resize(get_color_table(*extractor, full.data(), tableLength, nullptr, 0));
+        uint64_t fullError = squared_error(full, image);
+
+        for (size_t channelBits : { 5, 6 }) {
+            std::vector<color_t> first(tableLength), second(tableLength);
+            first.resize(get_color_table_coarse(*extractor, first.data(), tableLength, nullptr, 0, channelBits));
+            second.resize(get_color_table_coarse(*extractor, second.data(), tableLength, nullptr, 0, channelBits));
+            CHECK(first.size() == tableLength && first == second);
+            CHECK(squared_error(first, image) * 2 <= fullError * 3);
+
+            std::vector<color_t> forced(tableLength);
+            forced.resize(get_color_table_coarse(*extractor, forced.data(), tableLength, forceColors, 2, channelBits));
+            CHECK(forced.size() == tableLength && forced[0] == forceColors[0] && forced[1] == forceColors[1]);
+        }
+    }
+    destroy(extractor);
+}
+
+// ========== mapping outputs ==========
+
+// Index of pixel x of a packed row, the first pixel in the most significant bits of its byte.
+static uint8_t packed_index(const uint8_t* row, size_t x, size_t bitDepth) {
+    size_t pixelsPerByte = 8 / bitDepth;
+    size_t shift = (pixelsPerByte - 1 - x % pixelsPerByte) * bitDepth;
+    return static_cast<uint8_t>(row[x / pixelsPerByte] >> shift & ((1u << bitDepth) - 1));
+}
+
+// Checks each row of `packed` against the 8-bit indexes and that the padding after the row is zero.
+static bool unpacks_to(const std::vector<uint8_t>& packed, const std::vector<uint8_t>& indexes, size_t width, size_t height, size_t bitDepth, size_t stride) {
+    for (size_t y = 0; y < height; y++) {
+        const uint8_t* row = packed.data() + y * stride;
+        for (size_t x = 0; x < stride * 8 / bitDepth; x++) {
+            if (packed_index(row, x, bitDepth) != (x < width ? indexes[y * width + x] : 0)) return false;
+        }
+    }
+    return true;
+}
+
+TEST(packed_output_unpacks_to_indexes) {
+    for (size_t width : { 1, 7, 13, 64, 99 }) {
+        Image image = test_image(width, 9, 24 + width);
+        for (size_t bitDepth : { 1, 2, 4, 8 }) {
+            std::vector<color_t> colorTable = extract(image, size_t{ 1 } << bitDepth);
+            Palette* palette = palette_create(colorTable.data(), colorTable.size(), true);
+            std::vector<uint8_t> mapped = map_with(*palette, image);
+            std::vector<color_t> dithered = image.pixels;
+            std::vector<uint8_t> ditherIndexes(image.size());
+            palette_dither(*palette, dithered.data(), ditherIndexes.data(), image.width, image.height);
+
+            for (size_t rowAlignment : { 1, 4 }) {
+                size_t rowBytes = (width * bitDepth + 7) / 8;
+                size_t stride = palette_packed_stride(width, bitDepth, rowAlignment);
+                CHECK(stride % rowAlignment == 0 && stride >= rowBytes && stride < rowBytes + rowAlignment);
+
+                std::vector<uint8_t> packed(stride * image.height, 0xa5);
+                CHECK(palette_map_packed(*palette, image.pixels.data(), packed.data(), image.width, image.height, bitDepth, rowAlignment) == stride);
+                CHECK(unpacks_to(packed, mapped, image.width, image.height, bitDepth, stride));
+
+                std::vector<color_t> pixels = image.pixels;
+                std::fill(packed.begin(), packed.end(), 0xa5);
+                CHECK(palette_dither_packed(*palette, pixels.data(), packed.data(), image.width, image.height, bitDepth, rowAlignment) == stride);
+                CHECK(unpacks_to(packed, ditherIndexes, image.width, image.height, bitDepth, stride));
+                CHECK(pixels == dithered);
+            }
+
+            // a depth too small for the table, and layouts that are not supported at all
+            std::vector<uint8_t> packed(image.size());
+            if (colorTable.size() > 2) CHECK(palette_map_packed(*palette, image.pixels.data(), packed.data(), image.width, image.height, 1, 1) == static_cast<size_t>(-1));
+            CHECK(palette_packed_stride(width, 3, 1) == static_cast<size_t>(-1) && palette_packed_stride(width, bitDepth, 0) == static_cast<size_t>(-1));
+            palette_destroy(palette);
+        }
+    }
+}
+
+TEST(palette_map_rgb_expands_indexes) {
+    // a length that is neither a multiple of the vector width nor of the block size
+    Image image = test_image(301, 7, 25);
+    for (size_t tableLength : { 2, 16, 256 }) {
+        std::vector<color_t> colorTable = extract(image, tableLength);
+        Palette* palette = palette_create(colorTable.data(), colorTable.size(), true);
+        std::vector<uint8_t> expected = map_with(*palette, image);
+        std::vector<color_t> expanded(image.size());
+        for (size_t i = 0; i < image.size(); i++) expanded[i] = colorTable[expected[i]];
+
+        std::vector<color_t> outPixels(image.size());
+        std::vector<uint8_t> indexes(image.size());
+        palette_map_rgb(*palette, image.pixels.data(), outPixels.data(), indexes.data(), image.size());
+        CHECK(outPixels == expanded && indexes == expected);
+
+        std::vector<color_t> pixels = image.pixels;
+        palette_map_rgb(*palette, pixels.data(), pixels.data(), nullptr, pixels.size());
+        CHECK(pixels == expanded);
+        palette_destroy(palette);
+    }
+}
+
+// Recomputes the metrics of a result from its source pixels and indexes.
+static QuantizationMetrics metrics_of(const std::vector<color_t>& colorTable, const Image& image, const std::vector<uint8_t>& indexes) {
+    QuantizationMetrics metrics{};
+    for (size_t i = 0; i < image.size(); i++) {
+        color_t quantized = colorTable[indexes[i]];
+        for (int c = 0; c < 3; c++) {
+            int shift = 16 - 8 * c;
+            uint32_t error = static_cast<uint32_t>(std::abs(static_cast<int>(image.pixels[i] >> shift & 0xff) - static_cast<int>(quantized >> shift & 0xff)));
+            metrics.squaredError[c] += error * error;
+            metrics.maxError[c] = std::max(metrics.maxError[c], error);
+        }
+        metrics.usage[indexes[i]]++;
+        metrics.pixelCount++;
+    }
+    return metrics;
+}
+
+static bool operator==(const QuantizationMetrics& a, const QuantizationMetrics& b) {
+    return a.pixelCount == b.pixelCount && std::equal(std::begin(a.squaredError), std::end(a.squaredError), b.squaredError)
+        && std::equal(std::begin(a.maxError), std::end(a.maxError), b.maxError) && std::equal(std::begin(a.usage), std::end(a.usage), b.usage);
+}
+
+TEST(metrics_match_output_indexes) {
+    // the narrow image takes the dither path for images smaller than the kernel
+    for (Image image : { test_image(97, 61, 26), test_image(3, 40, 27) }) {
+        for (size_t tableLength : { 2, 16, 256 }) {
+            std::vector<color_t> colorTable = extract(image, tableLength);
+            Palette* palette = palette_create(colorTable.data(), colorTable.size(), true);
+
+            std::vector<uint8_t> indexes(image.size());
+            QuantizationMetrics metrics;
+            std::memset(&metrics, 0xff, sizeof(metrics));
+            palette_map_metrics(*palette, image.pixels.data(), indexes.data(), image.size(), &metrics);
+            CHECK(indexes == map_with(*palette, image));
+            CHECK(metrics == metrics_of(colorTable, image, indexes));
+
+            std::vector<color_t> pixels = image.pixels;
+            std::memset(&metrics, 0xff, sizeof(metrics));
+            palette_dither_metrics(*palette, pixels.data(), indexes.data(), image.width, image.height, &metrics);
+            CHECK(indexes == dither_pixels(colorTable, image));
+            CHECK(metrics == metrics_of(colorTable, image, indexes));
+            palette_destroy(palette);
+        }
+    }
+}
+
+// ========== counters ==========
+
+#if defined(COLORQUANTIZATION_STATS)
+constexpr bool StatsEnabled = true;
+#else
+constexpr bool StatsEnabled = false;
+#endif
+
+TEST(stats_follow_build_option) {
+    constexpr size_t TableLength = 16;
+    Image image = test_image(97, 61, 23);
+    SpaceShockColorExtractor* extractor = create();
+    add_bitmap(*extractor, image.pixels.data(), image.size());
+    std::vector<color_t> colorTable(TableLength);
+    colorTable.resize(get_color_table(*extractor, colorTable.data(), TableLength, nullptr, 0));
+
+    ExtractorStats extractorStats{};
+    CHECK(extractor_stats(*extractor, &extractorStats) == StatsEnabled);
+    destroy(extractor);
+
+    Palette* palette = palette_create(colorTable.data(), colorTable.size(), true);
+    std::vector<uint8_t> indexes = map_with(*palette, image);
+    PaletteStats paletteStats{};
+    CHECK(palette_stats(*palette, &paletteStats) == StatsEnabled);
+    palette_destroy(palette);
+
+    if constexpr (StatsEnabled) {
+        CHECK(extractorStats.colorTableCalls == 1);
+        CHECK(extractorStats.selectIterations == TableLength && extractorStats.absorbCalls == TableLength);
+        CHECK(extractorStats.absorbCellsChanged != 0);
+        CHECK(extractorStats.absorbCellsChanged <= extractorStats.absorbCellsNonEmpty);
+        CHECK(extractorStats.absorbCellsNonEmpty <= extractorStats.absorbCellsVisited);
+        CHECK(extractorStats.kernelRebuilds != 0 && extractorStats.kernelRebuilds <= TableLength);
+
+        // every pixel is looked up once, and the first lookup of each color misses
+        std::vector<color_t> colors = image.pixels;
+        std::sort(colors.begin(), colors.end());
+        size_t colorCount = std::unique(colors.begin(), colors.end()) - colors.begin();
+        uint64_t histogramCount = 0;
+        for (uint64_t count : paletteStats.candidateHistogram) histogramCount += count;
+        CHECK(paletteStats.cacheHits + paletteStats.cacheMisses == image.size());
+        CHECK(paletteStats.cacheMisses == colorCount && histogramCount == colorCount);
+        CHECK(paletteStats.candidatesExamined >= paletteStats.cacheMisses);
+    } else {
+        CHECK(extractorStats.colorTableCalls == 0 && extractorStats.absorbCalls == 0 && extractorStats.selectIterations == 0);
+        CHECK(paletteStats.cacheHits == 0 && paletteStats.cacheMisses == 0 && paletteStats.candidatesExamined == 0);
+    }
+}
+
+// ========== streaming ==========
+
+struct PixelReader {
+    const Image* image;
+    size_t offset;
+    size_t chunk;
+};
+
+static size_t read_pixels(void* userData, color_t* buffer, size_t bufferLength) {
+    PixelReader& reader = *static_cast<PixelReader*>(userData);
+    size_t count = std::min({ bufferLength, reader.chunk, reader.image->size() - reader.offset });
+    std::copy_n(reader.image->pixels.data() + reader.offset, count, buffer);
+    reader.offset += count;
+    return count;
+}
+
+TEST(add_bitmap_stream_equals_add_bitmap) {
+    Image image = test_image(97, 61, 3);
+    std::vector<color_t> expected = extract(image, 16);
+
+    for (size_t chunk : { 1, 13, 4096 }) {
+        SpaceShockColorExtractor* extractor = create();
+        PixelReader reader{ &image, 0, chunk };
+        CHECK(add_bitmap_stream(*extractor, read_pixels, &reader, 1000) == image.size());
+        std::vector<color_t> colorTable(16);
+        colorTable.resize(get_color_table(*extractor, colorTable.data(), colorTable.size(), nullptr, 0));
+        CHECK(colorTable == expected);
+        destroy(extractor);
+    }
+}
+
+TEST(dither_stream_equals_palette_dither) {
+    Image image = test_image(97, 61, 4);
+    std::vector<color_t> colorTable = extract(image, 16);
+    std::vector<color_t> expectedPixels;
+    std::vector<uint8_t> expected = dither_pixels(colorTable, image, &expectedPixels);
+
+    for (size_t strip : { 1, 5, 64 }) {
+        Palette* palette = palette_create(colorTable.data(), colorTable.size(), true);
+        DitherStream* stream = palette_dither_stream_create(*palette, image.width, image.height);
+        std::vector<color_t> pixels = image.pixels;
+        std::vector<uint8_t> indexes(image.size());
+
+        size_t row = 0;
+        while (row < image.height) {
+            size_t pushed = palette_dither_stream_push(*stream, pixels.data() + row * image.width, indexes.data() + row * image.width, strip);
+            CHECK(pushed == std::min(strip, image.height - row));
+            if (pushed == 0) break;
+            row += pushed;
+        }
+        CHECK(palette_dither_stream_push(*stream, pixels.data(), indexes.data(), 1) == 0);
+        CHECK(indexes == expected);
+        CHECK(pixels == expectedPixels);
+
+        palette_dither_stream_destroy(stream);
+        palette_destroy(palette);
+    }
+}
+
+// ========== palette files ==========
+
+TEST(palette_load_round_trips) {
+    Image image = test_image(97, 61, 5);
+    std::vector<color_t> colorTable = extract(image, 16);
+    std::string path = (std::filesystem::temp_directory_path() / "ColorQuantizationNativeTest.palette").string();
+    Palette* palette = palette_create_metric(colorTable.data(), colorTable.size(), true, MetricOklab);
+    std::vector<uint8_t> expected = map_with(*palette, image);
+
+    for (bool includeIndexMap : { false, true }) {
+        CHECK(palette_save(*palette, path.c_str(), includeIndexMap));
+        Palette* loaded = palette_load(path.c_str());
+        CHECK(loaded != nullptr);
+        if (!loaded) continue;
+        CHECK(palette_metric(*loaded) == MetricOklab);
+        CHECK(map_with(*loaded, image) == expected);
+        palette_destroy(loaded);
+    }
+    palette_destroy(palette);
+    std::filesystem::remove(path);
+}
+
+// Overwrites `length` bytes of a file at `offset`, from the end when `offset` is negative.
+static bool patch_file(const std::string& path, std::streamoff offset, const void* data, size_t length) {
+    std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+    file.seekp(offset, offset < 0 ? std::ios::end : std::ios::beg);
+    file.write(static_cast<const char*>(data), static_cast<std::streamsize>(length));
+    return static_cast<bool>(file.flush());
+}
+
+TEST(palette_load_clamps_corrupt_index_map) {
+    Image image = test_image(97, 61, 6);
+    std::vector<color_t> colorTable = extract(image, 16);
+    std::string path = (std::filesystem::temp_directory_path() / "ColorQuantizationNativeTest.palette").string();
+    Palette* palette = palette_create(colorTable.data(), colorTable.size(), true);
+    CHECK(palette_save(*palette, path.c_str(), true));
+    palette_destroy(palette);
+
+    // the index map fills the last 16 MB of the file; point every color of the image past the end of the table
+    std::vector<uint8_t> pastTable(0x1000000, 0xff);
+    CHECK(patch_file(path, -0x1000000, pastTable.data(), pastTable.size()));
+    Palette* loaded = palette_load(path.c_str());
+    CHECK(loaded != nullptr);
+    if (!loaded) return;
+
+    std::vector<uint8_t> indexes = map_with(*loaded, image);
+    CHECK(std::all_of(indexes.begin(), indexes.end(), [&](uint8_t index) { return index < colorTable.size(); }));
+    std::vector<color_t> pixels = image.pixels;
+    palette_dither(*loaded, pixels.data(), indexes.data(), image.width, image.height);
+    CHECK(std::all_of(indexes.begin(), indexes.end(), [&](uint8_t index) { return index < colorTable.size(); }));
+    palette_destroy(loaded);
+    std::filesystem::remove(path);
+}
+
+TEST(palette_load_rejects_corrupt_header) {
+    std::vector<color_t> colorTable = extract(test_image(97, 61, 7), 16);
+    std::string path = (std::filesystem::temp_directory_path() / "ColorQuantizationNativeTest.palette").string();
+    Palette* palette = palette_create(colorTable.data(), colorTable.size(), true);
+
+    // offsets of tableOffset, listOffset and listLength in the header; each value would wrap an unchecked sum
+    for (std::streamoff fieldOffset : { 16, 24, 32 }) {
+        for (uint64_t value : { ~uint64_t{ 0 }, ~uint64_t{ 0 } - 63, uint64_t{ 1 } << 63 }) {
+            CHECK(palette_save(*palette, path.c_str(), false));
+            CHECK(patch_file(path, fieldOffset, &value, sizeof(value)));
+            Palette* loaded = palette_load(path.c_str());
+            CHECK(loaded == nullptr);
+            if (loaded) palette_destroy(loaded);
+        }
+    }
+    palette_destroy(palette);
+    std::filesystem::remove(path);
+}
+
+// ========== histograms ==========
+
+static std::vector<uint8_t> export_histogram(const SpaceShockColorExtractor& extractor) {
+    std::vector<uint8_t> buffer(get_histogram(extractor, nullptr, 0));
+    CHECK(get_histogram(extractor, buffer.data(), buffer.size()) == buffer.size());
+    return buffer;
+}
+
+static std::vector<color_t> table_of(SpaceShockColorExtractor& extractor, size_t tableLength) {
+    std::vector<color_t> colorTable(tableLength);
+    colorTable.resize(get_color_table(extractor, colorTable.data(), tableLength, nullptr, 0));
+    return colorTable;
+}
+
+TEST(histogram_round_trips_to_add_bitmap) {
+    Image image = test_image(97, 61, 7);
+    SpaceShockColorExtractor* source = create();
+    add_bitmap(*source, image.pixels.data(), image.size());
+    std::vector<uint8_t> histogram = export_histogram(*source);
+
+    SpaceShockColorExtractor* imported = create();
+    CHECK(add_histogram_buffer(*imported, histogram.data(), histogram.size()) != static_cast<size_t>(-1));
+    CHECK(export_histogram(*imported) == histogram);
+    CHECK(table_of(*imported, 16) == table_of(*source, 16));
+    CHECK(add_histogram_buffer(*imported, histogram.data(), histogram.size() - 1) == static_cast<size_t>(-1));
+
+    destroy(imported);
+    destroy(source);
+}
+
+TEST(merged_shards_equal_add_bitmap) {
+    Image image = test_image(97, 61, 8);
+    SpaceShockColorExtractor* whole = create();
+    add_bitmap(*whole, image.pixels.data(), image.size());
+
+    for (size_t shardCount : { 2, 7 }) {
+        SpaceShockColorExtractor* merged = create();
+        size_t rowsPerShard = (image.height + shardCount - 1) / shardCount;
+        for (size_t row = 0; row < image.height; row += rowsPerShard) {
+            size_t rows = std::min(rowsPerShard, image.height - row);
+            SpaceShockColorExtractor* shard = create();
+            add_bitmap(*shard, image.pixels.data() + row * image.width, rows * image.width);
+            std::vector<uint8_t> histogram = export_histogram(*shard);
+            CHECK(add_histogram_buffer(*merged, histogram.data(), histogram.size()) != static_cast<size_t>(-1));
+            destroy(shard);
+        }
+        CHECK(export_histogram(*merged).size() == export_histogram(*whole).size());
+        CHECK(table_of(*merged, 16) == table_of(*whole, 16));
+        CHECK(table_of(*merged, 256) == table_of(*whole, 256));
+        destroy(merged);
+    }
+    destroy(whole);
+}
+
+TEST(sampled_counts_saturate) {
+    // one sample standing for a million pixels of a color whose count is already at the limit
+    const color_t color = 0x336699;
+    const uint32_t fullCount = std::numeric_limits<uint32_t>::max();
+    Image image{ 1024, 1024, std::vector<color_t>(1024 * 1024, color) };
+
+    SpaceShockColorExtractor* saturated = create();
+    add_histogram(*saturated, &color, &fullCount, 1);
+    SpaceShockColorExtractor* sampled = create();
+    add_histogram(*sampled, &color, &fullCount, 1);
+    for (SampleMode mode : { SampleStride, SampleStratified, SampleLowDiscrepancy }) {
+        CHECK(add_bitmap_sampled(*sampled, image.pixels.data(), image.width, image.height, mode, image.size()) == 1);
+    }
+    CHECK(export_histogram(*sampled) == export_histogram(*saturated));
+
+    destroy(sampled);
+    destroy(saturated);
+}
+
+// ========== temporal updates ==========
+
+TEST(remove_bitmap_restores_histogram) {
+    // a frame with mostly its own colors, so removing it leaves most of the color list stale and compacts it, and
+    // a small frame whose removal leaves a few stale colors that the next add has to bring back
+    Image base = test_image(97, 61, 15);
+    for (Image frame : { test_image(160, 120, 16), test_image(13, 11, 17) }) {
+        for (color_t& pixel : frame.pixels) pixel ^= 0x010101;
+
+        SpaceShockColorExtractor* extractor = create();
+        add_bitmap(*extractor, base.pixels.data(), base.size());
+        std::vector<uint8_t> baseHistogram = export_histogram(*extractor);
+        add_bitmap(*extractor, frame.pixels.data(), frame.size());
+        std::vector<uint8_t> fullHistogram = export_histogram(*extractor);
+
+        for (int round = 0; round < 2; round++) {
+            remove_bitmap(*extractor, frame.pixels.data(), frame.size());
+            CHECK(export_histogram(*extractor) == baseHistogram);
+            add_bitmap(*extractor, frame.pixels.data(), frame.size());
+            CHECK(export_histogram(*extractor) == fullHistogram);
+        }
+        destroy(extractor);
+    }
+}
+
+TEST(decay_scales_histogram_mass) {
+    Image image = test_image(256, 256, 18);
+    SpaceShockColorExtractor* extractor = create();
+    add_bitmap(*extractor, image.pixels.data(), image.size());
+    table_of(*extractor, 16);
+    std::vector<uint8_t> histogram = export_histogram(*extractor);
+
+    decay(*extractor, 1.0);
+    CHECK(export_histogram(*extractor) == histogram);
+    CHECK(extractor_drift(*extractor) == 0);
+
+    // the decayed mass is the drift since the table
+    decay(*extractor, 0.5);
+    CHECK(std::abs(extractor_drift(*extractor) - 0.5) < 0.01);
+    destroy(extractor);
+}
+
+TEST(drift_counts_changes_since_table) {
+    Image image = test_image(97, 61, 19);
+    Image frame = test_image(31, 17, 20);
+    SpaceShockColorExtractor* extractor = create();
+    CHECK(std::isinf(extractor_drift(*extractor)));
+    add_bitmap(*extractor, image.pixels.data(), image.size());
+    CHECK(std::isinf(extractor_drift(*extractor)));
+
+    table_of(*extractor, 16);
+    CHECK(extractor_drift(*extractor) == 0);
+    add_bitmap(*extractor, frame.pixels.data(), frame.size());
+    remove_bitmap(*extractor, frame.pixels.data(), frame.size());
+    CHECK(extractor_drift(*extractor) == 2.0 * frame.size() / image.size());
+    table_of(*extractor, 16);
+    CHECK(extractor_drift(*extractor) == 0);
+    destroy(extractor);
+}
+
+TEST(color_table_is_repeatable_after_updates) {
+    Image image = test_image(97, 61, 21);
+    Image frame = test_image(64, 48, 22);
+    SpaceShockColorExtractor* extractor = create();
+    add_bitmap(*extractor, image.pixels.data(), image.size());
+    add_bitmap(*extractor, frame.pixels.data(), frame.size());
+    table_of(*extractor, 256);
+    remove_bitmap(*extractor, frame.pixels.data(), frame.size());
+    decay(*extractor, 0.75);
+
+    // the first table after the updates is that of a fresh extractor holding the same histogram
+    std::vector<uint8_t> histogram = export_histogram(*extractor);
+    SpaceShockColorExtractor* fresh = create();
+    add_histogram_buffer(*fresh, histogram.data(), histogram.size());
+    for (size_t tableLength : { 16, 256 }) {
+        std::vector<color_t> first = table_of(*extractor, tableLength);
+        CHECK(first.size() == tableLength);
+        CHECK(first == table_of(*fresh, tableLength));
+        CHECK(first == table_of(*extractor, tableLength));
+        CHECK(export_histogram(*extractor) == histogram);
+    }
+    destroy(fresh);
+    destroy(extractor);
+}
+
+// ========== palette updates ==========
+
+TEST(palette_update_equals_fresh_palette) {
+    Image image = test_image(97, 61, 9);
+    Image next = test_image(97, 61, 10);
+    std::vector<color_t> colorTable = extract(image, 16);
+
+    for (ColorMetric metric : { MetricRgb, MetricLuma, MetricOklab }) {
+        for (bool optimize : { false, true }) {
+            Palette* palette = palette_create_metric(colorTable.data(), colorTable.size(), optimize, metric);
+            map_with(*palette, image);
+
+            // move a few entries far enough to change which cubes they own, and one onto another entry
+            std::vector<color_t> updated = colorTable;
+            std::vector<uint8_t> indexes{ 0, 3, 7, 15 };
+            std::vector<color_t> colors{ updated[0] ^ 0x404040, updated[3] ^ 0x800000, updated[1], 0x00ff00 };
+            for (size_t i = 0; i < indexes.size(); i++) updated[indexes[i]] = colors[i];
+            CHECK(palette_update(*palette, indexes.data(), colors.data(), indexes.size()));
+
+            Palette* fresh = palette_create_metric(updated.data(), updated.size(), optimize, metric);
+            CHECK(map_with(*palette, image) == map_with(*fresh, image));
+            CHECK(map_with(*palette, next) == map_with(*fresh, next));
+            palette_destroy(fresh);
+
+            uint8_t outOfRange = static_cast<uint8_t>(colorTable.size());
+            CHECK(!palette_update(*palette, &outOfRange, colors.data(), 1));
+            palette_destroy(palette);
+        }
+    }
+}
+
+// ========== job queue ==========
+
+struct QueuedFrame {
+    Image image;
+    std::vector<uint8_t> indexes;
+    std::vector<color_t> colorTable;
+    // set by the callback, which runs before the job is marked done
+    std::atomic<size_t> callbackColorCount{ 0 };
+    QuantizationJob* job = nullptr;
+
+    QueuedFrame(size_t width, size_t height, uint64_t seed) : image(test_image(width, height, seed)), indexes(image.size()), colorTable(256) {}
+};
+
+static QuantizationJobDesc frame_desc(QueuedFrame& frame, size_t tableLength, bool dither) {
+    QuantizationJobDesc desc{};
+    desc.pixels = frame.image.pixels.data();
+    desc.width = frame.image.width;
+    desc.height = frame.image.height;
+    desc.indexes = frame.indexes.data();
+    desc.colorTable = frame.colorTable.data();
+    desc.tableLength = tableLength;
+    desc.optimize = true;
+    desc.dither = dither;
+    desc.callback = [](void* userData, size_t colorCount) {
+        static_cast<QueuedFrame*>(userData)->callbackColorCount = colorCount;
+    };
+    desc.userData = &frame;
+    return desc;
+}
+
+// A job of the queue gives the table and indexes of the blocking calls.
+static void check_frame(QueuedFrame& frame, const Image& source, size_t tableLength, bool dither, size_t colorCount) {
+    std::vector<color_t> colorTable = extract(source, tableLength);
+    CHECK(colorCount == colorTable.size() && frame.callbackColorCount == colorCount);
+    CHECK(std::equal(colorTable.begin(), colorTable.end(), frame.colorTable.begin()));
+    CHECK(frame.indexes == (dither ? dither_pixels(colorTable, source) : map_pixels(colorTable, source, true)));
+}
+
+TEST(job_queue_runs_callbacks) {
+    scheduler_configure(2, nullptr, 0);
+    QuantizationQueue* queue = job_queue_create(2, 0);
+    std::vector<std::unique_ptr<QueuedFrame>> frames;
+    for (uint64_t seed = 0; seed < 6; seed++) {
+        frames.push_back(std::make_unique<QueuedFrame>(64, 48, 30 + seed));
+    }
+
+    for (size_t i = 0; i < frames.size(); i++) {
+        QueuedFrame& frame = *frames[i];
+        frame.job = job_submit(*queue, frame_desc(frame, i % 2 ? 16 : 256, i % 3 == 0));
+        CHECK(frame.job != nullptr);
+    }
+    for (size_t i = 0; i < frames.size(); i++) {
+        QueuedFrame& frame = *frames[i];
+        size_t colorCount = job_wait(*frame.job);
+        CHECK(job_done(*frame.job));
+        check_frame(frame, test_image(64, 48, 30 + i), i % 2 ? 16 : 256, i % 3 == 0, colorCount);
+        job_release(frame.job);
+    }
+
+    QueuedFrame invalid(64, 48, 36);
+    CHECK(job_submit(*queue, frame_desc(invalid, 0, false)) == nullptr);
+    CHECK(job_submit(*queue, frame_desc(invalid, 257, false)) == nullptr);
+    job_queue_destroy(queue);
+    scheduler_configure(0, nullptr, 0);
+}
+
+TEST(job_queue_blocks_at_max_pending_jobs) {
+    scheduler_configure(2, nullptr, 0);
+    QuantizationQueue* queue = job_queue_create(2, 1);
+    QueuedFrame first(64, 48, 40), second(64, 48, 41);
+
+    // the first job holds its slot until the gate opens
+    static std::atomic<bool> gateOpen;
+    gateOpen = false;
+    QuantizationJobDesc blocked = frame_desc(first, 16, false);
+    blocked.callback = [](void*, size_t) { while (!gateOpen) std::this_thread::yield(); };
+    first.job = job_submit(*queue, blocked);
+
+    std::atomic<bool> submitted{ false };
+    std::thread submitter([&] {
+        second.job = job_submit(*queue, frame_desc(second, 16, false));
+        submitted = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    CHECK(!submitted);
+
+    gateOpen = true;
+    submitter.join();
+    CHECK(submitted && second.job != nullptr);
+    job_wait(*first.job);
+    job_wait(*second.job);
+    CHECK(second.callbackColorCount == 16);
+    job_release(first.job);
+    job_release(second.job);
+    job_queue_destroy(queue);
+    scheduler_configure(0, nullptr, 0);
+}
+
+TEST(job_queue_destroy_waits_for_pending_jobs) {
+    scheduler_configure(2, nullptr, 0);
+    QuantizationQueue* queue = job_queue_create(1, 8);
+    std::vector<std::unique_ptr<QueuedFrame>> frames;
+    for (uint64_t seed = 0; seed < 4; seed++) {
+        frames.push_back(std::make_unique<QueuedFrame>(96, 64, 50 + seed));
+    }
+    for (auto& frame : frames) {
+        frame->job = job_submit(*queue, frame_desc(*frame, 64, true));
+    }
+    // handles may go before their jobs complete
+    job_release(frames[0]->job);
+    job_release(frames[1]->job);
+    job_queue_destroy(queue);
+
+    for (size_t i = 0; i < frames.size(); i++) {
+        QueuedFrame& frame = *frames[i];
+        if (i >= 2) {
+            CHECK(job_done(*frame.job));
+            CHECK(job_wait(*frame.job) == frame.callbackColorCount);
+            job_release(frame.job);
+        }
+        check_frame(frame, test_image(96, 64, 50 + i), 64, true, frame.callbackColorCount);
+    }
+    scheduler_configure(0, nullptr, 0);
+}
+
+// ========== scheduling ==========
+
+// Everything the scheduler splits into chunks, run once under one worker configuration.
+struct ScheduledResults {
+    QuantizationMetrics metrics;
+    std::vector<uint8_t> mapped, dithered, queued;
+    std::vector<color_t> ditheredPixels, queuedTable;
+    std::vector<color_t> coarseTable;
+    std::vector<uint8_t> tiled;
+    std::vector<color_t> tileTables;
+
+    bool operator==(const ScheduledResults&) const = default;
+};
+
+static ScheduledResults run_scheduled(const Image& image, const std::vector<color_t>& colorTable) {
+    ScheduledResults results{};
+    Palette* palette = palette_create(colorTable.data(), colorTable.size(), true);
+    results.mapped.resize(image.size());
+    palette_map_metrics(*palette, image.pixels.data(), results.mapped.data(), image.size(), &results.metrics);
+    results.ditheredPixels = image.pixels;
+    results.dithered.resize(image.size());
+    palette_dither(*palette, results.ditheredPixels.data(), results.dithered.data(), image.width, image.height);
+    palette_destroy(palette);
+
+    SpaceShockColorExtractor* extractor = create();
+    add_bitmap(*extractor, image.pixels.data(), image.size());
+    results.coarseTable.resize(64);
+    results.coarseTable.resize(get_color_table_coarse(*extractor, results.coarseTable.data(), 64, nullptr, 0, 6));
+    destroy(extractor);
+
+    std::vector<TileRect> tiles(tiles_grid(image.width, image.height, 128, 128, nullptr, 0));
+    tiles_grid(image.width, image.height, 128, 128, tiles.data(), tiles.size());
+    std::vector<size_t> tableLengths(tiles.size());
+    results.tileTables.resize(tiles.size() * 16);
+    results.tiled.resize(image.size());
+    CHECK(tiles_quantize(image.pixels.data(), image.width, image.height, tiles.data(), tiles.size(), 16, MetricRgb,
+        results.tileTables.data(), tableLengths.data(), results.tiled.data()) == image.size());
+
+    QuantizationQueue* queue = job_queue_create(0, 0);
+    std::vector<color_t> pixels = image.pixels;
+    results.queued.resize(image.size());
+    results.queuedTable.resize(32);
+    QuantizationJobDesc desc{};
+    desc.pixels = pixels.data();
+    desc.width = image.width;
+    desc.height = image.height;
+    desc.indexes = results.queued.data();
+    desc.colorTable = results.queuedTable.data();
+    desc.tableLength = results.queuedTable.size();
+    desc.optimize = true;
+    desc.dither = true;
+    QuantizationJob* job = job_submit(*queue, desc);
+    results.queuedTable.resize(job_wait(*job));
+    job_release(job);
+    job_queue_destroy(queue);
+    return results;
+}
+
+TEST(results_ignore_worker_count) {
+    // large enough that mapping and dithering split into several chunks
+    Image image = test_image(400, 300, 11);
+    std::vector<color_t> colorTable = extract(image, 64);
+
+    CHECK(scheduler_configure(0, nullptr, 0));
+    CHECK(scheduler_worker_count() == 0);
+    ScheduledResults expected = run_scheduled(image, colorTable);
+    for (size_t workerCount : { 1, 2, 4 }) {
+        scheduler_configure(workerCount, nullptr, 0);
+        CHECK(scheduler_worker_count() == workerCount);
+        CHECK(run_scheduled(image, colorTable) == expected);
+    }
+    // back to running everything on the calling thread for the tests after this one
+    scheduler_configure(0, nullptr, 0);
+}
+
+// ========== tiles ==========
+
+TEST(tiles_grid_covers_image) {
+    CHECK(tiles_grid(97, 61, 45, 37, nullptr, 0) == 6);
+    std::vector<TileRect> tiles(6);
+    CHECK(tiles_grid(97, 61, 45, 37, tiles.data(), 5) == static_cast<size_t>(-1));
+    CHECK(tiles_grid(97, 61, 45, 37, tiles.data(), tiles.size()) == 6);
+
+    std::vector<int> covered(97 * 61);
+    for (const TileRect& tile : tiles) {
+        for (size_t y = tile.y; y < tile.y + tile.height; y++) {
+            for (size_t x = tile.x; x < tile.x + tile.width; x++) covered[y * 97 + x]++;
+        }
+    }
+    CHECK(std::all_of(covered.begin(), covered.end(), [](int count) { return count == 1; }));
+    CHECK(tiles[2].x == 90 && tiles[2].width == 7 && tiles[5].y == 37 && tiles[5].height == 24);
+}
+
+TEST(tiles_match_dense_extractor) {
+    Image image = test_image(97, 61, 13);
+    std::vector<TileRect> tiles(tiles_grid(image.width, image.height, 45, 37, nullptr, 0));
+    tiles_grid(image.width, image.height, 45, 37, tiles.data(), tiles.size());
+
+    for (ColorMetric metric : { MetricRgb, MetricOklab }) {
+        for (size_t tableLength : { 2, 16, 256 }) {
+            std::vector<color_t> colorTables(tiles.size() * tableLength);
+            std::vector<size_t> tableLengths(tiles.size());
+            std::vector<uint8_t> indexes(image.size());
+            CHECK(tiles_quantize(image.pixels.data(), image.width, image.height, tiles.data(), tiles.size(), tableLength, metric,
+                colorTables.data(), tableLengths.data(), indexes.data()) == image.size());
+
+            size_t offset = 0;
+            for (size_t i = 0; i < tiles.size(); i++) {
+                const TileRect& tile = tiles[i];
+                Image tileImage{ tile.width, tile.height, {} };
+                for (size_t y = tile.y; y < tile.y + tile.height; y++) {
+                    const color_t* row = image.pixels.data() + y * image.width + tile.x;
+                    tileImage.pixels.insert(tileImage.pixels.end(), row, row + tile.width);
+                }
+
+                // the tile histogram lists its colors in ascending order, which decides ties between equal counts
+                std::vector<color_t> colors;
+                std::vector<uint32_t> counts;
+                std::vector<color_t> sorted = tileImage.pixels;
+                for (color_t& color : sorted) color &= 0xffffff;
+                std::sort(sorted.begin(), sorted.end());
+                for (color_t color : sorted) {
+                    if (colors.empty() || colors.back() != color) {
+                        colors.push_back(color);
+                        counts.push_back(0);
+                    }
+                    counts.back()++;
+                }
+
+                SpaceShockColorExtractor* extractor = create();
+                extractor_set_metric(*extractor, metric);
+                add_histogram(*extractor, colors.data(), counts.data(), colors.size());
+                std::vector<color_t> expected(tableLength);
+                expected.resize(get_color_table(*extractor, expected.data(), tableLength, nullptr, 0));
+                destroy(extractor);
+
+                const color_t* colorTable = colorTables.data() + i * tableLength;
+                CHECK(tableLengths[i] == expected.size() && std::equal(expected.begin(), expected.end(), colorTable));
+                CHECK(std::all_of(colorTable + tableLengths[i], colorTable + tableLength, [](color_t color) { return color == 0; }));
+
+                Palette* palette = palette_create_metric(expected.data(), expected.size(), false, metric);
+                std::vector<uint8_t> tileIndexes = map_with(*palette, tileImage);
+                palette_destroy(palette);
+                CHECK(std::equal(tileIndexes.begin(), tileIndexes.end(), indexes.begin() + offset));
+                offset += tileImage.size();
+            }
+        }
+    }
+}
+
+// ========== digests ==========
+
+// FNV-1a, so the results of two builds of the library can be compared without storing them.
+static uint64_t digest(const void* data, size_t length) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ static_cast<const uint8_t*>(data)[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+template<typename T>
+static uint64_t digest(const std::vector<T>& values) {
+    return digest(values.data(), values.size() * sizeof(T));
+}
+
+// Results of the paths that have AVX2 variants: the absorb loop of get_color_table and the color expansion of
+// palette lookups. CompareDigests.cmake checks that the scalar and the AVX2 build print the same lines.
+static void print_digests() {
+    const color_t forceColors[] = { 0x000000, 0xffffff, 0x808080 };
+
+    for (uint64_t seed : { 1, 2, 3 }) {
+        Image image = test_image(320, 240, seed);
+        for (ColorMetric metric : { MetricRgb, MetricLuma, MetricOklab }) {
+            SpaceShockColorExtractor* extractor = create();
+            extractor_set_metric(*extractor, metric);
+            add_bitmap(*extractor, image.pixels.data(), image.size());
+
+            for (size_t tableLength : { 16, 256 }) {
+                for (size_t forceCount : { size_t{ 0 }, std::size(forceColors) }) {
+                    std::vector<color_t> colorTable(tableLength);
+                    colorTable.resize(get_color_table(*extractor, colorTable.data(), tableLength, forceColors, forceCount));
+
+                    Palette* palette = palette_create_metric(colorTable.data(), colorTable.size(), true, metric);
+                    std::vector<uint8_t> mapped = map_with(*palette, image);
+                    std::vector<color_t> pixels = image.pixels;
+                    std::vector<uint8_t> dithered(image.size());
+                    palette_dither(*palette, pixels.data(), dithered.data(), image.width, image.height);
+                    palette_destroy(palette);
+
+                    std::printf("seed %" PRIu64 " metric %d table %zu force %zu: table %016" PRIx64 " map %016" PRIx64 " dither %016" PRIx64 "\n",
+                        seed, static_cast<int>(metric), tableLength, forceCount, digest(colorTable), digest(mapped), digest(dithered));
+                }
+            }
+            destroy(extractor);
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+#if defined(COLORQUANTIZATION_TEST_AVX2)
+    // linked against the AVX2 build of the library, which this CPU may not be able to run
+    if (!__builtin_cpu_supports("avx2")) {
+        std::fprintf(stderr, "skipped: this CPU does not support AVX2\n");
+        return 77;
+    }
+#endif
+
+    if (argc > 1 && std::string(argv[1]) == "--digest") {
+        print_digests();
+        return 0;
+    }
+
+    std::string filter = argc > 1 ? argv[1] : "";
+    size_t runCount = 0, failedCount = 0;
+
+    for (const TestCase& test : registry()) {
+        if (!filter.empty() && std::string(test.name).find(filter) == std::string::npos) continue;
+
+        size_t failuresBefore = failureCount;
+        test.run();
+        bool passed = failureCount == failuresBefore;
+        std::fprintf(stderr, "%-48s %s\n", test.name, passed ? "ok" : "FAILED");
+        runCount++;
+        if (!passed) failedCount++;
+    }
+
+    std::fprintf(stderr, "%zu tests, %zu failed\n", runCount, failedCount);
+    return failedCount == 0 ? 0 : 1;
+}
@@ -1,8 +1,6 @@
 ﻿using System;
 using System.Drawing;
 using System.Drawing.Imaging;
-using System.Runtime.CompilerServices;
-using System.Runtime.InteropServices;
 using ColorQuantizationSharp;
 
 unsafe {
@@ -47,14 +45,7 @@ unsafe {
         var data = cloneBitmap.LockBits(new Rectangle(0, 0, cloneBitmap.Width, cloneBitmap.Height), ImageLockMode.ReadWrite, PixelFormat.Format32bppRgb);
         var pixels = new Span<uint>((void*)data.Scan0, data.Width * data.Height);
 
-        byte[] indexes = palette.Map(pixels);
-
-        ref uint palettePtr = ref MemoryMarshal.GetReference(palette.ColorTable);
-        ref byte indexPtr = ref MemoryMarshal.GetArrayDataReference(indexes);
-
-        for (int i = 0; i < pixels.Length; i++) {
-            pixels[i] = Unsafe.Add(ref palettePtr, Unsafe.Add(ref indexPtr, i));
-        }
+        palette.MapRgb(pixels);
 
         cloneBitmap.UnlockBits(data);
         return cloneBitmap;
@@ -0,0 +1,19 @@
+﻿namespace ColorQuantizationSharp {
+    /// <summary>
+    /// 颜色之间的距离，用于查找调色板中最近的颜色，以及在<see cref="SpaceShockColorExtractor.GetColorTable(System.Span{uint}, System.ReadOnlySpan{uint})"/>中合并颜色。
+    /// </summary>
+    public enum ColorMetric : uint {
+        /// <summary>
+        /// sRGB空间中的欧氏距离
+        /// </summary>
+        Rgb,
+        /// <summary>
+        /// 按亮度系数0.299、0.587、0.114加权的sRGB距离，对绿色的差异更敏感
+        /// </summary>
+        Luma,
+        /// <summary>
+        /// Oklab空间中的欧氏距离，更接近人眼感知的色差
+        /// </summary>
+        Oklab,
+    }
+}
\ No newline at end of file
@@ -0,0 +1,9 @@
+﻿using System.Runtime.InteropServices;
+
+namespace ColorQuantizationSharp {
+    [StructLayout(LayoutKind.Sequential)]
+    internal struct ColorTableBudget {
+        public ulong DeadlineNanoseconds;
+        public ulong MaxWork;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,31 @@
+﻿using System;
+
+namespace ColorQuantizationSharp {
+    /// <summary>
+    /// 限时获取颜色表时为了不超出预算而采取的简化措施。
+    /// </summary>
+    [Flags]
+    public enum ColorTableShortcuts : uint {
+        None = 0,
+        /// <summary>
+        /// 吸收邻近颜色时使用了比正常更小的核
+        /// </summary>
+        SmallKernels = 1,
+        /// <summary>
+        /// 部分低计数颜色被选中后没有吸收邻近颜色
+        /// </summary>
+        SkipAbsorb = 2,
+        /// <summary>
+        /// 合并阶段忽略了来不及处理的低计数颜色
+        /// </summary>
+        RaisedSkipMinCount = 4,
+        /// <summary>
+        /// 合并阶段中途停止
+        /// </summary>
+        ReduceStopped = 8,
+        /// <summary>
+        /// 颜色表完成前已经超过期限，返回的颜色表仍是完整的
+        /// </summary>
+        Deadline = 16,
+    }
+}
\ No newline at end of file
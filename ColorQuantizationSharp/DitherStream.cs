@@ -0,0 +1,72 @@
+﻿using System;
+using System.Runtime.InteropServices;
+
+namespace ColorQuantizationSharp {
+    /// <summary>
+    /// 按水平条带分块进行抖动处理，结果与对整张图像调用<see cref="Palette.Dither(Span{uint}, Span{byte}, int, int)"/>完全相同。
+    /// <para>内部只保存一行的误差，适合无法一次性载入内存的大图像。</para>
+    /// </summary>
+    public class DitherStream : IDisposable {
+        private IntPtr ptr;
+        private readonly Palette palette;
+
+        public int Width { get; }
+
+        public int Height { get; }
+
+        /// <summary>
+        /// 已处理的行数
+        /// </summary>
+        public int Row { get; private set; }
+
+        /// <summary>
+        /// 构造一个抖动流。
+        /// <para>使用期间不能释放<paramref name="palette"/>。</para>
+        /// </summary>
+        /// <param name="palette"></param>
+        /// <param name="width"></param>
+        /// <param name="height">整张图像的高度</param>
+        /// <exception cref="ArgumentOutOfRangeException"></exception>
+        public DitherStream(Palette palette, int width, int height) {
+            if (width <= 0) throw new ArgumentOutOfRangeException(nameof(width));
+            if (height <= 0) throw new ArgumentOutOfRangeException(nameof(height));
+
+            this.palette = palette;
+            Width = width;
+            Height = height;
+            ptr = Native.PaletteDitherStreamCreate(palette.Handle, width, height);
+        }
+
+        /// <summary>
+        /// 对接下来的若干行进行抖动处理，行数为<paramref name="pixels"/>.Length / <see cref="Width"/>。
+        /// </summary>
+        /// <param name="pixels"></param>
+        /// <param name="indexes"></param>
+        /// <returns>实际处理的行数</returns>
+        /// <exception cref="ArgumentOutOfRangeException"></exception>
+        public int Push(Span<uint> pixels, Span<byte> indexes) {
+            int rowCount = pixels.Length / Width;
+            if (indexes.Length < rowCount * Width) throw new ArgumentOutOfRangeException(nameof(indexes), "存放索引的缓冲区太小");
+
+            int processed = (int)Native.PaletteDitherStreamPush(ptr, ref MemoryMarshal.GetReference(pixels), ref MemoryMarshal.GetReference(indexes), rowCount);
+            Row += processed;
+            return processed;
+        }
+
+        protected virtual void Dispose(bool disposing) {
+            if (ptr != IntPtr.Zero) {
+                Native.PaletteDitherStreamDestroy(ptr);
+                ptr = IntPtr.Zero;
+            }
+        }
+
+        ~DitherStream() {
+            Dispose(disposing: false);
+        }
+
+        public void Dispose() {
+            Dispose(disposing: true);
+            GC.SuppressFinalize(this);
+        }
+    }
+}
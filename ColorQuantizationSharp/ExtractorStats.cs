@@ -0,0 +1,26 @@
+﻿using System.Runtime.InteropServices;
+
+namespace ColorQuantizationSharp {
+    /// <summary>
+    /// <see cref="SpaceShockColorExtractor"/>自创建或<see cref="SpaceShockColorExtractor.Reset"/>以来的内部计数。
+    /// <para>仅当原生库以COLORQUANTIZATION_STATS编译时才会统计。</para>
+    /// </summary>
+    [StructLayout(LayoutKind.Sequential)]
+    public struct ExtractorStats {
+        public ulong ColorTableCalls;
+        public ulong AbsorbCalls;
+        public ulong AbsorbCellsVisited;
+        public ulong AbsorbCellsNonEmpty;
+        public ulong AbsorbCellsChanged;
+        public ulong KernelRebuilds;
+        public ulong MapInserts;
+        public ulong MapErases;
+        public ulong SelectIterations;
+        public ulong ReduceIterations;
+        public ulong SortNanoseconds;
+        public ulong ForceNanoseconds;
+        public ulong SelectNanoseconds;
+        public ulong ReduceNanoseconds;
+        public ulong RestoreNanoseconds;
+    }
+}
\ No newline at end of file
@@ -4,7 +4,7 @@ using System.Security;
 namespace ColorQuantizationSharp {
     [SuppressUnmanagedCodeSecurity]
     unsafe internal static class Native {
-        const string Dll = "ColorQuantization.dll";
+        const string Dll = "ColorQuantization";
 
         [DllImport(Dll, EntryPoint = "create")]
         public static extern IntPtr Create();
@@ -21,12 +21,50 @@ namespace ColorQuantizationSharp {
         [DllImport(Dll, EntryPoint = "add_bitmap")]
         public static extern void AddBitmap(IntPtr extractorPtr, ref uint pixels, nint pixelCount);
 
+        [DllImport(Dll, EntryPoint = "add_bitmap_sampled")]
+        public static extern nint AddBitmapSampled(IntPtr extractorPtr, ref uint pixels, nint width, nint height, SampleMode mode, nint ratio);
+
+        [DllImport(Dll, EntryPoint = "add_bitmap_stream")]
+        public static extern nint AddBitmapStream(IntPtr extractorPtr, delegate* unmanaged<void*, uint*, nint, nint> readPixels, void* userData, nint bufferLength);
+
+        [DllImport(Dll, EntryPoint = "remove_bitmap")]
+        public static extern void RemoveBitmap(IntPtr extractorPtr, ref uint pixels, nint pixelCount);
+
+        [DllImport(Dll, EntryPoint = "decay")]
+        public static extern void Decay(IntPtr extractorPtr, double factor);
+
+        [DllImport(Dll, EntryPoint = "extractor_drift")]
+        public static extern double ExtractorDrift(IntPtr extractorPtr);
+
+        [DllImport(Dll, EntryPoint = "add_histogram")]
+        public static extern void AddHistogram(IntPtr extractorPtr, ref uint colors, ref uint counts, nint colorCount);
+
+        [DllImport(Dll, EntryPoint = "add_histogram_buffer")]
+        public static extern nint AddHistogramBuffer(IntPtr extractorPtr, ref byte buffer, nint bufferLength);
+
+        [DllImport(Dll, EntryPoint = "get_histogram")]
+        public static extern nint GetHistogram(IntPtr extractorPtr, byte* buffer, nint bufferLength);
+
         [DllImport(Dll, EntryPoint = "get_color_table")]
         public static extern nint GetColorTable(IntPtr extractorPtr, uint* colorTable, nint tableLength, uint* forceColors, nint forceColorCount);
 
         [DllImport(Dll, EntryPoint = "get_color_table")]
         public static extern nint GetColorTable(IntPtr extractorPtr, ref uint colorTable, nint tableLength, ref uint forceColors, nint forceColorCount);
 
+        [DllImport(Dll, EntryPoint = "get_color_table_budget")]
+        public static extern nint GetColorTableBudget(IntPtr extractorPtr, ref uint colorTable, nint tableLength, ref uint forceColors, nint forceColorCount, in ColorTableBudget budget, out ColorTableShortcuts shortcuts);
+
+        [DllImport(Dll, EntryPoint = "get_color_table_coarse")]
+        public static extern nint GetColorTableCoarse(IntPtr extractorPtr, ref uint colorTable, nint tableLength, ref uint forceColors, nint forceColorCount, nint channelBits);
+
+        [DllImport(Dll, EntryPoint = "extractor_set_metric")]
+        [return: MarshalAs(UnmanagedType.U1)]
+        public static extern bool ExtractorSetMetric(IntPtr extractorPtr, ColorMetric metric);
+
+        [DllImport(Dll, EntryPoint = "extractor_stats")]
+        [return: MarshalAs(UnmanagedType.U1)]
+        public static extern bool ExtractorStats(IntPtr extractorPtr, out ExtractorStats stats);
+
         // ========== palette ==========
         [DllImport(Dll, EntryPoint = "palette_create")]
         public static extern IntPtr PaletteCreate(uint* colorTable, nint tableLength, bool optimize);
@@ -34,9 +72,19 @@ namespace ColorQuantizationSharp {
         [DllImport(Dll, EntryPoint = "palette_create")]
         public static extern IntPtr PaletteCreate(ref uint colorTable, nint tableLength, bool optimize);
 
+        [DllImport(Dll, EntryPoint = "palette_create_metric")]
+        public static extern IntPtr PaletteCreateMetric(ref uint colorTable, nint tableLength, bool optimize, ColorMetric metric);
+
+        [DllImport(Dll, EntryPoint = "palette_metric")]
+        public static extern ColorMetric PaletteMetric(IntPtr palettePtr);
+
         [DllImport(Dll, EntryPoint = "palette_destroy")]
         public static extern void PaletteDestroy(IntPtr palettePtr);
 
+        [DllImport(Dll, EntryPoint = "palette_update")]
+        [return: MarshalAs(UnmanagedType.U1)]
+        public static extern bool PaletteUpdate(IntPtr palettePtr, ref byte indexes, ref uint colors, nint count);
+
         [DllImport(Dll, EntryPoint = "palette_map")]
         public static extern void PaletteMap(IntPtr palettePtr, uint* pixels, byte* indexes, nint length);
 
@@ -49,7 +97,76 @@ namespace ColorQuantizationSharp {
         [DllImport(Dll, EntryPoint = "palette_dither")]
         public static extern void PaletteDither(IntPtr palettePtr, ref uint pixels, ref byte indexes, nint width, nint height);
 
+        [DllImport(Dll, EntryPoint = "palette_map_metrics")]
+        public static extern void PaletteMapMetrics(IntPtr palettePtr, ref uint pixels, ref byte indexes, nint length, out QuantizationMetrics metrics);
+
+        [DllImport(Dll, EntryPoint = "palette_dither_metrics")]
+        public static extern void PaletteDitherMetrics(IntPtr palettePtr, ref uint pixels, ref byte indexes, nint width, nint height, out QuantizationMetrics metrics);
+
+        [DllImport(Dll, EntryPoint = "palette_dither_stream_create")]
+        public static extern IntPtr PaletteDitherStreamCreate(IntPtr palettePtr, nint width, nint height);
+
+        [DllImport(Dll, EntryPoint = "palette_dither_stream_destroy")]
+        public static extern void PaletteDitherStreamDestroy(IntPtr streamPtr);
+
+        [DllImport(Dll, EntryPoint = "palette_dither_stream_push")]
+        public static extern nint PaletteDitherStreamPush(IntPtr streamPtr, ref uint pixels, ref byte indexes, nint rowCount);
+
+        [DllImport(Dll, EntryPoint = "palette_map_rgb")]
+        public static extern void PaletteMapRgb(IntPtr palettePtr, uint* pixels, uint* outPixels, byte* indexes, nint length);
+
+        [DllImport(Dll, EntryPoint = "palette_map_rgb")]
+        public static extern void PaletteMapRgb(IntPtr palettePtr, ref uint pixels, ref uint outPixels, ref byte indexes, nint length);
+
+        [DllImport(Dll, EntryPoint = "palette_packed_stride")]
+        public static extern nint PalettePackedStride(nint width, nint bitDepth, nint rowAlignment);
+
+        [DllImport(Dll, EntryPoint = "palette_map_packed")]
+        public static extern nint PaletteMapPacked(IntPtr palettePtr, ref uint pixels, ref byte indexes, nint width, nint height, nint bitDepth, nint rowAlignment);
+
+        [DllImport(Dll, EntryPoint = "palette_dither_packed")]
+        public static extern nint PaletteDitherPacked(IntPtr palettePtr, ref uint pixels, ref byte indexes, nint width, nint height, nint bitDepth, nint rowAlignment);
+
+        [DllImport(Dll, EntryPoint = "palette_save")]
+        [return: MarshalAs(UnmanagedType.U1)]
+        public static extern bool PaletteSave(IntPtr palettePtr, [MarshalAs(UnmanagedType.LPUTF8Str)] string filename, bool includeIndexMap);
+
+        [DllImport(Dll, EntryPoint = "palette_load")]
+        public static extern IntPtr PaletteLoad([MarshalAs(UnmanagedType.LPUTF8Str)] string filename);
+
         [DllImport(Dll, EntryPoint = "palette_color_table")]
         public static extern uint* PaletteColorTable(IntPtr palettePtr, out nint tableLength);
+
+        [DllImport(Dll, EntryPoint = "palette_stats")]
+        [return: MarshalAs(UnmanagedType.U1)]
+        public static extern bool PaletteStats(IntPtr palettePtr, out PaletteStats stats);
+
+        [DllImport(Dll, EntryPoint = "scheduler_configure")]
+        [return: MarshalAs(UnmanagedType.U1)]
+        public static extern bool SchedulerConfigure(nint workerCount, nint* cpus, nint cpuCount);
+
+        [DllImport(Dll, EntryPoint = "scheduler_set_executor")]
+        public static extern void SchedulerSetExecutor(delegate* unmanaged<void*, delegate* unmanaged<void*, void>, void*, void> executor, void* executorData, nint concurrency);
+
+        [DllImport(Dll, EntryPoint = "scheduler_worker_count")]
+        public static extern nint SchedulerWorkerCount();
+
+        [DllImport(Dll, EntryPoint = "job_queue_create")]
+        public static extern IntPtr JobQueueCreate(nint concurrency, nint maxPendingJobs);
+
+        [DllImport(Dll, EntryPoint = "job_queue_destroy")]
+        public static extern void JobQueueDestroy(IntPtr queuePtr);
+
+        [DllImport(Dll, EntryPoint = "job_submit")]
+        public static extern IntPtr JobSubmit(IntPtr queuePtr, in QuantizationJobDesc desc);
+
+        [DllImport(Dll, EntryPoint = "job_release")]
+        public static extern void JobRelease(IntPtr jobPtr);
+
+        [DllImport(Dll, EntryPoint = "tiles_grid")]
+        public static extern nint TilesGrid(nint width, nint height, nint tileWidth, nint tileHeight, ref TileRect tiles, nint tileCapacity);
+
+        [DllImport(Dll, EntryPoint = "tiles_quantize")]
+        public static extern nint TilesQuantize(ref uint pixels, nint width, nint height, ref TileRect tiles, nint tileCount, nint tableLength, ColorMetric metric, ref uint colorTables, ref nint tableLengths, ref byte indexes);
     }
 }
\ No newline at end of file
@@ -1,10 +1,18 @@
 ﻿using System;
+using System.Runtime.CompilerServices;
 using System.Runtime.InteropServices;
 
 namespace ColorQuantizationSharp {
     public class Palette : IDisposable {
         private IntPtr ptr;
 
+        internal IntPtr Handle => ptr;
+
+        /// <summary>
+        /// 查找最近颜色时使用的颜色距离，从文件载入时与保存时相同。
+        /// </summary>
+        public ColorMetric Metric => Native.PaletteMetric(ptr);
+
         unsafe public ReadOnlySpan<uint> ColorTable {
             get {
                 var table = Native.PaletteColorTable(ptr, out nint count);
@@ -26,6 +34,77 @@ namespace ColorQuantizationSharp {
             if (ptr == IntPtr.Zero) throw new ArgumentOutOfRangeException(nameof(colorTable), "颜色表大小不能超过256");
         }
 
+        /// <summary>
+        /// 构造一个按<paramref name="metric"/>查找最近颜色的调色板。
+        /// </summary>
+        /// <param name="colorTable">调色板颜色表</param>
+        /// <param name="metric">颜色距离，应与提取颜色表时<see cref="SpaceShockColorExtractor.Metric"/>相同</param>
+        /// <param name="optimize">参见<see cref="Palette(ReadOnlySpan{uint}, bool)"/></param>
+        /// <exception cref="ArgumentOutOfRangeException"></exception>
+        public Palette(ReadOnlySpan<uint> colorTable, ColorMetric metric, bool optimize = true) {
+            if (colorTable.IsEmpty) throw new ArgumentOutOfRangeException(nameof(colorTable), "颜色表不能为空");
+            if (metric > ColorMetric.Oklab) throw new ArgumentOutOfRangeException(nameof(metric));
+
+            ptr = Native.PaletteCreateMetric(ref MemoryMarshal.GetReference(colorTable), colorTable.Length, optimize, metric);
+            if (ptr == IntPtr.Zero) throw new ArgumentOutOfRangeException(nameof(colorTable), "颜色表大小不能超过256");
+        }
+
+        private Palette(IntPtr ptr) {
+            this.ptr = ptr;
+        }
+
+        /// <summary>
+        /// 从<see cref="Save"/>保存的文件中载入调色板。
+        /// <para>如果文件中包含完整的颜色索引表，则以只读方式映射该文件，多个进程共享同一份内存，几乎不需要初始化时间。</para>
+        /// </summary>
+        /// <param name="filename"></param>
+        /// <returns></returns>
+        /// <exception cref="InvalidDataException"></exception>
+        public static Palette Load(string filename) {
+            IntPtr ptr = Native.PaletteLoad(filename);
+            if (ptr == IntPtr.Zero) throw new InvalidDataException($"无法载入调色板文件：{filename}");
+            return new Palette(ptr);
+        }
+
+        /// <summary>
+        /// 将调色板保存到文件，包括颜色表和优化后的候选颜色列表。
+        /// </summary>
+        /// <param name="filename"></param>
+        /// <param name="includeIndexMap">如果该参数为true，则预先计算所有颜色的索引并一起保存（16MB），载入后无需再查找</param>
+        /// <exception cref="IOException"></exception>
+        public void Save(string filename, bool includeIndexMap = false) {
+            if (!Native.PaletteSave(ptr, filename, includeIndexMap)) throw new IOException($"无法保存调色板文件：{filename}");
+        }
+
+        /// <summary>
+        /// 修改调色板中的部分颜色，并保留不受影响的缓存。
+        /// <para>适用于视频帧之间调色板只有少量变化的情况，比重新构造调色板更快，结果与用新颜色表构造的调色板完全相同。</para>
+        /// </summary>
+        /// <param name="indexes">要修改的颜色索引</param>
+        /// <param name="colors">对应的新颜色</param>
+        /// <exception cref="ArgumentException"></exception>
+        /// <exception cref="ArgumentOutOfRangeException"></exception>
+        /// <exception cref="InvalidOperationException"></exception>
+        public void Update(ReadOnlySpan<byte> indexes, ReadOnlySpan<uint> colors) {
+            if (indexes.Length != colors.Length) throw new ArgumentException("索引与颜色的长度不一致", nameof(colors));
+            foreach (byte index in indexes) {
+                if (index >= ColorTable.Length) throw new ArgumentOutOfRangeException(nameof(indexes), "索引超出颜色表范围");
+            }
+
+            if (!Native.PaletteUpdate(ptr, ref MemoryMarshal.GetReference(indexes), ref MemoryMarshal.GetReference(colors), indexes.Length)) {
+                throw new InvalidOperationException("从包含颜色索引表的文件载入的调色板不能修改");
+            }
+        }
+
+        /// <summary>
+        /// 读取内部计数，用于分析性能。
+        /// </summary>
+        /// <param name="stats"></param>
+        /// <returns>原生库未以COLORQUANTIZATION_STATS编译时返回false，此时计数全为0</returns>
+        public bool TryGetStats(out PaletteStats stats) {
+            return Native.PaletteStats(ptr, out stats);
+        }
+
         /// <summary>
         /// 将每个像素映射到距离最近的颜色索引
         /// </summary>
@@ -38,6 +117,19 @@ namespace ColorQuantizationSharp {
             Native.PaletteMap(ptr, ref MemoryMarshal.GetReference(pixels), ref MemoryMarshal.GetReference(outIndexes), pixels.Length);
         }
 
+        /// <summary>
+        /// 将每个像素映射到距离最近的颜色索引，并同时统计量化误差
+        /// </summary>
+        /// <param name="pixels"></param>
+        /// <param name="outIndexes"></param>
+        /// <param name="metrics">原图与量化结果之间的误差</param>
+        /// <exception cref="ArgumentOutOfRangeException"></exception>
+        public void Map(ReadOnlySpan<uint> pixels, Span<byte> outIndexes, out QuantizationMetrics metrics) {
+            if (outIndexes.Length < pixels.Length) throw new ArgumentOutOfRangeException(nameof(outIndexes), "存放索引的缓冲区太小");
+
+            Native.PaletteMapMetrics(ptr, ref MemoryMarshal.GetReference(pixels), ref MemoryMarshal.GetReference(outIndexes), pixels.Length, out metrics);
+        }
+
         /// <summary>
         /// 将每个像素映射到距离最近的颜色索引
         /// </summary>
@@ -65,6 +157,30 @@ namespace ColorQuantizationSharp {
             return Map(pixels);
         }
 
+        /// <summary>
+        /// 将每个像素替换为距离最近的调色板颜色，一次遍历完成映射和展开。
+        /// </summary>
+        /// <param name="pixels"></param>
+        public void MapRgb(Span<uint> pixels) {
+            ref uint pixelsRef = ref MemoryMarshal.GetReference(pixels);
+            Native.PaletteMapRgb(ptr, ref pixelsRef, ref pixelsRef, ref Unsafe.NullRef<byte>(), pixels.Length);
+        }
+
+        /// <summary>
+        /// 将每个像素映射为距离最近的调色板颜色，一次遍历完成映射和展开。
+        /// <para><paramref name="outPixels"/>可以与<paramref name="pixels"/>是同一块内存，但不能部分重叠。</para>
+        /// </summary>
+        /// <param name="pixels"></param>
+        /// <param name="outPixels"></param>
+        /// <param name="outIndexes">可选，同时输出颜色索引</param>
+        /// <exception cref="ArgumentOutOfRangeException"></exception>
+        public void MapRgb(ReadOnlySpan<uint> pixels, Span<uint> outPixels, Span<byte> outIndexes = default) {
+            if (outPixels.Length < pixels.Length) throw new ArgumentOutOfRangeException(nameof(outPixels), "存放颜色的缓冲区太小");
+            if (!outIndexes.IsEmpty && outIndexes.Length < pixels.Length) throw new ArgumentOutOfRangeException(nameof(outIndexes), "存放索引的缓冲区太小");
+
+            Native.PaletteMapRgb(ptr, ref MemoryMarshal.GetReference(pixels), ref MemoryMarshal.GetReference(outPixels), ref MemoryMarshal.GetReference(outIndexes), pixels.Length);
+        }
+
         /// <summary>
         /// 使用抖动处理来获得颜色索引
         /// </summary>
@@ -82,6 +198,24 @@ namespace ColorQuantizationSharp {
             Native.PaletteDither(ptr, ref MemoryMarshal.GetReference(pixels), ref MemoryMarshal.GetReference(indexes), width, height);
         }
 
+        /// <summary>
+        /// 使用抖动处理来获得颜色索引，并同时统计抖动结果与原图之间的误差
+        /// </summary>
+        /// <param name="pixels"></param>
+        /// <param name="indexes"></param>
+        /// <param name="width"></param>
+        /// <param name="height"></param>
+        /// <param name="metrics">原图与抖动结果之间的误差</param>
+        /// <exception cref="ArgumentOutOfRangeException"></exception>
+        public void Dither(Span<uint> pixels, Span<byte> indexes, int width, int height, out QuantizationMetrics metrics) {
+            if (width <= 0) throw new ArgumentOutOfRangeException(nameof(width));
+            if (height <= 0) throw new ArgumentOutOfRangeException(nameof(height));
+            if (width * height > pixels.Length) throw new ArgumentOutOfRangeException(nameof(pixels));
+            if (width * height > indexes.Length) throw new ArgumentOutOfRangeException(nameof(indexes));
+
+            Native.PaletteDitherMetrics(ptr, ref MemoryMarshal.GetReference(pixels), ref MemoryMarshal.GetReference(indexes), width, height, out metrics);
+        }
+
         /// <summary>
         /// 使用抖动处理来获得颜色索引
         /// </summary>
@@ -100,6 +234,70 @@ namespace ColorQuantizationSharp {
             return indexes;
         }
 
+        /// <summary>
+        /// 计算按位打包的索引图像每行所占的字节数
+        /// </summary>
+        /// <param name="width"></param>
+        /// <param name="bitDepth">每个像素的位数，只能是1、2、4或8</param>
+        /// <param name="rowAlignment">每行字节数的对齐值，例如PNG为1，BMP为4</param>
+        /// <returns></returns>
+        /// <exception cref="ArgumentOutOfRangeException"></exception>
+        public static int PackedStride(int width, int bitDepth, int rowAlignment = 1) {
+            if (width <= 0) throw new ArgumentOutOfRangeException(nameof(width));
+
+            nint stride = Native.PalettePackedStride(width, bitDepth, rowAlignment);
+            if (stride < 0) throw new ArgumentOutOfRangeException(nameof(bitDepth), "位数只能是1、2、4或8，且对齐值必须大于0");
+            return (int)stride;
+        }
+
+        /// <summary>
+        /// 将每个像素映射到距离最近的颜色索引，并按位打包输出。
+        /// <para>每个字节存放8/<paramref name="bitDepth"/>个像素，最左边的像素位于最高位；每行末尾的填充位为0。</para>
+        /// </summary>
+        /// <param name="pixels"></param>
+        /// <param name="outIndexes">大小至少为<see cref="PackedStride"/>*<paramref name="height"/></param>
+        /// <param name="width"></param>
+        /// <param name="height"></param>
+        /// <param name="bitDepth">每个像素的位数，只能是1、2、4或8，且颜色表大小不能超过2^<paramref name="bitDepth"/></param>
+        /// <param name="rowAlignment">每行字节数的对齐值</param>
+        /// <returns>每行的字节数</returns>
+        /// <exception cref="ArgumentOutOfRangeException"></exception>
+        public int MapPacked(ReadOnlySpan<uint> pixels, Span<byte> outIndexes, int width, int height, int bitDepth, int rowAlignment = 1) {
+            if (height <= 0) throw new ArgumentOutOfRangeException(nameof(height));
+            if (width * height > pixels.Length) throw new ArgumentOutOfRangeException(nameof(pixels));
+            if (ColorTable.Length > 1 << Math.Min(bitDepth, 8)) throw new ArgumentOutOfRangeException(nameof(bitDepth), "颜色表太大，无法用该位数表示");
+
+            int stride = PackedStride(width, bitDepth, rowAlignment);
+            if (stride * height > outIndexes.Length) throw new ArgumentOutOfRangeException(nameof(outIndexes), "存放索引的缓冲区太小");
+
+            Native.PaletteMapPacked(ptr, ref MemoryMarshal.GetReference(pixels), ref MemoryMarshal.GetReference(outIndexes), width, height, bitDepth, rowAlignment);
+            return stride;
+        }
+
+        /// <summary>
+        /// 使用抖动处理来获得颜色索引，并按位打包输出。
+        /// <para>每个字节存放8/<paramref name="bitDepth"/>个像素，最左边的像素位于最高位；每行末尾的填充位为0。</para>
+        /// </summary>
+        /// <param name="pixels"></param>
+        /// <param name="outIndexes">大小至少为<see cref="PackedStride"/>*<paramref name="height"/></param>
+        /// <param name="width"></param>
+        /// <param name="height"></param>
+        /// <param name="bitDepth">每个像素的位数，只能是1、2、4或8，且颜色表大小不能超过2^<paramref name="bitDepth"/></param>
+        /// <param name="rowAlignment">每行字节数的对齐值</param>
+        /// <returns>每行的字节数</returns>
+        /// <exception cref="ArgumentOutOfRangeException"></exception>
+        public int DitherPacked(Span<uint> pixels, Span<byte> outIndexes, int width, int height, int bitDepth, int rowAlignment = 1) {
+            if (height <= 0) throw new ArgumentOutOfRangeException(nameof(height));
+            if (width * height > pixels.Length) throw new ArgumentOutOfRangeException(nameof(pixels));
+            if (ColorTable.Length > 1 << Math.Min(bitDepth, 8)) throw new ArgumentOutOfRangeException(nameof(bitDepth), "颜色表太大，无法用该位数表示");
+
+            int stride = PackedStride(width, bitDepth, rowAlignment);
+            if (stride * height > outIndexes.Length) throw new ArgumentOutOfRangeException(nameof(outIndexes), "存放索引的缓冲区太小");
+
+            Native.PaletteDitherPacked(ptr, ref MemoryMarshal.GetReference(pixels), ref MemoryMarshal.GetReference(outIndexes), width, height, bitDepth, rowAlignment);
+            return stride;
+        }
+
         protected virtual void Dispose(bool disposing) {
             if (ptr != IntPtr.Zero) {
                 Native.PaletteDestroy(ptr);
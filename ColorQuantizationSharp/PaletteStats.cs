@@ -0,0 +1,23 @@
+﻿using System.Runtime.InteropServices;
+
+namespace ColorQuantizationSharp {
+    /// <summary>
+    /// <see cref="Palette"/>自创建以来的内部计数。
+    /// <para>仅当原生库以COLORQUANTIZATION_STATS编译时才会统计。</para>
+    /// </summary>
+    [StructLayout(LayoutKind.Sequential)]
+    unsafe public struct PaletteStats {
+        public ulong CacheHits;
+        public ulong CacheMisses;
+        public ulong CandidatesExamined;
+        /// <summary>
+        /// 按比较的候选颜色数分组的缓存未命中次数，第k组为(2^(k-1), 2^k]
+        /// </summary>
+        public fixed ulong CandidateHistogram[9];
+
+        /// <summary>
+        /// 缓存命中率
+        /// </summary>
+        public double HitRate => CacheHits + CacheMisses == 0 ? 0 : (double)CacheHits / (CacheHits + CacheMisses);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,20 @@
+﻿using System;
+using System.Runtime.InteropServices;
+
+namespace ColorQuantizationSharp {
+    [StructLayout(LayoutKind.Sequential)]
+    unsafe internal struct QuantizationJobDesc {
+        public uint* Pixels;
+        public nint Width;
+        public nint Height;
+        public byte* Indexes;
+        public uint* ColorTable;
+        public nint TableLength;
+        public uint* ForceColors;
+        public nint ForceColorCount;
+        public byte Optimize;
+        public byte Dither;
+        public delegate* unmanaged<void*, nint, void> Callback;
+        public void* UserData;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,32 @@
+﻿using System;
+using System.Runtime.InteropServices;
+
+namespace ColorQuantizationSharp {
+    /// <summary>
+    /// 原图与量化结果之间的误差，通道顺序为R、G、B。
+    /// </summary>
+    [StructLayout(LayoutKind.Sequential)]
+    unsafe public struct QuantizationMetrics {
+        public ulong PixelCount;
+        public fixed ulong SquaredError[3];
+        public fixed uint MaxError[3];
+        public fixed ulong Usage[256];
+
+        /// <summary>
+        /// 所有通道的均方误差
+        /// </summary>
+        public double Mse => PixelCount == 0 ? 0 : (double)(SquaredError[0] + SquaredError[1] + SquaredError[2]) / (PixelCount * 3);
+
+        /// <summary>
+        /// 峰值信噪比（dB），无误差时为正无穷
+        /// </summary>
+        public double Psnr => 10 * Math.Log10(255.0 * 255.0 / Mse);
+
+        /// <summary>
+        /// 指定通道的均方误差
+        /// </summary>
+        /// <param name="channel">0为R，1为G，2为B</param>
+        /// <returns></returns>
+        public double ChannelMse(int channel) => PixelCount == 0 ? 0 : (double)SquaredError[channel] / PixelCount;
+    }
+}
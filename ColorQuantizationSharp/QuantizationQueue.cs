@@ -0,0 +1,125 @@
+﻿using System;
+using System.Buffers;
+using System.Runtime.InteropServices;
+using System.Threading.Tasks;
+
+namespace ColorQuantizationSharp {
+    /// <summary>
+    /// 在<see cref="Scheduler"/>的工作线程上异步完成“提取调色板、构造调色板、映射或抖动”的整个流程。
+    /// <para>每一帧分为提取和映射两个阶段，可以与其它帧的不同阶段同时执行；提取器与调色板在内部复用，避免每帧重新分配。</para>
+    /// </summary>
+    unsafe public class QuantizationQueue : IDisposable {
+        private IntPtr ptr;
+
+        /// <summary>
+        /// 构造一个量化队列。
+        /// </summary>
+        /// <param name="concurrency">最多同时执行的阶段数，0表示与<see cref="Scheduler.WorkerCount"/>相同</param>
+        /// <param name="maxPendingJobs">最多同时处理的帧数，队列已满时<see cref="QuantizeAsync"/>会阻塞，0表示<paramref name="concurrency"/>的2倍</param>
+        /// <exception cref="ArgumentOutOfRangeException"></exception>
+        public QuantizationQueue(int concurrency = 0, int maxPendingJobs = 0) {
+            if (concurrency < 0) throw new ArgumentOutOfRangeException(nameof(concurrency));
+            if (maxPendingJobs < 0) throw new ArgumentOutOfRangeException(nameof(maxPendingJobs));
+
+            ptr = Native.JobQueueCreate(concurrency, maxPendingJobs);
+        }
+
+        /// <summary>
+        /// 提交一帧图像，从中提取<paramref name="colorTable"/>.Length种颜色，并将每个像素映射到颜色索引。
+        /// <para>任务完成前不能修改或释放传入的缓冲区。</para>
+        /// </summary>
+        /// <param name="pixels">图像像素，抖动时会被修改</param>
+        /// <param name="width"></param>
+        /// <param name="height"></param>
+        /// <param name="indexes">存放颜色索引</param>
+        /// <param name="colorTable">存放提取的颜色，长度即为颜色数（最多256）</param>
+        /// <param name="forceColors">必须包含的颜色</param>
+        /// <param name="optimize">参见<see cref="Palette(ReadOnlySpan{uint}, bool)"/></param>
+        /// <param name="dither">如果该参数为true，则进行抖动处理</param>
+        /// <returns>实际提取的颜色数</returns>
+        /// <exception cref="ArgumentOutOfRangeException"></exception>
+        public Task<int> QuantizeAsync(Memory<uint> pixels, int width, int height, Memory<byte> indexes, Memory<uint> colorTable, ReadOnlyMemory<uint> forceColors = default, bool optimize = true, bool dither = false) {
+            if (width <= 0) throw new ArgumentOutOfRangeException(nameof(width));
+            if (height <= 0) throw new ArgumentOutOfRangeException(nameof(height));
+            if ((long)width * height > pixels.Length) throw new ArgumentOutOfRangeException(nameof(pixels));
+            if ((long)width * height > indexes.Length) throw new ArgumentOutOfRangeException(nameof(indexes), "存放索引的缓冲区太小");
+            if (colorTable.IsEmpty || colorTable.Length > 256) throw new ArgumentOutOfRangeException(nameof(colorTable), "颜色表大小必须在1到256之间");
+            if (forceColors.Length > colorTable.Length) throw new ArgumentOutOfRangeException(nameof(forceColors), "强制颜色数不能超过颜色表大小");
+
+            var job = new Job(pixels.Pin(), indexes.Pin(), colorTable.Pin(), forceColors.Pin());
+            var handle = GCHandle.Alloc(job);
+            var desc = new QuantizationJobDesc {
+                Pixels = (uint*)job.Pixels.Pointer,
+                Width = width,
+                Height = height,
+                Indexes = (byte*)job.Indexes.Pointer,
+                ColorTable = (uint*)job.ColorTable.Pointer,
+                TableLength = colorTable.Length,
+                ForceColors = (uint*)job.ForceColors.Pointer,
+                ForceColorCount = forceColors.Length,
+                Optimize = optimize ? (byte)1 : (byte)0,
+                Dither = dither ? (byte)1 : (byte)0,
+                Callback = &OnCompleted,
+                UserData = (void*)GCHandle.ToIntPtr(handle),
+            };
+
+            IntPtr jobPtr = Native.JobSubmit(ptr, desc);
+            if (jobPtr == IntPtr.Zero) {
+                handle.Free();
+                job.Unpin();
+                throw new ArgumentOutOfRangeException(nameof(colorTable));
+            }
+            Native.JobRelease(jobPtr);
+            return job.Completion.Task;
+        }
+
+        [UnmanagedCallersOnly]
+        private static void OnCompleted(void* userData, nint colorCount) {
+            var handle = GCHandle.FromIntPtr((IntPtr)userData);
+            var job = (Job)handle.Target!;
+            handle.Free();
+            job.Unpin();
+            job.Completion.SetResult((int)colorCount);
+        }
+
+        private sealed class Job {
+            public MemoryHandle Pixels, Indexes, ColorTable, ForceColors;
+            // 回调在原生工作线程上执行，后续操作不能在该线程上同步运行
+            public readonly TaskCompletionSource<int> Completion = new(TaskCreationOptions.RunContinuationsAsynchronously);
+
+            public Job(MemoryHandle pixels, MemoryHandle indexes, MemoryHandle colorTable, MemoryHandle forceColors) {
+                Pixels = pixels;
+                Indexes = indexes;
+                ColorTable = colorTable;
+                ForceColors = forceColors;
+            }
+
+            public void Unpin() {
+                Pixels.Dispose();
+                Indexes.Dispose();
+                ColorTable.Dispose();
+                ForceColors.Dispose();
+            }
+        }
+
+        /// <summary>
+        /// 等待所有已提交的帧处理完成后释放。
+        /// </summary>
+        /// <param name="disposing"></param>
+        protected virtual void Dispose(bool disposing) {
+            if (ptr != IntPtr.Zero) {
+                Native.JobQueueDestroy(ptr);
+                ptr = IntPtr.Zero;
+            }
+        }
+
+        ~QuantizationQueue() {
+            Dispose(disposing: false);
+        }
+
+        public void Dispose() {
+            Dispose(disposing: true);
+            GC.SuppressFinalize(this);
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,19 @@
+﻿namespace ColorQuantizationSharp {
+    /// <summary>
+    /// <see cref="SpaceShockColorExtractor.AddBitmap(System.ReadOnlySpan{uint}, int, int, SampleMode, int)"/>的采样方式。
+    /// </summary>
+    public enum SampleMode : uint {
+        /// <summary>
+        /// 按扫描顺序每ratio个像素取中间一个，最快，但可能与图像中的周期性图案重合
+        /// </summary>
+        Stride,
+        /// <summary>
+        /// 将图像划分为约ratio个像素的格子，每格取一个伪随机位置的像素
+        /// </summary>
+        Stratified,
+        /// <summary>
+        /// 低差异点集，均匀分布且没有规则网格
+        /// </summary>
+        LowDiscrepancy,
+    }
+}
\ No newline at end of file
@@ -0,0 +1,61 @@
+﻿using System;
+using System.Runtime.InteropServices;
+using System.Threading;
+
+namespace ColorQuantizationSharp {
+    /// <summary>
+    /// 原生库共用的工作线程，映射、抖动、构造调色板和<see cref="QuantizationQueue"/>都在这些线程上并行执行。
+    /// <para>并行结果与线程数无关，任何配置下输出都逐字节相同。</para>
+    /// <para>默认使用（可用CPU数-1）个工作线程，调用线程也参与计算。请在没有其它调用进行时修改配置。</para>
+    /// </summary>
+    unsafe public static class Scheduler {
+        /// <summary>
+        /// 当前可同时运行的工作线程数（或外部执行器的并发数），0表示所有计算都在调用线程上完成
+        /// </summary>
+        public static int WorkerCount => (int)Native.SchedulerWorkerCount();
+
+        /// <summary>
+        /// 设置工作线程数，并可将第i个工作线程绑定到CPU <paramref name="cpus"/>[i % cpus.Length]。
+        /// </summary>
+        /// <param name="workerCount">工作线程数，0表示不使用额外线程</param>
+        /// <param name="cpus">要绑定的CPU编号，为空时不绑定</param>
+        /// <returns>是否所有工作线程都绑定成功，失败时线程仍可正常工作</returns>
+        /// <exception cref="ArgumentOutOfRangeException"></exception>
+        public static bool Configure(int workerCount, ReadOnlySpan<int> cpus = default) {
+            if (workerCount < 0) throw new ArgumentOutOfRangeException(nameof(workerCount));
+
+            nint* cpuIndexes = stackalloc nint[cpus.Length];
+            for (int i = 0; i < cpus.Length; i++) {
+                if (cpus[i] < 0) throw new ArgumentOutOfRangeException(nameof(cpus));
+                cpuIndexes[i] = cpus[i];
+            }
+            return Native.SchedulerConfigure(workerCount, cpuIndexes, cpus.Length);
+        }
+
+        /// <summary>
+        /// 不再使用原生工作线程，改为把任务交给.NET线程池执行。
+        /// </summary>
+        /// <param name="concurrency">每次并行计算最多提交的任务数，0表示<see cref="Environment.ProcessorCount"/>-1</param>
+        /// <exception cref="ArgumentOutOfRangeException"></exception>
+        public static void UseThreadPool(int concurrency = 0) {
+            if (concurrency < 0) throw new ArgumentOutOfRangeException(nameof(concurrency));
+            if (concurrency == 0) concurrency = Math.Max(Environment.ProcessorCount - 1, 1);
+
+            Native.SchedulerSetExecutor(&Execute, null, concurrency);
+        }
+
+        /// <summary>
+        /// 恢复为默认的原生工作线程。
+        /// </summary>
+        public static void Reset() {
+            Native.SchedulerSetExecutor(null, null, 0);
+        }
+
+        [UnmanagedCallersOnly]
+        private static void Execute(void* executorData, delegate* unmanaged<void*, void> task, void* taskData) {
+            ThreadPool.UnsafeQueueUserWorkItem(static state => {
+                ((delegate* unmanaged<void*, void>)state.Task)((void*)state.Data);
+            }, (Task: (IntPtr)task, Data: (IntPtr)taskData), preferLocal: false);
+        }
+    }
+}
\ No newline at end of file
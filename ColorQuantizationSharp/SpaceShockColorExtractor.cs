@@ -3,6 +3,13 @@ using System.Runtime.CompilerServices;
 using System.Runtime.InteropServices;
 
 namespace ColorQuantizationSharp {
+    /// <summary>
+    /// 填充<paramref name="buffer"/>并返回读取的像素数，返回0表示没有更多像素。
+    /// </summary>
+    /// <param name="buffer"></param>
+    /// <returns></returns>
+    public delegate int ReadPixelsCallback(Span<uint> buffer);
+
     unsafe public class SpaceShockColorExtractor : IDisposable {
         private IntPtr ptr;
 
@@ -19,12 +26,95 @@ namespace ColorQuantizationSharp {
             Native.AddBitmap(ptr, ref MemoryMarshal.GetReference(pixels), pixels.Length);
         }
 
+        /// <summary>
+        /// 只读取约1/<paramref name="ratio"/>的像素来添加图像，适合为大图生成预览或缩略图。
+        /// <para>每个采样像素按其代表的像素数计数，颜色表的计算方式与添加完整图像时相同。</para>
+        /// </summary>
+        /// <param name="pixels"></param>
+        /// <param name="width"></param>
+        /// <param name="height"></param>
+        /// <param name="mode">采样方式</param>
+        /// <param name="ratio">采样间隔，1表示读取所有像素</param>
+        /// <returns>实际读取的像素数</returns>
+        /// <exception cref="ArgumentOutOfRangeException"></exception>
+        public long AddBitmap(ReadOnlySpan<uint> pixels, int width, int height, SampleMode mode, int ratio) {
+            if (width < 0) throw new ArgumentOutOfRangeException(nameof(width));
+            if (height < 0) throw new ArgumentOutOfRangeException(nameof(height));
+            if ((long)width * height > pixels.Length) throw new ArgumentOutOfRangeException(nameof(pixels));
+            if (mode > SampleMode.LowDiscrepancy) throw new ArgumentOutOfRangeException(nameof(mode));
+            if (ratio <= 0) throw new ArgumentOutOfRangeException(nameof(ratio));
+
+            return Native.AddBitmapSampled(ptr, ref MemoryMarshal.GetReference(pixels), width, height, mode, ratio);
+        }
+
+        /// <summary>
+        /// 分块读取图像并添加进<see cref="SpaceShockColorExtractor"/>对象中，内存占用只与缓冲区大小有关。
+        /// <para><paramref name="readPixels"/>每次填充传入的缓冲区并返回读取的像素数，返回0表示结束。</para>
+        /// </summary>
+        /// <param name="readPixels"></param>
+        /// <param name="bufferLength">每次读取的最大像素数</param>
+        /// <returns>读取的像素总数</returns>
+        /// <exception cref="ArgumentOutOfRangeException"></exception>
+        public long AddBitmap(ReadPixelsCallback readPixels, int bufferLength = 0x100000) {
+            if (bufferLength <= 0) throw new ArgumentOutOfRangeException(nameof(bufferLength));
+
+            var handle = GCHandle.Alloc(readPixels);
+            try {
+                return Native.AddBitmapStream(ptr, &ReadPixels, (void*)GCHandle.ToIntPtr(handle), bufferLength);
+            } finally {
+                handle.Free();
+            }
+        }
+
+        [UnmanagedCallersOnly]
+        private static nint ReadPixels(void* userData, uint* buffer, nint bufferLength) {
+            var readPixels = (ReadPixelsCallback)GCHandle.FromIntPtr((IntPtr)userData).Target!;
+            return readPixels(new Span<uint>(buffer, (int)bufferLength));
+        }
+
+        /// <summary>
+        /// 将颜色直方图添加进<see cref="SpaceShockColorExtractor"/>对象中，等价于添加每种颜色对应数量的像素。
+        /// </summary>
+        /// <param name="colors"></param>
+        /// <param name="counts">每种颜色的像素数</param>
+        /// <exception cref="ArgumentException"></exception>
+        public void AddHistogram(ReadOnlySpan<uint> colors, ReadOnlySpan<uint> counts) {
+            if (colors.Length != counts.Length) throw new ArgumentException("颜色与数量的长度不一致", nameof(counts));
+
+            Native.AddHistogram(ptr, ref MemoryMarshal.GetReference(colors), ref MemoryMarshal.GetReference(counts), colors.Length);
+        }
+
+        /// <summary>
+        /// 合并<see cref="ExportHistogram"/>导出的直方图。
+        /// <para>按顺序合并多个分片的直方图，与依次对各分片调用<see cref="AddBitmap(ReadOnlySpan{uint})"/>的结果完全相同。</para>
+        /// </summary>
+        /// <param name="histogram"></param>
+        /// <returns>合并的颜色数</returns>
+        /// <exception cref="InvalidDataException"></exception>
+        public int AddHistogram(ReadOnlySpan<byte> histogram) {
+            nint colorCount = Native.AddHistogramBuffer(ptr, ref MemoryMarshal.GetReference(histogram), histogram.Length);
+            if (colorCount < 0) throw new InvalidDataException("直方图数据无效");
+            return (int)colorCount;
+        }
+
+        /// <summary>
+        /// 将已添加的所有颜色及其数量导出为紧凑的二进制直方图，可在其它进程中用<see cref="AddHistogram(ReadOnlySpan{byte})"/>合并。
+        /// </summary>
+        /// <returns></returns>
+        public byte[] ExportHistogram() {
+            var histogram = new byte[Native.GetHistogram(ptr, null, 0)];
+            fixed (byte* buffer = histogram) {
+                Native.GetHistogram(ptr, buffer, histogram.Length);
+            }
+            return histogram;
+        }
+
         /// <summary>
         /// 获得调色板颜色表。
-        /// <para>注意：此方法具有副作用，如需复用对象请先调用<see cref="Reset"/>方法。</para>
+        /// <para>此方法不会修改已添加的颜色计数，可以在增删图像后再次调用。</para>
         /// </summary>
         /// <param name="colorTable"></param>
-        /// <param name="forceColors">强制颜色表，调色板中一定会出现这些颜色。</param>
+        /// <param name="forceColors">强制颜色表，调色板中一定会出现这些颜色。处理视频帧时可传入上一帧调色板的主要颜色以减少闪烁。</param>
         /// <returns></returns>
         /// <exception cref="ArgumentOutOfRangeException"></exception>
         public int GetColorTable(Span<uint> colorTable, ReadOnlySpan<uint> forceColors = default) {
@@ -35,10 +125,10 @@ namespace ColorQuantizationSharp {
 
         /// <summary>
         /// 获得调色板颜色表。
-        /// <para>注意：此方法具有副作用，如需复用对象请先调用<see cref="Reset"/>方法。</para>
+        /// <para>此方法不会修改已添加的颜色计数，可以在增删图像后再次调用。</para>
         /// </summary>
         /// <param name="tableLength"></param>
-        /// <param name="forceColors">强制颜色表，调色板中一定会出现这些颜色。</param>
+        /// <param name="forceColors">强制颜色表，调色板中一定会出现这些颜色。处理视频帧时可传入上一帧调色板的主要颜色以减少闪烁。</param>
         /// <returns></returns>
         /// <exception cref="ArgumentOutOfRangeException"></exception>
         public uint[] GetColorTable(int tableLength, ReadOnlySpan<uint> forceColors = default) {
@@ -48,6 +138,93 @@ namespace ColorQuantizationSharp {
             return new Span<uint>(colorTable, tableLength).ToArray();
         }
 
+        /// <summary>
+        /// 在限定的时间或工作量内获得调色板颜色表，超出预算时会降低质量，但总是返回完整的颜色表。
+        /// <para>工作量按吸收时访问的颜色格数和合并时的比较次数计算，只限制工作量时结果与运行速度无关。</para>
+        /// </summary>
+        /// <param name="colorTable"></param>
+        /// <param name="deadline">时间预算，<see cref="TimeSpan.Zero"/>表示不限</param>
+        /// <param name="shortcuts">为不超出预算而采取的简化措施</param>
+        /// <param name="forceColors">参见<see cref="GetColorTable(Span{uint}, ReadOnlySpan{uint})"/></param>
+        /// <param name="maxWork">工作量预算，0表示不限</param>
+        /// <returns></returns>
+        /// <exception cref="ArgumentOutOfRangeException"></exception>
+        public int GetColorTable(Span<uint> colorTable, TimeSpan deadline, out ColorTableShortcuts shortcuts, ReadOnlySpan<uint> forceColors = default, long maxWork = 0) {
+            if (deadline < TimeSpan.Zero) throw new ArgumentOutOfRangeException(nameof(deadline));
+            if (maxWork < 0) throw new ArgumentOutOfRangeException(nameof(maxWork));
+
+            var budget = new ColorTableBudget {
+                DeadlineNanoseconds = (ulong)deadline.Ticks * 100,
+                MaxWork = (ulong)maxWork,
+            };
+            int tableLength = (int)Native.GetColorTableBudget(ptr, ref MemoryMarshal.GetReference(colorTable), colorTable.Length, ref MemoryMarshal.GetReference(forceColors), forceColors.Length, budget, out shortcuts);
+            if (tableLength < 0) throw new ArgumentOutOfRangeException(nameof(colorTable), "颜色表空间不能小于强制颜色表的大小");
+            return tableLength;
+        }
+
+        /// <summary>
+        /// 先在每通道<paramref name="channelBits"/>位的粗糙直方图上获得调色板颜色表，再对照完整直方图在每个颜色附近修正。
+        /// <para>适用于颜色种类极多的图像，速度远快于<see cref="GetColorTable(Span{uint}, ReadOnlySpan{uint})"/>，质量略有差异。</para>
+        /// </summary>
+        /// <param name="colorTable">颜色表空间，最多256个颜色</param>
+        /// <param name="channelBits">粗糙直方图每通道的位数，只能是5或6，更粗的网格反而需要修正更多颜色</param>
+        /// <param name="forceColors">参见<see cref="GetColorTable(Span{uint}, ReadOnlySpan{uint})"/></param>
+        /// <returns></returns>
+        /// <exception cref="ArgumentOutOfRangeException"></exception>
+        public int GetColorTableCoarse(Span<uint> colorTable, int channelBits = 5, ReadOnlySpan<uint> forceColors = default) {
+            if (colorTable.Length > 256) throw new ArgumentOutOfRangeException(nameof(colorTable), "颜色表空间不能超过256");
+            if (channelBits < 5 || channelBits > 6) throw new ArgumentOutOfRangeException(nameof(channelBits), "每通道位数只能是5或6");
+
+            int tableLength = (int)Native.GetColorTableCoarse(ptr, ref MemoryMarshal.GetReference(colorTable), colorTable.Length, ref MemoryMarshal.GetReference(forceColors), forceColors.Length, channelBits);
+            if (tableLength < 0) throw new ArgumentOutOfRangeException(nameof(colorTable), "颜色表空间不能小于强制颜色表的大小");
+            return tableLength;
+        }
+
+        /// <summary>
+        /// 从<see cref="SpaceShockColorExtractor"/>对象中移除之前添加过的图像，用于对视频帧维护滑动窗口。
+        /// </summary>
+        /// <param name="pixels"></param>
+        public void RemoveBitmap(ReadOnlySpan<uint> pixels) {
+            Native.RemoveBitmap(ptr, ref MemoryMarshal.GetReference(pixels), pixels.Length);
+        }
+
+        /// <summary>
+        /// 将所有颜色计数乘以<paramref name="factor"/>，在添加每一帧之前调用即可得到按指数衰减的直方图。
+        /// </summary>
+        /// <param name="factor">衰减系数，范围[0, 1]</param>
+        public void Decay(double factor) {
+            Native.Decay(ptr, factor);
+        }
+
+        /// <summary>
+        /// 自上次获取颜色表以来直方图变化的比例，尚未获取过颜色表时为正无穷。
+        /// <para>可用于决定何时重新计算调色板，例如每K帧或超过某个阈值时。</para>
+        /// </summary>
+        public double Drift => Native.ExtractorDrift(ptr);
+
+        private ColorMetric metric = ColorMetric.Rgb;
+
+        /// <summary>
+        /// 获取颜色表时合并相近颜色所用的颜色距离，应与之后构造<see cref="Palette"/>时使用的相同。<see cref="Reset"/>不会改变该设置。
+        /// </summary>
+        /// <exception cref="ArgumentOutOfRangeException"></exception>
+        public ColorMetric Metric {
+            get => metric;
+            set {
+                if (!Native.ExtractorSetMetric(ptr, value)) throw new ArgumentOutOfRangeException(nameof(value));
+                metric = value;
+            }
+        }
+
+        /// <summary>
+        /// 读取内部计数，用于分析性能。
+        /// </summary>
+        /// <param name="stats"></param>
+        /// <returns>原生库未以COLORQUANTIZATION_STATS编译时返回false，此时计数全为0</returns>
+        public bool TryGetStats(out ExtractorStats stats) {
+            return Native.ExtractorStats(ptr, out stats);
+        }
+
         /// <summary>
         /// 将内部所有缓存清零。
         /// <para>需要使用<see cref="AddBitmap"/>重新添加图像才可以再获取调色板颜色表。</para>
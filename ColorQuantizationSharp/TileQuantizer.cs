@@ -0,0 +1,73 @@
+﻿using System;
+using System.Runtime.CompilerServices;
+using System.Runtime.InteropServices;
+
+namespace ColorQuantizationSharp {
+    /// <summary>
+    /// 为图像的每个分块（如纹理图集中的精灵）单独提取调色板并映射。
+    /// <para>每个分块只读取一次像素，并使用与其颜色数相称的紧凑直方图，不需要为每块创建<see cref="SpaceShockColorExtractor"/>；所有分块并行处理。</para>
+    /// </summary>
+    public static class TileQuantizer {
+        /// <summary>
+        /// 按行优先顺序将图像切成<paramref name="tileWidth"/>×<paramref name="tileHeight"/>的分块，最后一列和最后一行截到图像边界。
+        /// </summary>
+        /// <param name="width"></param>
+        /// <param name="height"></param>
+        /// <param name="tileWidth"></param>
+        /// <param name="tileHeight"></param>
+        /// <returns></returns>
+        /// <exception cref="ArgumentOutOfRangeException"></exception>
+        public static TileRect[] Grid(int width, int height, int tileWidth, int tileHeight) {
+            if (width < 0) throw new ArgumentOutOfRangeException(nameof(width));
+            if (height < 0) throw new ArgumentOutOfRangeException(nameof(height));
+            if (tileWidth <= 0) throw new ArgumentOutOfRangeException(nameof(tileWidth));
+            if (tileHeight <= 0) throw new ArgumentOutOfRangeException(nameof(tileHeight));
+
+            var tiles = new TileRect[(int)Native.TilesGrid(width, height, tileWidth, tileHeight, ref Unsafe.NullRef<TileRect>(), 0)];
+            Native.TilesGrid(width, height, tileWidth, tileHeight, ref MemoryMarshal.GetArrayDataReference(tiles), tiles.Length);
+            return tiles;
+        }
+
+        /// <summary>
+        /// 为每个分块提取最多<paramref name="tableLength"/>种颜色的调色板，并用它映射该分块。
+        /// </summary>
+        /// <param name="pixels">整幅图像</param>
+        /// <param name="width"></param>
+        /// <param name="height"></param>
+        /// <param name="tiles">分块，允许重叠</param>
+        /// <param name="tableLength">每个分块调色板的最大颜色数，不超过256</param>
+        /// <param name="colorTables">第i块的颜色表存放在从i*<paramref name="tableLength"/>开始的位置，不足部分填0</param>
+        /// <param name="tableLengths">每个分块实际的颜色数</param>
+        /// <param name="indexes">各分块的索引依次存放，块内按行排列</param>
+        /// <param name="metric">颜色距离</param>
+        /// <returns>写入的索引数，即所有分块的像素总数</returns>
+        /// <exception cref="ArgumentOutOfRangeException"></exception>
+        public static int Quantize(ReadOnlySpan<uint> pixels, int width, int height, ReadOnlySpan<TileRect> tiles, int tableLength,
+            Span<uint> colorTables, Span<int> tableLengths, Span<byte> indexes, ColorMetric metric = ColorMetric.Rgb) {
+            if (width < 0) throw new ArgumentOutOfRangeException(nameof(width));
+            if (height < 0) throw new ArgumentOutOfRangeException(nameof(height));
+            if ((long)width * height > pixels.Length) throw new ArgumentOutOfRangeException(nameof(pixels));
+            if (tableLength <= 0 || tableLength > 256) throw new ArgumentOutOfRangeException(nameof(tableLength), "颜色表大小必须在1到256之间");
+            if (metric > ColorMetric.Oklab) throw new ArgumentOutOfRangeException(nameof(metric));
+            if ((long)tiles.Length * tableLength > colorTables.Length) throw new ArgumentOutOfRangeException(nameof(colorTables), "存放颜色表的缓冲区太小");
+            if (tableLengths.Length < tiles.Length) throw new ArgumentOutOfRangeException(nameof(tableLengths), "存放颜色数的缓冲区太小");
+
+            long indexCount = 0;
+            foreach (var tile in tiles) {
+                if (tile.X < 0 || tile.Y < 0 || tile.Width < 0 || tile.Height < 0 || tile.X + tile.Width > width || tile.Y + tile.Height > height) {
+                    throw new ArgumentOutOfRangeException(nameof(tiles), "分块超出图像范围");
+                }
+                indexCount += tile.Area;
+            }
+            if (indexCount > indexes.Length) throw new ArgumentOutOfRangeException(nameof(indexes), "存放索引的缓冲区太小");
+
+            var lengths = new nint[tiles.Length];
+            Native.TilesQuantize(ref MemoryMarshal.GetReference(pixels), width, height, ref MemoryMarshal.GetReference(tiles), tiles.Length, tableLength, metric,
+                ref MemoryMarshal.GetReference(colorTables), ref MemoryMarshal.GetArrayDataReference(lengths), ref MemoryMarshal.GetReference(indexes));
+            for (int i = 0; i < lengths.Length; i++) {
+                tableLengths[i] = (int)lengths[i];
+            }
+            return (int)indexCount;
+        }
+    }
+}
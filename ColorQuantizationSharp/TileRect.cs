@@ -0,0 +1,26 @@
+﻿using System.Runtime.InteropServices;
+
+namespace ColorQuantizationSharp {
+    /// <summary>
+    /// 图像中的一个矩形区域，用于<see cref="TileQuantizer"/>。
+    /// </summary>
+    [StructLayout(LayoutKind.Sequential)]
+    public struct TileRect {
+        public nint X;
+        public nint Y;
+        public nint Width;
+        public nint Height;
+
+        public TileRect(int x, int y, int width, int height) {
+            X = x;
+            Y = y;
+            Width = width;
+            Height = height;
+        }
+
+        /// <summary>
+        /// 区域内的像素数
+        /// </summary>
+        public long Area => (long)Width * Height;
+    }
+}
\ No newline at end of file
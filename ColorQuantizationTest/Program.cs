@@ -1,7 +1,5 @@
 ﻿using System.Drawing;
 using System.Drawing.Imaging;
-using System.Runtime.CompilerServices;
-using System.Runtime.InteropServices;
 using ColorQuantizationSharp;
 
 const string BitmapFilename = @"Z:\yande.re 96993 akino_momiji cuffs gayarou loli naked nipples pussy_juice sakura_musubi wallpaper.png";
@@ -23,21 +21,12 @@ unsafe static (uint[] ColorTable, byte[] Indexes) PaletteMap(Bitmap bitmap, int
     using var extractor = new SpaceShockColorExtractor();
     var data = bitmap.LockBits(new Rectangle(0, 0, bitmap.Width, bitmap.Height), ImageLockMode.ReadWrite, PixelFormat.Format32bppRgb);
     try {
-        var pixels = new ReadOnlySpan<uint>((void*)data.Scan0, data.Width * data.Height);
+        var pixels = new Span<uint>((void*)data.Scan0, data.Width * data.Height);
         extractor.AddBitmap(pixels);
         uint[] colorTable = extractor.GetColorTable(colorCount, forceColors);
         using var palette = new Palette(colorTable, optimize: true);
-        byte[] indexes = palette.Map(pixels);
-
-        ref uint palettePtr = ref MemoryMarshal.GetArrayDataReference(colorTable);
-        ref byte indexPtr = ref MemoryMarshal.GetArrayDataReference(indexes);
-        uint* p = (uint*)data.Scan0;
-        nint bitmapLength = bitmap.Width * bitmap.Height;
-
-        for (nint i = 0; i < bitmapLength; i++) {
-            p[i] = Unsafe.Add(ref palettePtr, Unsafe.Add(ref indexPtr, i));
-        }
-
+        byte[] indexes = GC.AllocateUninitializedArray<byte>(pixels.Length);
+        palette.MapRgb(pixels, pixels, indexes);
         return (colorTable, indexes);
     } finally {
         bitmap.UnlockBits(data);